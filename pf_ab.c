@@ -0,0 +1,214 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "pf_dbg.h"
+#include "pf_conf.h"
+#include "pf_stat.h"
+#include "pf_hist.h"
+#include "pf_clock.h"
+#include "pf_ab.h"
+
+// a second needs some requests on both sides for its percentiles
+#define PF_AB_MIN_COUNT         10
+
+static const struct {
+	const char     *name;
+	int             lower_is_better;
+} pf_ab_metric[PF_AB_METRICS] = {
+	[PF_AB_RATE]    = { "ok/s",     0 },
+	[PF_AB_MEAN]    = { "mean us",  1 },
+	[PF_AB_P50]     = { "p50 us",   1 },
+	[PF_AB_P99]     = { "p99 us",   1 },
+};
+
+pf_ab_t *
+pf_ab_alloc (void)
+{
+	pf_ab_t *ab = calloc (1, sizeof (*ab));
+
+	if (!ab) BAIL ("calloc (pf_ab_t)");
+	ab->ns = pf_clock_read ();
+	return ab;
+}
+
+void
+pf_ab_sample (pf_ab_t *ab, const pf_stat_t *stat, int keep)
+{
+	pf_hist_t *rtt = malloc (sizeof (*rtt));
+	uint64_t now = pf_clock_read (), completed, n[2];
+	double sec = (now - ab->ns) / 1e9, *s;
+	uint b, t;
+
+	if (!rtt) BAIL ("malloc (pf_hist_t)");
+
+	// the slot is written, if not kept, during the warm-up too
+	if (ab->no_samples == ab->max_samples) {
+		ab->max_samples = ab->max_samples ? 2 * ab->max_samples : 64;
+		ab->sample = realloc (ab->sample,
+				ab->max_samples * sizeof (*ab->sample));
+		if (!ab->sample) BAIL ("realloc %u a/b samples",
+				ab->max_samples);
+	}
+	s = ab->sample[ab->no_samples][0];
+
+	for (b=0; b<2; b++) {
+		pf_hist_reset (rtt);
+		completed = 0;
+		for (t=0; t<stat->no_threads; t++) {
+			completed += tstat_read (&stat->thread[t].backend[b],
+					completed);
+			pf_hist_merge (rtt, &stat->thread[t].backend[b].rtt);
+		}
+
+		// this second only, then keep the totals for the next one
+		n[b] = completed - ab->completed[b];
+		ab->completed[b] = completed;
+		pf_hist_sub (rtt, &ab->rtt[b]);
+		pf_hist_merge (&ab->rtt[b], rtt);
+
+		s[b * PF_AB_METRICS + PF_AB_RATE] = sec ? n[b] / sec : 0;
+		s[b * PF_AB_METRICS + PF_AB_MEAN] = pf_hist_mean (rtt) / 1e3;
+		s[b * PF_AB_METRICS + PF_AB_P50] =
+			pf_hist_percentile (rtt, 50) / 1e3;
+		s[b * PF_AB_METRICS + PF_AB_P99] =
+			pf_hist_percentile (rtt, 99) / 1e3;
+		n[b] = rtt->count;
+	}
+	ab->ns = now;
+	free (rtt);
+
+	if (keep && n[0] >= PF_AB_MIN_COUNT && n[1] >= PF_AB_MIN_COUNT)
+		ab->no_samples++;
+}
+
+// ------------------------------------------------------------------------
+
+// continued fraction for the incomplete beta function, modified Lentz
+static double
+pf_ab_betacf (double a, double b, double x)
+{
+	const double tiny = 1e-300;
+	double c = 1, d = 1 - (a + b) * x / (a + 1), h, del, aa;
+	int m;
+
+	d = 1 / (fabs (d) < tiny ? tiny : d);
+	h = d;
+	for (m=1; m<300; m++) {
+		aa = m * (b - m) * x / ((a + 2*m - 1) * (a + 2*m));
+		d = 1 + aa * d;
+		c = 1 + aa / c;
+		d = 1 / (fabs (d) < tiny ? tiny : d);
+		c = fabs (c) < tiny ? tiny : c;
+		h *= d * c;
+
+		aa = -(a + m) * (a + b + m) * x / ((a + 2*m) * (a + 2*m + 1));
+		d = 1 + aa * d;
+		c = 1 + aa / c;
+		d = 1 / (fabs (d) < tiny ? tiny : d);
+		c = fabs (c) < tiny ? tiny : c;
+		del = d * c;
+		h *= del;
+		if (fabs (del - 1) < 1e-12)
+			break;
+	}
+	return h;
+}
+
+// regularized incomplete beta function I_x(a, b)
+static double
+pf_ab_betai (double a, double b, double x)
+{
+	double front;
+
+	if (x <= 0)
+		return 0;
+	if (x >= 1)
+		return 1;
+
+	front = exp (lgamma (a + b) - lgamma (a) - lgamma (b)
+			+ a * log (x) + b * log (1 - x));
+	if (x < (a + 1) / (a + b + 2))
+		return front * pf_ab_betacf (a, b, x) / a;
+	return 1 - front * pf_ab_betacf (b, a, 1 - x) / b;
+}
+
+// two-sided p-value of Student's t with df degrees of freedom
+static double
+pf_ab_p (double t, double df)
+{
+	return pf_ab_betai (df / 2, 0.5, df / (df + t * t));
+}
+
+// t such that 95% of the distribution lies within +-t
+static double
+pf_ab_t95 (double df)
+{
+	double lo = 0, hi = 1000, mid;
+	int i;
+
+	for (i=0; i<100; i++) {
+		mid = (lo + hi) / 2;
+		if (pf_ab_p (mid, df) > 0.05)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return hi;
+}
+
+void
+pf_ab_report (const pf_ab_t *ab, const pf_conf_t *conf)
+{
+	uint n = ab->no_samples, i, m;
+	double a, b, d, dd, sd, se, t, p, ci, t95;
+
+	printf ("a/b      A %s, B %s\n", conf->backend[0].name,
+			conf->backend[1].name);
+	if (n < 3) {
+		printf ("a/b      %u paired seconds, too few to tell B from "
+				"A; run longer\n", n);
+		return;
+	}
+
+	t95 = pf_ab_t95 (n - 1);
+	printf ("a/b      %u paired seconds, B - A with a 95%% confidence "
+			"interval:\n", n);
+
+	for (m=0; m<PF_AB_METRICS; m++) {
+		a = b = d = dd = 0;
+		for (i=0; i<n; i++) {
+			a += ab->sample[i][0][m];
+			b += ab->sample[i][1][m];
+			d += ab->sample[i][1][m] - ab->sample[i][0][m];
+		}
+		a /= n;
+		b /= n;
+		d /= n;
+		for (i=0; i<n; i++) {
+			double x = ab->sample[i][1][m] - ab->sample[i][0][m]
+				- d;
+			dd += x * x;
+		}
+		sd = sqrt (dd / (n - 1));
+		se = sd / sqrt (n);
+		ci = t95 * se;
+
+		if (se > 0) {
+			t = d / se;
+			p = pf_ab_p (t, n - 1);
+		} else
+			p = d ? 0 : 1;
+
+		printf ("  %-8s A %10.1f  B %10.1f  %+10.1f +- %-8.1f",
+				pf_ab_metric[m].name, a, b, d, ci);
+		if (a)
+			printf (" (%+6.2f%% +- %.2f%%)", 100 * d / a,
+					100 * ci / a);
+		printf ("  p %.4f  %s\n", p, p >= 0.05 ? "noise"
+				: (d < 0) == pf_ab_metric[m].lower_is_better
+				? "B better" : "B worse");
+	}
+}
@@ -0,0 +1,54 @@
+#ifndef __included__pf_ab_h__
+#define __included__pf_ab_h__
+
+#include <stdint.h>
+
+#include "pf_hist.h"
+
+struct pf_conf_s;
+struct pf_stat_s;
+
+/*
+ * A/B comparison.  With -l ab, each thread gives half its agents to A and
+ * half to B, exactly two backends, in the same run, so both see the same
+ * client, load and network, and whatever drifts during the run hits both
+ * alike.  Each side's agents go as fast as it answers, so its rate is its
+ * own.
+ *
+ * Every second the main loop samples what each backend did in that
+ * second: requests per second and the mean, p50 and p99 round trip.
+ * The per-second differences B - A are paired, which takes the drift
+ * out, and go through a paired t-test.  The report gives each delta with
+ * its 95% confidence interval and p-value.
+ */
+
+enum pf_ab_metric_e {
+	PF_AB_RATE,
+	PF_AB_MEAN,
+	PF_AB_P50,
+	PF_AB_P99,
+	PF_AB_METRICS
+};
+
+typedef struct pf_ab_s {
+	// one per second: [backend][metric]
+	double                (*sample)[2][PF_AB_METRICS];
+	uint                    no_samples;
+	uint                    max_samples;
+
+	// totals as of the last sample
+	uint64_t                ns;
+	uint64_t                completed[2];
+	pf_hist_t               rtt[2];
+} pf_ab_t;
+
+extern pf_ab_t *pf_ab_alloc (void);
+
+// take the second since the last call; during the warm-up, with keep 0,
+// only move the starting point
+extern void pf_ab_sample (pf_ab_t *ab, const struct pf_stat_s *stat,
+		int keep);
+
+extern void pf_ab_report (const pf_ab_t *ab, const struct pf_conf_s *conf);
+
+#endif // __included__pf_ab_h__
@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <netdb.h>
+
+#include "pf_dbg.h"
+#include "pf_backend.h"
+
+static void
+pf_backend_name (pf_backend_t *b)
+{
+	char addr[INET6_ADDRSTRLEN];
+	const struct sockaddr_in *sin = (void*)&b->addr;
+	const struct sockaddr_in6 *sin6 = (void*)&b->addr;
+
+	if (b->addr.ss_family == AF_INET6) {
+		inet_ntop (AF_INET6, &sin6->sin6_addr, addr, sizeof (addr));
+		snprintf (b->name, sizeof (b->name), "[%s]:%u", addr,
+				ntohs (sin6->sin6_port));
+	} else {
+		inet_ntop (AF_INET, &sin->sin_addr, addr, sizeof (addr));
+		snprintf (b->name, sizeof (b->name), "%s:%u", addr,
+				ntohs (sin->sin_port));
+	}
+}
+
+int
+pf_backend_add (pf_backend_t **backend, uint *no_backends,
+		const char *spec, const char *default_port)
+{
+	struct addrinfo hints = {
+		.ai_family = AF_UNSPEC,
+		.ai_socktype = SOCK_STREAM,
+	}, *ai, *p;
+	char *host = strdup (spec), *port = NULL, *q;
+	pf_backend_t *b;
+	uint i, added = 0;
+	int rc;
+
+	// [v6]:port, host:port, or a bare v6 literal with no port
+	if (host[0] == '[') {
+		q = index (host, ']');
+		if (!q)
+			BAIL ("unterminated [ in %s", spec);
+		*q = 0;
+		if (q[1] == ':')
+			port = q+2;
+		memmove (host, host+1, strlen (host));
+	} else if ((q = index (host, ':')) && q == rindex (host, ':')) {
+		*q = 0;
+		port = q+1;
+	}
+
+	rc = getaddrinfo (host, port ?: default_port, &hints, &ai);
+	if (rc)
+		BAIL ("cannot resolve %s: %s", spec, gai_strerror (rc));
+
+	for (p=ai; p; p=p->ai_next) {
+		if (p->ai_addrlen > sizeof (b->addr))
+			continue;
+
+		for (i=0; i<*no_backends; i++)
+			if ((*backend)[i].addrlen == p->ai_addrlen
+					&& !memcmp (&(*backend)[i].addr,
+						p->ai_addr, p->ai_addrlen))
+				break;
+		if (i < *no_backends)
+			continue;
+
+		*backend = realloc (*backend, (*no_backends + 1) * sizeof (**backend));
+		if (!*backend)
+			BAIL ("realloc %u backends", *no_backends + 1);
+
+		b = &(*backend)[(*no_backends)++];
+		memset (b, 0, sizeof (*b));
+		memcpy (&b->addr, p->ai_addr, p->ai_addrlen);
+		b->addrlen = p->ai_addrlen;
+		pf_backend_name (b);
+		added++;
+	}
+
+	freeaddrinfo (ai);
+	free (host);
+	return added;
+}
+
+const char *
+pf_balance_name (enum pf_balance_e balance)
+{
+	switch (balance) {
+	case PF_BALANCE_RR:     return "round-robin";
+	case PF_BALANCE_LEAST:  return "least-outstanding";
+	case PF_BALANCE_AB:     return "a/b";
+	}
+	return "?";
+}
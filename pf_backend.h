@@ -0,0 +1,34 @@
+#ifndef __included__pf_backend_h__
+#define __included__pf_backend_h__
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/*
+ * Servers the load is spread over.  A host name contributes every
+ * address it resolves to, IPv4 and IPv6 alike; -b lists them
+ * explicitly.  Each thread picks one per new connection, see pf_run.c.
+ */
+
+enum pf_balance_e {
+	PF_BALANCE_RR,          // round-robin
+	PF_BALANCE_LEAST,       // fewest outstanding requests
+	PF_BALANCE_AB,          // strictly alternating between two, see pf_ab.h
+};
+
+typedef struct pf_backend_s {
+	struct sockaddr_storage addr;
+	socklen_t               addrlen;
+	char                    name[INET6_ADDRSTRLEN + 8];
+} pf_backend_t;
+
+// resolve <host>[:<port>], where host may be a [v6] literal, and append
+// each address not yet on the list
+extern int pf_backend_add (pf_backend_t **backend, uint *no_backends,
+		const char *spec, const char *default_port);
+
+extern const char *pf_balance_name (enum pf_balance_e balance);
+
+#endif // __included__pf_backend_h__
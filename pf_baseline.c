@@ -0,0 +1,278 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#include "pf_dbg.h"
+#include "pf_module.h"
+#include "pf_hist.h"
+#include "pf_baseline.h"
+
+#define PF_BASELINE_VERSION     1
+
+// the fields a baseline keeps, by the names they have in pf_tstat_t
+static const struct {
+	const char     *name;
+	size_t          off;
+} pf_baseline_counter[] = {
+#define X(n)    { #n, offsetof (pf_tstat_t, n) },
+	PF_TSTAT_COUNTERS (X)
+#undef X
+}, pf_baseline_hist[] = {
+#define X(n)    { #n, offsetof (pf_tstat_t, n) },
+	PF_TSTAT_HISTS (X)
+#undef X
+};
+
+#define PF_BASELINE_N(a)        (sizeof (a) / sizeof ((a)[0]))
+
+static const struct {
+	const char     *opt;
+	const char     *name;
+	double          pct;            // of rtt, 0 for the rate
+} pf_gate_metric[PF_GATE_METRICS] = {
+	[PF_GATE_RATE]  = { "rate",     "rt/s",         0 },
+	[PF_GATE_P50]   = { "p50",      "p50 us",       50 },
+	[PF_GATE_P90]   = { "p90",      "p90 us",       90 },
+	[PF_GATE_P99]   = { "p99",      "p99 us",       99 },
+	[PF_GATE_P999]  = { "p999",     "p99.9 us",     99.9 },
+};
+
+int
+pf_baseline_save (const char *file, const char *url, const pf_tstat_t *total,
+		uint64_t ns)
+{
+	char tmp[PATH_MAX];
+	const pf_hist_t *h;
+	FILE *f;
+	uint i;
+	int rc;
+
+	// a rename, so an interrupted save leaves the old baseline be
+	snprintf (tmp, sizeof (tmp), "%s.tmp", file);
+	f = fopen (tmp, "w");
+	if (!f)
+		return -errno;
+
+	fprintf (f, "# pf baseline of %s\n"
+			"version %u\n"
+			"ns %"PRIu64"\n",
+			url, PF_BASELINE_VERSION, ns);
+
+	for (i=0; i<PF_BASELINE_N (pf_baseline_counter); i++)
+		fprintf (f, "counter %s %"PRIu64"\n",
+				pf_baseline_counter[i].name,
+				*(const uint64_t *)((const char *)total
+					+ pf_baseline_counter[i].off));
+
+	for (i=0; i<PF_BASELINE_N (pf_baseline_hist); i++) {
+		h = (const pf_hist_t *)((const char *)total
+				+ pf_baseline_hist[i].off);
+		if (!h->count)
+			continue;
+		fprintf (f, "hist %s ", pf_baseline_hist[i].name);
+		pf_hist_encode (h, f);
+		fprintf (f, "\n");
+	}
+
+	rc = ferror (f) ? -EIO : 0;
+	if (fclose (f) && !rc)
+		rc = -errno;
+	if (!rc && rename (tmp, file) < 0)
+		rc = -errno;
+	if (rc<0)
+		unlink (tmp);
+
+	return rc;
+}
+
+static int
+pf_baseline_line (char *line, pf_tstat_t *ts, uint64_t *ns)
+{
+	char *key = strtok (line, " \n"), *name, *val;
+	uint i;
+
+	if (!key)
+		return 0;
+	if (!strcmp (key, "ns"))
+		return sscanf (strtok (NULL, "\n") ?: "", "%"SCNu64, ns) == 1
+			? 0 : -EINVAL;
+
+	name = strtok (NULL, " \n");
+	val = strtok (NULL, "\n");
+	if (!name || !val)
+		return 0;
+
+	if (!strcmp (key, "counter")) {
+		for (i=0; i<PF_BASELINE_N (pf_baseline_counter); i++)
+			if (!strcmp (name, pf_baseline_counter[i].name))
+				return sscanf (val, "%"SCNu64, (uint64_t *)
+						((char *)ts
+						+ pf_baseline_counter[i].off))
+					== 1 ? 0 : -EINVAL;
+	} else if (!strcmp (key, "hist")) {
+		for (i=0; i<PF_BASELINE_N (pf_baseline_hist); i++)
+			if (!strcmp (name, pf_baseline_hist[i].name))
+				return pf_hist_decode ((pf_hist_t *)((char *)ts
+						+ pf_baseline_hist[i].off), val);
+	}
+
+	return 0;
+}
+
+int
+pf_baseline_load (const char *file, pf_tstat_t *ts, uint64_t *ns)
+{
+	char *line = NULL;
+	size_t max = 0;
+	uint version = 0, no = 0;
+	FILE *f;
+	int rc = 0;
+
+	memset (ts, 0, sizeof (*ts));
+	*ns = 0;
+
+	f = fopen (file, "r");
+	if (!f)
+		return -errno;
+
+	while (rc == 0 && getline (&line, &max, f) > 0) {
+		no++;
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+
+		// the version comes first, before anything it could change
+		if (!version) {
+			if (sscanf (line, "version %u", &version) != 1
+					|| version != PF_BASELINE_VERSION)
+				rc = -EINVAL;
+			continue;
+		}
+
+		rc = pf_baseline_line (line, ts, ns);
+	}
+
+	if (rc<0)
+		DBG (0, "%s:%u: not a baseline line\n", file, no);
+	else if (!version || !*ns)
+		rc = -EINVAL;
+
+	free (line);
+	fclose (f);
+	return rc;
+}
+
+// ------------------------------------------------------------------------
+
+int
+pf_gate_parse (pf_gate_t *gate, const char *args)
+{
+	const char *val[PF_GATE_METRICS] = { NULL };
+	char *end;
+	uint m, any = 0;
+	int rc;
+	pf_module_opt_t opts[] = {
+		{ "file",       PF_OPT_STR,     &gate->file },
+		{ "rate",       PF_OPT_STR,     &val[PF_GATE_RATE] },
+		{ "p50",        PF_OPT_STR,     &val[PF_GATE_P50] },
+		{ "p90",        PF_OPT_STR,     &val[PF_GATE_P90] },
+		{ "p99",        PF_OPT_STR,     &val[PF_GATE_P99] },
+		{ "p999",       PF_OPT_STR,     &val[PF_GATE_P999] },
+		{ NULL }
+	};
+
+	memset (gate, 0, sizeof (*gate));
+
+	rc = pf_module_parse_opts ("gate", args, opts);
+	if (rc<0)
+		return rc;
+
+	if (!gate->file)
+		BAIL ("gate needs a baseline, file=<path>");
+
+	for (m=0; m<PF_GATE_METRICS; m++) {
+		gate->limit[m] = -1;
+		if (!val[m])
+			continue;
+		gate->limit[m] = strtod (val[m], &end);
+		if (end == val[m] || *end || gate->limit[m] < 0)
+			BAIL ("gate %s must be a percentage, like %s=5",
+					pf_gate_metric[m].opt,
+					pf_gate_metric[m].opt);
+		any++;
+	}
+	if (!any) {
+		gate->limit[PF_GATE_RATE] = 5;
+		gate->limit[PF_GATE_P99] = 10;
+	}
+
+	gate->base = calloc (1, sizeof (*gate->base));
+	if (!gate->base) BAIL ("calloc (pf_tstat_t)");
+
+	rc = pf_baseline_load (gate->file, gate->base, &gate->base_ns);
+	if (rc<0)
+		BAIL ("cannot load baseline %s: %s", gate->file,
+				strerror (-rc));
+
+	return 0;
+}
+
+static double
+pf_gate_value (const pf_tstat_t *ts, uint64_t ns, uint m)
+{
+	if (m == PF_GATE_RATE)
+		return ns ? ts->round_trips / (ns / 1e9) : 0;
+	return pf_hist_percentile (&ts->rtt, pf_gate_metric[m].pct) / 1e3;
+}
+
+int
+pf_gate_check (const pf_gate_t *gate, const pf_tstat_t *total, uint64_t ns)
+{
+	double base, now, delta;
+	uint m, checked = 0, regressed = 0, bad;
+
+	printf ("gate     against %s, %.1f sec\n", gate->file,
+			gate->base_ns / 1e9);
+
+	for (m=0; m<PF_GATE_METRICS; m++) {
+		if (gate->limit[m] < 0)
+			continue;
+
+		// percentiles need round trips on both sides
+		if (m != PF_GATE_RATE && !gate->base->rtt.count) {
+			printf ("  %-9s no round trips in the baseline, "
+					"not checked\n", pf_gate_metric[m].name);
+			continue;
+		}
+
+		base = pf_gate_value (gate->base, gate->base_ns, m);
+		now = pf_gate_value (total, ns, m);
+		delta = base ? 100 * (now - base) / base : 0;
+
+		// worse is lower for the rate, higher for latencies
+		if (m == PF_GATE_RATE)
+			bad = -delta > gate->limit[m];
+		else
+			bad = !total->rtt.count || delta > gate->limit[m];
+
+		printf ("  %-9s %12.1f -> %12.1f  %+8.2f%%  limit %c%g%%  %s\n",
+				pf_gate_metric[m].name, base, now, delta,
+				m == PF_GATE_RATE ? '-' : '+', gate->limit[m],
+				bad ? "REGRESSED" : "ok");
+		checked++;
+		regressed += bad;
+	}
+
+	if (regressed)
+		printf ("gate     failed, %u of %u regressed\n", regressed,
+				checked);
+	else
+		printf ("gate     passed, %u checked\n", checked);
+
+	return regressed ? -ERANGE : 0;
+}
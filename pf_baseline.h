@@ -0,0 +1,59 @@
+#ifndef __included__pf_baseline_h__
+#define __included__pf_baseline_h__
+
+#include <stdint.h>
+
+#include "pf_stat.h"
+
+/*
+ * Baselines and a regression gate.  -K saves what a run measured, all
+ * of its merged counters and histograms, to a text file; -G compares a
+ * later run to such a file and fails it, with exit code 2, when round
+ * trips per second fell, or rtt percentiles rose, by more than the
+ * percentage allowed for each.
+ *
+ * The histograms are kept whole, as sparse buckets, so a baseline can
+ * be gated on any percentile later, and still takes only a few KB: it
+ * can live in git next to the code it measures.  The file is line
+ * based, one counter or histogram per line, and unknown lines are
+ * skipped, so files from older or newer versions still load.
+ */
+
+enum pf_gate_metric_e {
+	PF_GATE_RATE,
+	PF_GATE_P50,
+	PF_GATE_P90,
+	PF_GATE_P99,
+	PF_GATE_P999,
+	PF_GATE_METRICS
+};
+
+typedef struct pf_gate_s {
+	const char             *file;
+
+	// allowed regression, in percent; below 0 when not checked
+	double                  limit[PF_GATE_METRICS];
+
+	// what the baseline run measured, over base_ns
+	pf_tstat_t             *base;
+	uint64_t                base_ns;
+} pf_gate_t;
+
+// write a run's merged stats, measured over ns, to file; -errno
+extern int pf_baseline_save (const char *file, const char *url,
+		const pf_tstat_t *total, uint64_t ns);
+
+// read a file pf_baseline_save() wrote into ts; -EINVAL if it is not one
+extern int pf_baseline_load (const char *file, pf_tstat_t *ts, uint64_t *ns);
+
+// file=<path>[,rate=<pct>][,p50=<pct>][,p90=<pct>][,p99=<pct>]
+// [,p999=<pct>]; without limits, rate=5 and p99=10.  Loads the baseline
+// right away, so a missing one fails before the run, not after it.
+extern int pf_gate_parse (pf_gate_t *gate, const char *args);
+
+// compare a run to the baseline and print how it went; -ERANGE if
+// anything regressed beyond its limit
+extern int pf_gate_check (const pf_gate_t *gate, const pf_tstat_t *total,
+		uint64_t ns);
+
+#endif // __included__pf_baseline_h__
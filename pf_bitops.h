@@ -1,6 +1,7 @@
 #ifndef __included__pf_bitops_h__
 #define __included__pf_bitops_h__
 
+#include <stddef.h>
 #include <asm/types.h>
 
 // these are lifted from linux kernel asm/bitops.h
@@ -47,6 +48,65 @@ static inline void clear_bit(int nr, volatile unsigned long *addr)
 	*p &= ~mask;
 }
 
+#define BITS_TO_LONGS(nr)	(((nr) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+
+/*
+ * The searches below work a word at a time: a whole word of zero bits
+ * (or of ones, for the zero-bit search) is skipped with one compare and
+ * the bit inside the first interesting word is found with ctz.
+ */
+
+/**
+ * find_next_bit - find the next set bit in a memory region
+ * @data: The address to base the search on
+ * @max: The bitmap size in bits
+ * @offset: The bitnumber to start searching at
+ *
+ * Returns the bit-number of the next set bit, or @max if there is none.
+ */
+static inline unsigned int my_find_next_bit (const unsigned long *data,
+		size_t max, size_t offset)
+{
+	size_t w = BITOP_WORD(offset);
+	unsigned long word;
+
+	if (offset >= max)
+		return max;
+
+	// ignore the bits below offset in the first word
+	word = data[w] & (~0UL << (offset % BITS_PER_LONG));
+
+	while (!word) {
+		if (++w >= BITS_TO_LONGS(max))
+			return max;
+		word = data[w];
+	}
+
+	offset = w * BITS_PER_LONG + __builtin_ctzl (word);
+	return offset < max ? offset : max;
+}
+
+static inline unsigned int my_find_next_zero_bit (const unsigned long *data,
+		size_t max, size_t offset)
+{
+	size_t w = BITOP_WORD(offset);
+	unsigned long word;
+
+	if (offset >= max)
+		return max;
+
+	word = ~data[w] & (~0UL << (offset % BITS_PER_LONG));
+
+	while (!word) {
+		if (++w >= BITS_TO_LONGS(max))
+			return max;
+		word = ~data[w];
+	}
+
+	offset = w * BITS_PER_LONG + __builtin_ctzl (word);
+	return offset < max ? offset : max;
+}
+
 /**
  * find_first_bit - find the first set bit in a memory region
  * @data: The address to start the search at
@@ -55,24 +115,29 @@ static inline void clear_bit(int nr, volatile unsigned long *addr)
  * Returns the bit-number of the first set bit, not the number of the byte
  * containing a bit.
  */
-static inline unsigned int my_find_first_bit (unsigned long *data, size_t max)
+static inline unsigned int my_find_first_bit (const unsigned long *data,
+		size_t max)
 {
-	size_t n;
-	for (n=0; n<max; n++) {
-		if (test_bit (n, data))
-			return n;
-	}
-	return max;
+	return my_find_next_bit (data, max, 0);
 }
 
-static inline unsigned int my_find_first_zero_bit (unsigned long *data, size_t max)
+static inline unsigned int my_find_first_zero_bit (const unsigned long *data,
+		size_t max)
 {
-	size_t n;
-	for (n=0; n<max; n++) {
-		if (! test_bit (n, data))
-			return n;
-	}
-	return max;
+	return my_find_next_zero_bit (data, max, 0);
 }
 
+/**
+ * for_each_set_bit - iterate over the set bits of a bitmap
+ * @bit: unsigned int used as the loop cursor
+ * @data: The bitmap
+ * @max: The bitmap size in bits
+ *
+ * The bit under the cursor may be cleared by the loop body.
+ */
+#define for_each_set_bit(bit, data, max) \
+	for ((bit) = my_find_first_bit ((data), (max)); \
+	     (bit) < (max); \
+	     (bit) = my_find_next_bit ((data), (max), (bit) + 1))
+
 #endif // __included__pf_bitops_h__
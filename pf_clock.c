@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+#include "pf_dbg.h"
+#include "pf_clock.h"
+
+pf_clock_t pf_clock = { .source = PF_CLOCK_MONOTONIC };
+__thread uint64_t pf_clock_cached_ns;
+
+#if defined(__x86_64__) || defined(__i386__)
+
+static int
+pf_clock_tsc_invariant (void)
+{
+	uint eax, ebx, ecx, edx;
+
+	if (!__get_cpuid (0x80000000, &eax, &ebx, &ecx, &edx)
+			|| eax < 0x80000007)
+		return 0;
+
+	__get_cpuid (0x80000007, &eax, &ebx, &ecx, &edx);
+	return !!(edx & (1 << 8));
+}
+
+// measure TSC ticks against CLOCK_MONOTONIC over a short window
+static void
+pf_clock_tsc_calibrate (void)
+{
+	uint64_t ns0, ns1, tsc0, tsc1;
+	struct timespec ts = { .tv_sec = 0, .tv_nsec = 50 * 1000 * 1000 };
+
+	ns0 = pf_clock_read_monotonic ();
+	tsc0 = __builtin_ia32_rdtsc ();
+	nanosleep (&ts, NULL);
+	ns1 = pf_clock_read_monotonic ();
+	tsc1 = __builtin_ia32_rdtsc ();
+
+	pf_clock.mult = (((unsigned __int128)(ns1 - ns0)) << PF_CLOCK_SHIFT)
+		/ (tsc1 - tsc0);
+	pf_clock.base_tsc = tsc1;
+	pf_clock.base_ns = ns1;
+}
+
+#else
+
+static int pf_clock_tsc_invariant (void) { return 0; }
+static void pf_clock_tsc_calibrate (void) { }
+
+#endif
+
+int
+pf_clock_init (enum pf_clock_source_e source)
+{
+	int tsc = pf_clock_tsc_invariant ();
+
+	if (source == PF_CLOCK_TSC && !tsc)
+		BAIL ("TSC is not invariant on this machine, use -C mono");
+
+	if (source == PF_CLOCK_AUTO)
+		source = tsc ? PF_CLOCK_TSC : PF_CLOCK_MONOTONIC;
+
+	if (source == PF_CLOCK_TSC)
+		pf_clock_tsc_calibrate ();
+
+	pf_clock.source = source;
+	pf_clock_tick ();
+
+	return 0;
+}
+
+const char *
+pf_clock_name (void)
+{
+	return pf_clock.source == PF_CLOCK_TSC ? "tsc" : "monotonic";
+}
+
+int
+pf_clock_parse_time (const char *s, char **end, uint64_t *ns)
+{
+	double v = strtod (s, end);
+
+	// NaN fails this too
+	if (*end == s || !(v >= 0))
+		return -EINVAL;
+
+	if (!strncmp (*end, "ms", 2)) {
+		*end += 2;
+		v *= 1e6;
+	} else if (!strncmp (*end, "us", 2)) {
+		*end += 2;
+		v *= 1e3;
+	} else if (!strncmp (*end, "ns", 2)) {
+		*end += 2;
+	} else if (**end == 's') {
+		*end += 1;
+		v *= 1e9;
+	} else {
+		v *= 1e6;
+	}
+
+	if (v >= 18e18)
+		return -ERANGE;
+
+	*ns = v;
+	return 0;
+}
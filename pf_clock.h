@@ -0,0 +1,79 @@
+#ifndef __included__pf_clock_h__
+#define __included__pf_clock_h__
+
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * All timestamps in pf are nanoseconds on one monotonic timeline, read
+ * either from CLOCK_MONOTONIC or from the TSC scaled by a factor
+ * calibrated against it at startup.
+ *
+ * pf_clock_read() takes a fresh reading.  The event loop refreshes a
+ * per-thread cached value with pf_clock_tick() once per iteration, and
+ * per-request bookkeeping uses pf_clock_now(), which is just a load.
+ */
+
+enum pf_clock_source_e {
+	PF_CLOCK_AUTO,          // TSC if it is invariant, else monotonic
+	PF_CLOCK_MONOTONIC,
+	PF_CLOCK_TSC,
+};
+
+typedef struct pf_clock_s {
+	enum pf_clock_source_e  source;
+
+	// ns = base_ns + ((tsc - base_tsc) * mult) >> PF_CLOCK_SHIFT
+	uint64_t                base_tsc;
+	uint64_t                base_ns;
+	uint64_t                mult;
+} pf_clock_t;
+
+#define PF_CLOCK_SHIFT          32
+
+extern pf_clock_t pf_clock;
+extern __thread uint64_t pf_clock_cached_ns;
+
+// pick and calibrate the source, before any thread is started
+extern int pf_clock_init (enum pf_clock_source_e source);
+extern const char *pf_clock_name (void);
+
+// <num>[s|ms|us|ns], ms without a unit, as every time option takes it;
+// end is left after the unit, for the caller to check or go on from
+extern int pf_clock_parse_time (const char *s, char **end, uint64_t *ns);
+
+static inline uint64_t
+pf_clock_read_monotonic (void)
+{
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static inline uint64_t
+pf_clock_read (void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	if (pf_clock.source == PF_CLOCK_TSC) {
+		uint64_t d = __builtin_ia32_rdtsc () - pf_clock.base_tsc;
+		return pf_clock.base_ns
+			+ (uint64_t)(((unsigned __int128)d * pf_clock.mult)
+					>> PF_CLOCK_SHIFT);
+	}
+#endif
+	return pf_clock_read_monotonic ();
+}
+
+static inline uint64_t
+pf_clock_tick (void)
+{
+	return pf_clock_cached_ns = pf_clock_read ();
+}
+
+static inline uint64_t
+pf_clock_now (void)
+{
+	return pf_clock_cached_ns;
+}
+
+#endif // __included__pf_clock_h__
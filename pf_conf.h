@@ -4,29 +4,99 @@
 #include <sys/types.h>
 #include <netinet/in.h>
 
+#include "pf_backend.h"
+#include "pf_think.h"
+
+// how a connection ends, see pf_ctx_close()
+enum pf_close_e {
+	PF_CLOSE_NORMAL,        // close(), FIN when done
+	PF_CLOSE_PEER,          // the server's FIN first, then close()
+	PF_CLOSE_RST,           // abortive, RST instead of FIN
+};
+
+static inline const char *
+pf_close_name (enum pf_close_e mode)
+{
+	switch (mode) {
+	case PF_CLOSE_NORMAL:   return "normal";
+	case PF_CLOSE_PEER:     return "peer";
+	case PF_CLOSE_RST:      return "rst";
+	}
+	return "?";
+}
+
 struct pf_ctx_s;
+struct pf_module_s;
+struct pf_ctl_s;
+struct pf_udp_conf_s;
+struct iovec;
 
 typedef struct pf_conf_s {
 
-        // host to connect to
-        struct sockaddr_in      server;
+        // servers to connect to, and how to spread connections
+        pf_backend_t           *backend;
+        uint                    no_backends;
+        enum pf_balance_e       balance;
+
+	// host part of the url, for the Host header
+	const char             *host;
 
 	// page part of the url to GET
 	const char             *path;
 
+	// socket options, 0 leaves the system default; see pf_sockopt.h
+	size_t                  so_rcvbuf;
+	size_t                  so_sndbuf;
+	uint                    so_nodelay;
+	uint                    so_quickack;
+	uint                    so_fastopen;
+	uint                    so_busy_poll;   // us, if permitted
+
+	// spin on a non-blocking poll for this long before sleeping in it
+	uint                    busy_poll_us;
+
+	// teardown
+	enum pf_close_e         close_mode;
+
+        // protocol module the handlers below came from
+        const struct pf_module_s *module;
+
         // data handlers
 	int (*do_init) (struct pf_ctx_s *ctx);
         int (*do_connected) (struct pf_ctx_s *ctx);
         int (*do_send) (struct pf_ctx_s *ctx);
         int (*do_recv) (struct pf_ctx_s *ctx);
         int (*do_closing) (struct pf_ctx_s *ctx, int rc);
+        void (*do_fini) (struct pf_ctx_s *ctx);
+        int (*do_thread_init) (const struct pf_conf_s *conf);
+        void (*do_thread_fini) (const struct pf_conf_s *conf);
+	int (*do_dgram_request) (struct pf_ctx_s *ctx, struct iovec *iov);
+	int (*do_dgram_agent) (const struct pf_conf_s *conf, const void *buf,
+			size_t len);
+	int (*do_dgram_reply) (struct pf_ctx_s *ctx, const void *buf,
+			size_t len);
+
+	// datagrams instead of connections, set by a datagram module
+	const struct pf_udp_conf_s *udp;
 
         // definition of the test
         uint                    no_agents;
         uint                    no_connections;
 	uint			start_delay_sec;
 	uint			close_delay_sec;
-	uint			kill_switch;
+
+	// a connect, or a request, that takes longer fails; 0 never
+	uint64_t                timeout_ns;
+
+	// time between an agent's connections
+	pf_think_t              think;
+
+	// runtime adjustments, see pf_ctl.h
+	struct pf_ctl_s        *ctl;
+
+	// this process, of the workers of a distributed run; 0 of 1 if not
+	uint                    worker;
+	uint                    no_workers;
 
 } pf_conf_t;
 
@@ -0,0 +1,416 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "pf_dbg.h"
+#include "pf_conf.h"
+#include "pf_stat.h"
+#include "pf_hist.h"
+#include "pf_ctl.h"
+#include "pf_sockstat.h"
+
+// ------------------------------------------------------------------------
+
+void
+pf_ctl_init (pf_ctl_t *ctl, const pf_conf_t *conf, pf_stat_t *stat)
+{
+	memset (ctl, 0, sizeof (*ctl));
+	ctl->fd = -1;
+	ctl->conf = conf;
+	ctl->stat = stat;
+	ctl->agents = conf->no_agents;
+}
+
+void
+pf_ctl_set (pf_ctl_t *ctl, uint *field, uint value)
+{
+	__atomic_store_n (field, value, __ATOMIC_RELAXED);
+	__atomic_fetch_add (&ctl->generation, 1, __ATOMIC_RELEASE);
+}
+
+// ------------------------------------------------------------------------
+// metrics, in prometheus text format
+
+// histogram bucket bounds exported, in seconds
+static const double pf_ctl_le[] = {
+	25e-6, 50e-6, 100e-6, 250e-6, 500e-6,
+	1e-3, 2.5e-3, 5e-3, 10e-3, 25e-3, 50e-3, 100e-3, 250e-3, 500e-3,
+	1, 2.5, 5, 10,
+};
+
+static void
+pf_ctl_hist (FILE *f, const char *name, const char *help, const pf_hist_t *h)
+{
+	uint i;
+
+	fprintf (f, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+	for (i=0; i<sizeof (pf_ctl_le)/sizeof (pf_ctl_le[0]); i++)
+		fprintf (f, "%s_bucket{le=\"%g\"} %"PRIu64"\n", name,
+				pf_ctl_le[i],
+				pf_hist_count_below (h, pf_ctl_le[i] * 1e9));
+	fprintf (f, "%s_bucket{le=\"+Inf\"} %"PRIu64"\n"
+			"%s_sum %.9f\n"
+			"%s_count %"PRIu64"\n",
+			name, h->count, name, h->sum / 1e9, name, h->count);
+}
+
+#define PF_CTL_PER_THREAD(f,stat,name,type,help,field) ({               \
+	uint __t;                                                       \
+	fprintf (f, "# HELP " name " " help "\n# TYPE " name " " type "\n"); \
+	for (__t=0; __t<(stat)->no_threads; __t++)                      \
+		fprintf (f, name "{thread=\"%u\"} %"PRIu64"\n", __t,    \
+			(uint64_t)tstat_read (&(stat)->thread[__t], field)); \
+	})
+
+static void
+pf_ctl_backends (pf_ctl_t *ctl, FILE *f)
+{
+	const pf_conf_t *conf = ctl->conf;
+	pf_stat_t *stat = ctl->stat;
+	uint64_t ok, fail;
+	uint b, t;
+
+	if (conf->no_backends < 2 || !stat->thread->backend)
+		return;
+
+	fprintf (f, "# HELP pf_backend_requests_total Connections per backend and outcome.\n"
+		"# TYPE pf_backend_requests_total counter\n");
+	for (b=0; b<conf->no_backends; b++) {
+		ok = fail = 0;
+		for (t=0; t<stat->no_threads; t++) {
+			ok += tstat_read (&stat->thread[t].backend[b], completed);
+			fail += tstat_read (&stat->thread[t].backend[b], failed);
+		}
+		fprintf (f, "pf_backend_requests_total{backend=\"%s\",result=\"ok\"} %"PRIu64"\n"
+			"pf_backend_requests_total{backend=\"%s\",result=\"fail\"} %"PRIu64"\n",
+			conf->backend[b].name, ok, conf->backend[b].name, fail);
+	}
+}
+
+static void
+pf_ctl_errors (pf_ctl_t *ctl, FILE *f)
+{
+	pf_stat_t *stat = ctl->stat;
+	uint64_t n;
+	uint e, t;
+
+	fprintf (f, "# HELP pf_errors_total Failed connections by class.\n"
+		"# TYPE pf_errors_total counter\n");
+	for (e=0; e<PF_ERR_MAX; e++) {
+		n = 0;
+		for (t=0; t<stat->no_threads; t++)
+			n += tstat_read (&stat->thread[t], errors[e]);
+		fprintf (f, "pf_errors_total{class=\"%s\"} %"PRIu64"\n",
+				pf_err_name (e), n);
+	}
+}
+
+static void
+pf_ctl_metrics (pf_ctl_t *ctl, FILE *f)
+{
+	pf_stat_t *stat = ctl->stat;
+	pf_hist_t *h;
+	uint t;
+	int tw;
+
+	fprintf (f, "# HELP pf_connections_completed_total Connections that completed successfully.\n"
+		"# TYPE pf_connections_completed_total counter\n"
+		"pf_connections_completed_total %u\n"
+		"# HELP pf_connections_failed_total Connections that failed.\n"
+		"# TYPE pf_connections_failed_total counter\n"
+		"pf_connections_failed_total %u\n",
+		stat_atomic_read (stat, no_completed),
+		stat_atomic_read (stat, no_failed));
+
+	PF_CTL_PER_THREAD (f, stat, "pf_sent_bytes_total", "counter",
+			"Bytes sent by closed connections.", send_bytes);
+	PF_CTL_PER_THREAD (f, stat, "pf_received_bytes_total", "counter",
+			"Bytes received by closed connections.", recv_bytes);
+	PF_CTL_PER_THREAD (f, stat, "pf_round_trips_total", "counter",
+			"Request/response exchanges completed.", round_trips);
+	PF_CTL_PER_THREAD (f, stat, "pf_agents_active", "gauge",
+			"Agents with a connection being polled.", active);
+	PF_CTL_PER_THREAD (f, stat, "pf_loop_iterations_total", "counter",
+			"Event loop iterations.", loop_iterations);
+	PF_CTL_PER_THREAD (f, stat, "pf_fastopen_hits_total", "counter",
+			"Connections whose SYN data the server accepted.", tfo_hits);
+	PF_CTL_PER_THREAD (f, stat, "pf_fastopen_misses_total", "counter",
+			"Fast open connections that fell back to a handshake.",
+			tfo_misses);
+	PF_CTL_PER_THREAD (f, stat, "pf_datagrams_sent_total", "counter",
+			"UDP requests sent.", dgram_sent);
+	PF_CTL_PER_THREAD (f, stat, "pf_datagrams_late_total", "counter",
+			"UDP replies that matched no request in flight.",
+			dgram_late);
+	PF_CTL_PER_THREAD (f, stat, "pf_verify_ok_total", "counter",
+			"HTTP bodies of the expected length and hash.",
+			verify_ok);
+	PF_CTL_PER_THREAD (f, stat, "pf_verify_bad_length_total", "counter",
+			"HTTP bodies not of the expected length.",
+			verify_bad_len);
+	PF_CTL_PER_THREAD (f, stat, "pf_verify_bad_hash_total", "counter",
+			"HTTP bodies of the expected length, not hash.",
+			verify_bad_hash);
+	PF_CTL_PER_THREAD (f, stat, "pf_encoded_responses_total", "counter",
+			"HTTP responses with a content encoding.",
+			enc_responses);
+	PF_CTL_PER_THREAD (f, stat, "pf_encoded_wire_bytes_total", "counter",
+			"Encoded HTTP body bytes as received.",
+			enc_wire_bytes);
+	PF_CTL_PER_THREAD (f, stat, "pf_encoded_decoded_bytes_total",
+			"counter", "Encoded HTTP body bytes after decoding.",
+			enc_decoded_bytes);
+	PF_CTL_PER_THREAD (f, stat, "pf_decode_ns_total", "counter",
+			"Time spent decoding HTTP bodies, in ns.",
+			enc_decode_ns);
+
+	pf_ctl_errors (ctl, f);
+	pf_ctl_backends (ctl, f);
+
+	tw = pf_sockstat_time_wait ();
+	if (tw >= 0)
+		fprintf (f, "# HELP pf_time_wait_sockets TCP sockets in TIME_WAIT on this host.\n"
+			"# TYPE pf_time_wait_sockets gauge\n"
+			"pf_time_wait_sockets %d\n", tw);
+
+	fprintf (f, "# HELP pf_control_agents Active agents per thread.\n"
+		"# TYPE pf_control_agents gauge\n"
+		"pf_control_agents %u\n"
+		"# HELP pf_control_rate Target new connections per second, 0 is unlimited.\n"
+		"# TYPE pf_control_rate gauge\n"
+		"pf_control_rate %u\n"
+		"# HELP pf_control_paused Whether new connections are paused.\n"
+		"# TYPE pf_control_paused gauge\n"
+		"pf_control_paused %u\n"
+		"# HELP pf_control_draining Whether the run is draining to a stop.\n"
+		"# TYPE pf_control_draining gauge\n"
+		"pf_control_draining %u\n",
+		ctl_read (ctl, agents), ctl_read (ctl, rate),
+		ctl_read (ctl, paused), ctl_read (ctl, drain));
+
+	h = malloc (sizeof (*h));
+	if (!h)
+		return;
+
+#define PF_CTL_MERGED(field,name,help) ({                               \
+	pf_hist_reset (h);                                              \
+	for (t=0; t<stat->no_threads; t++)                              \
+		pf_hist_merge (h, &stat->thread[t].field);              \
+	if (h->count)                                                   \
+		pf_ctl_hist (f, name, help, h);                         \
+	})
+
+	PF_CTL_MERGED (rtt, "pf_request_duration_seconds",
+			"Request to complete response latency.");
+	PF_CTL_MERGED (ttfb, "pf_time_to_first_byte_seconds",
+			"Request to first response byte.");
+	PF_CTL_MERGED (xfer, "pf_transfer_seconds",
+			"First to last response byte.");
+
+#undef PF_CTL_MERGED
+
+	free (h);
+}
+
+// ------------------------------------------------------------------------
+// commands
+
+static int
+pf_ctl_query_uint (const char *query, uint *value)
+{
+	char *end;
+
+	if (!query || strncmp (query, "n=", 2))
+		return -EINVAL;
+
+	*value = strtoul (query+2, &end, 0);
+	if (end == query+2 || (*end && *end != '&'))
+		return -EINVAL;
+
+	return 0;
+}
+
+// returns an HTTP status; the body goes to f
+static int
+pf_ctl_command (pf_ctl_t *ctl, const char *method, const char *path,
+		const char *query, FILE *f)
+{
+	uint n;
+
+	if (!strcmp (path, "/metrics")) {
+		pf_ctl_metrics (ctl, f);
+		return 200;
+
+	// a web page can make the browser GET anything on loopback, so
+	// whatever changes the run takes a POST
+	} else if (strcmp (method, "POST")) {
+		fprintf (f, "POST /pause, /resume, /stop, /agents?n=<num>, "
+				"/rate?n=<num>\n");
+		return 405;
+
+	} else if (!strcmp (path, "/pause")) {
+		pf_ctl_set (ctl, &ctl->paused, 1);
+
+	} else if (!strcmp (path, "/resume")) {
+		pf_ctl_set (ctl, &ctl->paused, 0);
+
+	} else if (!strcmp (path, "/stop")) {
+		pf_ctl_set (ctl, &ctl->drain, 1);
+
+	} else if (!strcmp (path, "/agents")) {
+		if (pf_ctl_query_uint (query, &n) || !n
+				|| n > ctl->conf->no_agents) {
+			fprintf (f, "agents?n=<1..%u>\n", ctl->conf->no_agents);
+			return 400;
+		}
+		pf_ctl_set (ctl, &ctl->agents, n);
+
+	} else if (!strcmp (path, "/rate")) {
+		if (pf_ctl_query_uint (query, &n)) {
+			fprintf (f, "rate?n=<conn/sec>, 0 for unlimited\n");
+			return 400;
+		}
+		pf_ctl_set (ctl, &ctl->rate, n);
+
+	} else {
+		fprintf (f, "GET /metrics, POST /pause, /resume, /stop, "
+				"/agents?n=<num>, /rate?n=<num>\n");
+		return 404;
+	}
+
+	fprintf (f, "ok\n");
+	return 200;
+}
+
+// a client gets this long to send its request, so one that sends
+// nothing cannot hold up the others
+#define PF_CTL_READ_SEC         2
+
+static void
+pf_ctl_serve (pf_ctl_t *ctl, int fd)
+{
+	char req[2048], *path, *query, *end, *body = NULL;
+	size_t len = 0, body_len = 0;
+	struct timeval tv = { .tv_sec = PF_CTL_READ_SEC };
+	FILE *f;
+	int rc, status;
+
+	setsockopt (fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv));
+	setsockopt (fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof (tv));
+
+	// up to the end of the headers; a browser's cross-site request
+	// carries an Origin, which a command line client never does
+	do {
+		rc = read (fd, req + len, sizeof (req) - 1 - len);
+		if (rc<0 && errno == EINTR)
+			continue;
+		if (rc <= 0)
+			return;
+		len += rc;
+		req[len] = 0;
+	} while (!strstr (req, "\r\n\r\n") && !strstr (req, "\n\n")
+			&& len < sizeof (req) - 1);
+
+	if (strcasestr (req, "\norigin:"))
+		return;
+
+	// "<method> <path>[?<query>] HTTP/x.y"
+	path = index (req, ' ');
+	if (!path)
+		return;
+	*path++ = 0;
+	end = path + strcspn (path, " \r\n");
+	*end = 0;
+	query = index (path, '?');
+	if (query)
+		*query++ = 0;
+
+	f = open_memstream (&body, &body_len);
+	if (!f)
+		return;
+	status = pf_ctl_command (ctl, req, path, query, f);
+	fclose (f);
+
+	dprintf (fd, "HTTP/1.0 %d %s\r\n"
+			"Content-Type: text/plain; version=0.0.4\r\n"
+			"Content-Length: %zu\r\n"
+			"\r\n", status, status == 200 ? "OK"
+			: status == 405 ? "Method Not Allowed" : "Error",
+			body_len);
+	rc = write (fd, body, body_len);
+	free (body);
+}
+
+static void *
+pf_ctl_thread (void *arg)
+{
+	pf_ctl_t *ctl = arg;
+	int fd;
+
+	for (;;) {
+		fd = accept (ctl->fd, NULL, NULL);
+		if (fd<0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			break;
+		}
+		pf_ctl_serve (ctl, fd);
+		close (fd);
+	}
+
+	return NULL;
+}
+
+int
+pf_ctl_listen (pf_ctl_t *ctl, const char *addr)
+{
+	int fd, one = 1;
+
+	if (index (addr, '/')) {
+		struct sockaddr_un sun = { .sun_family = AF_UNIX };
+
+		if (strlen (addr) >= sizeof (sun.sun_path))
+			BAIL ("control socket path too long: %s", addr);
+		strcpy (sun.sun_path, addr);
+		unlink (addr);
+
+		fd = socket (AF_UNIX, SOCK_STREAM, 0);
+		if (fd<0) BAIL ("control socket");
+		if (bind (fd, (void*)&sun, sizeof (sun)) < 0)
+			BAIL ("bind %s", addr);
+
+	} else {
+		struct sockaddr_in sin = {
+			.sin_family = AF_INET,
+			.sin_port = htons (atoi (addr)),
+			.sin_addr.s_addr = htonl (INADDR_LOOPBACK),
+		};
+
+		fd = socket (AF_INET, SOCK_STREAM, 0);
+		if (fd<0) BAIL ("control socket");
+		setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof (one));
+		if (bind (fd, (void*)&sin, sizeof (sin)) < 0)
+			BAIL ("bind 127.0.0.1:%s", addr);
+	}
+
+	if (listen (fd, 16) < 0)
+		BAIL ("listen %s", addr);
+
+	ctl->fd = fd;
+	if (pthread_create (&ctl->tid, NULL, pf_ctl_thread, ctl))
+		BAIL ("pthread_create control");
+	pthread_detach (ctl->tid);
+
+	return 0;
+}
@@ -0,0 +1,41 @@
+#ifndef __included__pf_ctl_h__
+#define __included__pf_ctl_h__
+
+#include <pthread.h>
+
+struct pf_conf_s;
+struct pf_stat_s;
+
+/*
+ * Runtime control of a running test.  Values are written by main() or
+ * the control socket thread with pf_ctl_set(), which bumps generation;
+ * each worker compares generation at the top of its loop and picks the
+ * new values up there, so a change never lands in the middle of a step.
+ * With -p it lives in memory shared with the worker processes.
+ */
+typedef struct pf_ctl_s {
+        uint                    generation;
+
+        uint                    agents;         // active agents per thread
+        uint                    rate;           // new conn/sec, 0 = no limit
+        uint                    paused;         // open no new connections
+        uint                    drain;          // finish in-flight, then exit
+        uint                    kill_switch;    // abandon in-flight, exit now
+
+        // control socket
+        int                     fd;
+        pthread_t               tid;
+        const struct pf_conf_s *conf;
+        struct pf_stat_s       *stat;
+} pf_ctl_t;
+
+#define ctl_read(c,n)   __atomic_load_n (&(c)->n, __ATOMIC_ACQUIRE)
+
+extern void pf_ctl_init (pf_ctl_t *ctl, const struct pf_conf_s *conf,
+                struct pf_stat_s *stat);
+extern void pf_ctl_set (pf_ctl_t *ctl, uint *field, uint value);
+
+// serve metrics and commands on <port> (loopback) or on a unix socket path
+extern int pf_ctl_listen (pf_ctl_t *ctl, const char *addr);
+
+#endif // __included__pf_ctl_h__
@@ -2,43 +2,124 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 
 #include "pf_dbg.h"
 #include "pf_ctx.h"
 #include "pf_conf.h"
+#include "pf_stat.h"
+#include "pf_clock.h"
 
-int
-pf_ctx_init (pf_ctx_t *ctx, const pf_conf_t *conf, struct pf_stat_s *stat)
+static int
+__pf_ctx_init (pf_ctx_t *ctx, const pf_conf_t *conf, struct pf_stat_s *stat,
+		struct pf_tstat_s *tstat, void *private_data)
 {
 	int rc = 0;
         memset (ctx, 0, sizeof (*ctx));
         ctx->conf = conf;
         ctx->stat = stat;
+        ctx->tstat = tstat;
         ctx->fd = -1;
-	ctx->state = PF_CTX_AVAIL;
+	ctx->out.file_fd = -1;
+	ctx->private_data = private_data;
 	if (conf->do_init)
 		rc = conf->do_init(ctx);
 	return rc;
 }
 
+int
+pf_ctx_init (pf_ctx_t *ctx, const pf_conf_t *conf, struct pf_stat_s *stat,
+		struct pf_tstat_s *tstat)
+{
+	return __pf_ctx_init (ctx, conf, stat, tstat, NULL);
+}
+
 void
 pf_ctx_reset (pf_ctx_t *ctx)
 {
-        const struct pf_conf_s *conf = ctx->conf;;
-        struct pf_stat_s *stat = ctx->stat;
-        pf_ctx_init (ctx, conf, stat);
+	// protocol handler state survives, so do_init can reuse it
+        __pf_ctx_init (ctx, ctx->conf, ctx->stat, ctx->tstat,
+			ctx->private_data);
+}
+
+void
+pf_ctx_fini (pf_ctx_t *ctx)
+{
+	pf_ctx_close (ctx);
+	if (ctx->conf->do_fini)
+		ctx->conf->do_fini (ctx);
+	ctx->private_data = NULL;
 }
 
 int 
 pf_ctx_socket (pf_ctx_t *ctx)
 {
         int rc;
+	const pf_backend_t *b = &ctx->conf->backend[ctx->backend];
 
-        rc = socket (PF_INET, SOCK_STREAM, 0);
-        if (rc<0) BAIL ("new socked creation: PF_INET SOCK_STREAM");
+	// out of descriptors is something to count and back off from
+        rc = socket (b->addr.ss_family, SOCK_STREAM, 0);
+        if (rc<0) {
+		rc = -errno;
+		DBG (1, "failed to create a %s socket: %s\n",
+				b->addr.ss_family == AF_INET6 ? "PF_INET6"
+				: "PF_INET", strerror (-rc));
+		return rc;
+	}
 
         ctx->fd = rc;
 
+	// neither connect() nor writes may block the whole thread
+	if (fcntl (ctx->fd, F_SETFL, O_NONBLOCK) < 0)
+		BAIL ("fcntl O_NONBLOCK");
+
+	if (ctx->conf->so_rcvbuf) {
+		int val = ctx->conf->so_rcvbuf;
+		// must be set before connect() for the window scale to follow
+		if (setsockopt (ctx->fd, SOL_SOCKET, SO_RCVBUF,
+					&val, sizeof (val)) < 0)
+			BAIL ("setsockopt SO_RCVBUF %d", val);
+	}
+
+	if (ctx->conf->so_sndbuf) {
+		int val = ctx->conf->so_sndbuf;
+		if (setsockopt (ctx->fd, SOL_SOCKET, SO_SNDBUF,
+					&val, sizeof (val)) < 0)
+			BAIL ("setsockopt SO_SNDBUF %d", val);
+	}
+
+	if (ctx->conf->so_nodelay) {
+		int one = 1;
+		if (setsockopt (ctx->fd, IPPROTO_TCP, TCP_NODELAY,
+					&one, sizeof (one)) < 0)
+			BAIL ("setsockopt TCP_NODELAY");
+	}
+
+	// the kernel polls the device queue on reads; main() checked
+	// that this is permitted
+	if (ctx->conf->so_busy_poll) {
+		int val = ctx->conf->so_busy_poll;
+		setsockopt (ctx->fd, SOL_SOCKET, SO_BUSY_POLL,
+				&val, sizeof (val));
+	}
+
+	// connect() returns at once, and the first send goes out with the
+	// SYN if there is a cookie for the server, or asks for one if not
+	if (ctx->conf->so_fastopen) {
+		int one = 1;
+		if (setsockopt (ctx->fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT,
+					&one, sizeof (one)) < 0)
+			BAIL ("setsockopt TCP_FASTOPEN_CONNECT, needs Linux "
+					"4.11 and net.ipv4.tcp_fastopen & 1");
+	}
+
         return rc;
 }
 
@@ -46,22 +127,230 @@ int
 pf_ctx_connect (pf_ctx_t *ctx)
 {
         int rc;
+	const pf_backend_t *b = &ctx->conf->backend[ctx->backend];
 
-        rc = connect (ctx->fd, (void*)&ctx->conf->server, sizeof (ctx->conf->server));
-        if (rc<0) BAIL ("failed to connect to server %08x %04x",
-                        ctx->conf->server.sin_addr.s_addr,
-                        ctx->conf->server.sin_port);
+	// one backend being down is a failed connection, not a failed run
+        rc = connect (ctx->fd, (void*)&b->addr, b->addrlen);
+        if (rc<0) {
+		rc = -errno;
+		if (rc != -EINPROGRESS)
+			DBG (1, "failed to connect to %s: %s\n", b->name,
+					strerror (-rc));
+		return rc;
+	}
+
+	pf_ctx_quickack (ctx);
 
         return rc;
 }
 
+int
+pf_ctx_connected (pf_ctx_t *ctx)
+{
+	socklen_t len = sizeof (int);
+	int err = 0;
+
+	if (getsockopt (ctx->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+		err = errno;
+	if (err) {
+		DBG (1, "failed to connect to %s: %s\n",
+				ctx->conf->backend[ctx->backend].name,
+				strerror (err));
+		return -err;
+	}
+
+	pf_ctx_quickack (ctx);
+
+	return 0;
+}
+
+void
+pf_ctx_quickack (pf_ctx_t *ctx)
+{
+	int one = 1;
+
+	// the kernel drops out of quickack mode by itself, so this is
+	// repeated after every read; failing is harmless
+	if (ctx->conf->so_quickack)
+		setsockopt (ctx->fd, IPPROTO_TCP, TCP_QUICKACK,
+				&one, sizeof (one));
+}
+
+void
+pf_ctx_fastopen_result (pf_ctx_t *ctx)
+{
+	struct tcp_info ti;
+	socklen_t len = sizeof (ti);
+
+	if (!ctx->conf->so_fastopen || ctx->fd<0)
+		return;
+
+	// the server acknowledged the data on our SYN: the cookie worked
+	if (!getsockopt (ctx->fd, IPPROTO_TCP, TCP_INFO, &ti, &len)
+			&& (ti.tcpi_options & TCPI_OPT_SYN_DATA))
+		tstat_add (ctx->tstat, tfo_hits, 1);
+	else
+		tstat_add (ctx->tstat, tfo_misses, 1);
+}
+
+/*
+ * Whoever sends the first FIN ends up holding the connection in
+ * TIME_WAIT, for 60s on Linux, and with it a local port.  A client that
+ * closes first at a high rate runs out of ports; PF_CLOSE_RST skips all
+ * that by resetting instead.  PF_CLOSE_PEER leaves the first FIN to the
+ * server: the connection stays open after the exchange until the
+ * server's FIN is read, and only then is it closed.
+ */
 int 
 pf_ctx_close (pf_ctx_t *ctx)
 {
-        if (ctx->fd != -1)
+	static const struct linger rst = { .l_onoff = 1, .l_linger = 0 };
+
+        if (ctx->fd != -1) {
+		if (ctx->conf->close_mode == PF_CLOSE_RST)
+			setsockopt (ctx->fd, SOL_SOCKET, SO_LINGER,
+					&rst, sizeof (rst));
                 close (ctx->fd);
+	}
         ctx->fd = -1;
 
         return 0;
 }
 
+int
+pf_ctx_linger (pf_ctx_t *ctx)
+{
+	char buf[512];
+	ssize_t rc;
+
+	// anything still coming is not part of the exchange
+	do {
+		rc = recv (ctx->fd, buf, sizeof (buf), MSG_DONTWAIT);
+	} while (rc>0);
+
+	if (rc==0)
+		return 0;
+	return errno == EAGAIN ? -EAGAIN : -errno;
+}
+
+void
+pf_ctx_round_trip (pf_ctx_t *ctx, uint64_t ns)
+{
+	pf_tstat_t *ts = ctx->tstat;
+
+	tstat_add (ts, round_trips, 1);
+	pf_hist_add (&ts->rtt, ns);
+	if (ts->backend)
+		pf_hist_add (&ts->backend[ctx->backend].rtt, ns);
+
+	ctx->delay_finish_ns = ctx->conf->timeout_ns
+		? pf_clock_now () + ctx->conf->timeout_ns : UINT64_MAX;
+}
+
+// ------------------------------------------------------------------------
+
+void
+pf_ctx_out_reset (pf_ctx_t *ctx)
+{
+	memset (&ctx->out, 0, sizeof (ctx->out));
+	ctx->out.file_fd = -1;
+	ctx->wants_to_send_more = 0;
+}
+
+int
+pf_ctx_out_add (pf_ctx_t *ctx, const void *base, size_t len)
+{
+	pf_ctx_out_t *out = &ctx->out;
+
+	if (!len)
+		return 0;
+
+	// the file range always goes last
+	if (out->iov_cnt == PF_CTX_OUT_IOV || out->file_len)
+		return -ENOSPC;
+
+	out->iov[out->iov_cnt++] = (struct iovec){
+		.iov_base = (void*)base, .iov_len = len };
+	ctx->wants_to_send_more = 1;
+
+	return 0;
+}
+
+int
+pf_ctx_out_add_file (pf_ctx_t *ctx, int fd, off_t off, size_t len)
+{
+	pf_ctx_out_t *out = &ctx->out;
+
+	if (out->file_len)
+		return -ENOSPC;
+
+	out->file_fd = fd;
+	out->file_off = off;
+	out->file_len = len;
+	if (len)
+		ctx->wants_to_send_more = 1;
+
+	return 0;
+}
+
+/*
+ * Issue one send for whatever is pending: sendmsg() over the unsent
+ * memory segments, or sendfile() once those are gone.  Short writes just
+ * advance the cursor; wants_to_send_more stays set until the queue is
+ * empty.  Returns bytes sent, -EAGAIN if the socket is full, or -errno.
+ */
+ssize_t
+pf_ctx_out_flush (pf_ctx_t *ctx)
+{
+	pf_ctx_out_t *out = &ctx->out;
+	ssize_t rc;
+
+	if (out->iov_idx < out->iov_cnt) {
+		struct msghdr msg = {
+			.msg_iov = &out->iov[out->iov_idx],
+			.msg_iovlen = out->iov_cnt - out->iov_idx,
+		};
+		int flags = MSG_DONTWAIT | MSG_NOSIGNAL;
+		size_t left;
+
+		if (out->file_len)
+			flags |= MSG_MORE;
+
+		// with fast open and no cookie, the first send only gets the
+		// SYN out; the data follows once connected
+		rc = sendmsg (ctx->fd, &msg, flags);
+		if (rc<0)
+			return errno == EINPROGRESS ? -EAGAIN : -errno;
+
+		// consume fully sent segments, trim the partial one
+		for (left = rc; left; out->iov_idx++) {
+			struct iovec *iov = &out->iov[out->iov_idx];
+			if (left < iov->iov_len) {
+				iov->iov_base = (char*)iov->iov_base + left;
+				iov->iov_len -= left;
+				break;
+			}
+			left -= iov->iov_len;
+		}
+
+	} else if (out->file_len) {
+		rc = sendfile (ctx->fd, out->file_fd, &out->file_off,
+				out->file_len);
+		if (rc<0)
+			return errno == EINPROGRESS ? -EAGAIN : -errno;
+		if (rc==0)
+			return -EIO;    // file shrunk under us
+
+		out->file_len -= rc;
+
+	} else
+		return 0;
+
+	ctx->send_cnt ++;
+	ctx->send_bytes += rc;
+
+	ctx->wants_to_send_more = out->iov_idx < out->iov_cnt
+		|| out->file_len;
+
+	return rc;
+}
@@ -3,35 +3,54 @@
 
 struct pf_conf_s;
 struct pf_stat_s;
+struct pf_tstat_s;
 
 #include <stdint.h>
 #include <sys/types.h>
-
-#include "pf_list.h"
+#include <sys/uio.h>
 
 enum pf_ctx_state_e {
 	PF_CTX_AVAIL,
 	PF_CTX_CONN,
+	PF_CTX_CONNECTING,      // connect() in flight
 	PF_CTX_DELAY_ACTIVE,
 	PF_CTX_ACTIVE,
 	PF_CTX_DELAY_CLOSE,
+	PF_CTX_THINK,
+	PF_CTX_REPLY,           // datagram out, reply not in yet
 	PF_CTX_STATE_MAX
 };
 
+// outgoing data not yet accepted by the socket: a list of memory segments,
+// optionally followed by a range of a file to sendfile()
+#define PF_CTX_OUT_IOV  8
+
+typedef struct pf_ctx_out_s {
+	struct iovec            iov[PF_CTX_OUT_IOV];
+	uint                    iov_cnt;        // segments queued
+	uint                    iov_idx;        // first one not fully sent
+
+	int                     file_fd;
+	off_t                   file_off;
+	size_t                  file_len;       // left to send
+} pf_ctx_out_t;
+
+// per agent state the engine loop does not need on every iteration; the
+// state and list links live in pf_run's dense agent array
 typedef struct pf_ctx_s {
-	struct list_head	link;
-	enum pf_ctx_state_e	state;
 	uint 			number;
 
         // the configuration
         const struct pf_conf_s *conf;
         struct pf_stat_s       *stat;
+        struct pf_tstat_s      *tstat;
 
 	// used by protocol handler
 	void                   *private_data;
 
-        // the socket
+        // the socket, and the backend it goes to
         int                     fd;
+        uint                    backend;
 
         // read/write and byte counts
         size_t                  send_cnt;
@@ -39,16 +58,44 @@ typedef struct pf_ctx_s {
         size_t                  recv_cnt;
         size_t                  recv_bytes;
 
-	// flags
-	time_t			delay_finish_time;
+	// flags; the deadline of an ordered state, see pf_run.c
+	uint64_t		delay_finish_ns;
+	uint64_t                connect_ns;
 	uint32_t                wants_to_send_more:1;
+	uint32_t                lingering:1;    // done, the peer closes first
+
+	// output queue, drained by pf_ctx_out_flush()
+	pf_ctx_out_t            out;
 } pf_ctx_t;
 
 extern int pf_ctx_init (pf_ctx_t *ctx, const struct pf_conf_s *conf, 
-                struct pf_stat_s *stat);
+                struct pf_stat_s *stat, struct pf_tstat_s *tstat);
 extern void pf_ctx_reset (pf_ctx_t *ctx);
+extern void pf_ctx_fini (pf_ctx_t *ctx);
 extern int pf_ctx_socket (pf_ctx_t *ctx);
+// -EINPROGRESS while the handshake is under way; then, once the
+// socket is writable, pf_ctx_connected() says how it went
 extern int pf_ctx_connect (pf_ctx_t *ctx);
+extern int pf_ctx_connected (pf_ctx_t *ctx);
 extern int pf_ctx_close (pf_ctx_t *ctx);
 
+// with PF_CLOSE_PEER, once the exchange is done: read until the peer's
+// FIN, 0 when it is in, -EAGAIN while it is not
+extern int pf_ctx_linger (pf_ctx_t *ctx);
+
+// re-arm TCP_QUICKACK, if so configured
+extern void pf_ctx_quickack (pf_ctx_t *ctx);
+
+// count whether fast open carried data on the SYN, before closing
+extern void pf_ctx_fastopen_result (pf_ctx_t *ctx);
+
+// a request/response exchange completed, ns after it started; the
+// next one gets a deadline of its own
+extern void pf_ctx_round_trip (pf_ctx_t *ctx, uint64_t ns);
+
+extern void pf_ctx_out_reset (pf_ctx_t *ctx);
+extern int pf_ctx_out_add (pf_ctx_t *ctx, const void *base, size_t len);
+extern int pf_ctx_out_add_file (pf_ctx_t *ctx, int fd, off_t off, size_t len);
+extern ssize_t pf_ctx_out_flush (pf_ctx_t *ctx);
+
 #endif // __included__pf_ctx_h__
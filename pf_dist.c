@@ -0,0 +1,989 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <endian.h>
+#include <netdb.h>
+
+#include <sys/types.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "pf_dbg.h"
+#include "pf_stat.h"
+#include "pf_hist.h"
+#include "pf_clock.h"
+#include "pf_hash.h"
+#include "pf_sha256.h"
+#include "pf_dist.h"
+
+// ------------------------------------------------------------------------
+// messages: a type and a length, both 32bit big endian, then the payload
+
+enum pf_dist_msg_e {
+	PF_DIST_CONF = 1,       // -> worker: index, no_workers, argc, argv
+	PF_DIST_READY,          // <- worker: set up
+	PF_DIST_START,          // -> worker: CLOCK_REALTIME ns to start at
+	PF_DIST_STATS,          // <- worker: one interval
+	PF_DIST_HELLO,          // <- magic, version, records, nonce
+				// -> magic, HMAC of the above with the token
+				// <- empty, accepted
+};
+
+#define PF_DIST_MSG_MAX         (16 << 20)
+
+// "pfds"; the version changes whenever any message does
+#define PF_DIST_MAGIC           0x70666473
+#define PF_DIST_VERSION         4
+
+// the shared secret, from the environment so that it is not in argv
+#define PF_DIST_TOKEN_ENV       "PF_DIST_TOKEN"
+#define PF_DIST_TOKEN_MAX       256
+#define PF_DIST_NONCE_LEN       32
+
+// a connection that does not say hello in time is dropped
+#define PF_DIST_HELLO_SEC       10
+
+// how far ahead of "everyone is ready" the start is scheduled
+#define PF_DIST_START_DELAY_NS  500000000ull
+#define PF_DIST_INTERVAL_NS     1000000000ull
+
+typedef struct pf_dist_buf_s {
+	uint8_t        *data;
+	size_t          len;            // bytes in data
+	size_t          max;            // allocated
+	size_t          pos;            // read position
+	int             bad;            // read past the end
+} pf_dist_buf_t;
+
+static void
+pf_dist_put (pf_dist_buf_t *b, const void *p, size_t n)
+{
+	if (b->len + n > b->max) {
+		b->max = (b->len + n) * 2;
+		b->data = realloc (b->data, b->max);
+		if (!b->data) BAIL ("realloc %zu", b->max);
+	}
+	memcpy (b->data + b->len, p, n);
+	b->len += n;
+}
+
+static void
+pf_dist_put_u32 (pf_dist_buf_t *b, uint32_t v)
+{
+	v = htobe32 (v);
+	pf_dist_put (b, &v, sizeof (v));
+}
+
+static void
+pf_dist_put_u64 (pf_dist_buf_t *b, uint64_t v)
+{
+	v = htobe64 (v);
+	pf_dist_put (b, &v, sizeof (v));
+}
+
+static const void *
+pf_dist_get (pf_dist_buf_t *b, size_t n)
+{
+	const void *p = b->data + b->pos;
+
+	if (b->bad || b->pos + n > b->len) {
+		b->bad = 1;
+		return NULL;
+	}
+	b->pos += n;
+	return p;
+}
+
+static uint32_t
+pf_dist_get_u32 (pf_dist_buf_t *b)
+{
+	uint32_t v;
+	const void *p = pf_dist_get (b, sizeof (v));
+
+	if (!p)
+		return 0;
+	memcpy (&v, p, sizeof (v));
+	return be32toh (v);
+}
+
+static uint64_t
+pf_dist_get_u64 (pf_dist_buf_t *b)
+{
+	uint64_t v;
+	const void *p = pf_dist_get (b, sizeof (v));
+
+	if (!p)
+		return 0;
+	memcpy (&v, p, sizeof (v));
+	return be64toh (v);
+}
+
+static int
+pf_dist_io (int fd, void *p, size_t n, int do_write)
+{
+	ssize_t rc;
+
+	while (n) {
+		rc = do_write ? send (fd, p, n, MSG_NOSIGNAL) : recv (fd, p, n, 0);
+		if (rc<0 && errno == EINTR)
+			continue;
+		if (rc<0)
+			return -errno;
+		if (rc == 0)
+			return -EPIPE;
+		p = (char*)p + rc;
+		n -= rc;
+	}
+	return 0;
+}
+
+static int
+pf_dist_send (int fd, uint type, const pf_dist_buf_t *b)
+{
+	uint32_t hdr[2] = { htobe32 (type), htobe32 (b ? b->len : 0) };
+	int rc;
+
+	rc = pf_dist_io (fd, hdr, sizeof (hdr), 1);
+	if (rc<0 || !b || !b->len)
+		return rc;
+	return pf_dist_io (fd, b->data, b->len, 1);
+}
+
+// receive one message into b, replacing what was there; returns its type
+static int
+pf_dist_recv (int fd, pf_dist_buf_t *b)
+{
+	uint32_t hdr[2];
+	int rc;
+
+	rc = pf_dist_io (fd, hdr, sizeof (hdr), 0);
+	if (rc<0)
+		return rc;
+
+	b->len = b->pos = 0;
+	b->bad = 0;
+	hdr[1] = be32toh (hdr[1]);
+	if (hdr[1] > PF_DIST_MSG_MAX)
+		return -EMSGSIZE;
+	if (hdr[1] > b->max) {
+		b->max = hdr[1];
+		b->data = realloc (b->data, b->max);
+		if (!b->data) BAIL ("realloc %zu", b->max);
+	}
+
+	rc = pf_dist_io (fd, b->data, hdr[1], 0);
+	if (rc<0)
+		return rc;
+	b->len = hdr[1];
+
+	return be32toh (hdr[0]);
+}
+
+// ------------------------------------------------------------------------
+// stats records
+//
+// Counters are sent as the difference to the last record, histograms as
+// the difference of every non-empty bucket.  Gauges and the run's start
+// and end, relative to the synchronized start, are sent as they are.
+
+typedef struct pf_dist_record_s {
+	uint            seq;
+	uint            final;
+	uint            completed;
+	uint            failed;
+	pf_tstat_t      ts;
+} pf_dist_record_t;
+
+// all threads of this process, read while they run
+static void
+pf_dist_snapshot (pf_tstat_t *ts, const pf_stat_t *stat, uint64_t base_ns)
+{
+	uint64_t start = 0, end = 0, v;
+	uint t;
+
+	memset (ts, 0, sizeof (*ts));
+
+	for (t=0; t<stat->no_threads; t++) {
+		const pf_tstat_t *src = &stat->thread[t];
+
+#define X(n)    ts->n += tstat_read (src, n);
+		PF_TSTAT_COUNTERS (X)
+		PF_TSTAT_GAUGES (X)
+#undef X
+#define X(n)    pf_hist_merge (&ts->n, &src->n);
+		PF_TSTAT_HISTS (X)
+#undef X
+
+		v = tstat_read (src, start_ns);
+		if (v && (!start || v < start))
+			start = v;
+		v = tstat_read (src, end_ns);
+		if (v > end)
+			end = v;
+	}
+
+	// these are per agent, not summed
+	if (stat->no_threads) {
+		ts->agent_hot_bytes /= stat->no_threads;
+		ts->agent_cold_bytes /= stat->no_threads;
+	}
+
+	ts->start_ns = start > base_ns ? start - base_ns : 0;
+	ts->end_ns = end > base_ns ? end - base_ns : 0;
+}
+
+static void
+pf_dist_put_hist (pf_dist_buf_t *b, const pf_hist_t *cur,
+		const pf_hist_t *prev)
+{
+	uint32_t nz = 0;
+	size_t at;
+	uint i;
+
+	pf_dist_put_u64 (b, cur->count - prev->count);
+	pf_dist_put_u64 (b, cur->sum - prev->sum);
+	pf_dist_put_u64 (b, cur->min);
+	pf_dist_put_u64 (b, cur->max);
+
+	at = b->len;
+	pf_dist_put_u32 (b, 0);
+	for (i=0; i<PF_HIST_BUCKETS; i++) {
+		if (cur->bucket[i] == prev->bucket[i])
+			continue;
+		pf_dist_put_u32 (b, i);
+		pf_dist_put_u64 (b, cur->bucket[i] - prev->bucket[i]);
+		nz++;
+	}
+
+	nz = htobe32 (nz);
+	memcpy (b->data + at, &nz, sizeof (nz));
+}
+
+static void
+pf_dist_get_hist (pf_dist_buf_t *b, pf_hist_t *h)
+{
+	uint32_t nz, i;
+
+	pf_hist_reset (h);
+	h->count = pf_dist_get_u64 (b);
+	h->sum = pf_dist_get_u64 (b);
+	h->min = pf_dist_get_u64 (b);
+	h->max = pf_dist_get_u64 (b);
+
+	nz = pf_dist_get_u32 (b);
+	while (nz-- && !b->bad) {
+		i = pf_dist_get_u32 (b);
+		if (i >= PF_HIST_BUCKETS) {
+			b->bad = 1;
+			break;
+		}
+		h->bucket[i] = pf_dist_get_u64 (b);
+	}
+}
+
+static void
+pf_dist_put_record (pf_dist_buf_t *b, const pf_dist_record_t *rec,
+		const pf_tstat_t *cur, const pf_tstat_t *prev)
+{
+	pf_dist_put_u32 (b, rec->seq);
+	pf_dist_put_u32 (b, rec->final);
+	pf_dist_put_u32 (b, rec->completed);
+	pf_dist_put_u32 (b, rec->failed);
+	pf_dist_put_u64 (b, cur->start_ns);
+	pf_dist_put_u64 (b, cur->end_ns);
+
+#define X(n)    pf_dist_put_u32 (b, cur->n);
+	PF_TSTAT_GAUGES (X)
+#undef X
+#define X(n)    pf_dist_put_u64 (b, cur->n - prev->n);
+	PF_TSTAT_COUNTERS (X)
+#undef X
+#define X(n)    pf_dist_put_hist (b, &cur->n, &prev->n);
+	PF_TSTAT_HISTS (X)
+#undef X
+}
+
+static int
+pf_dist_get_record (pf_dist_buf_t *b, pf_dist_record_t *rec)
+{
+	pf_tstat_t *ts = &rec->ts;
+
+	rec->seq = pf_dist_get_u32 (b);
+	rec->final = pf_dist_get_u32 (b);
+	rec->completed = pf_dist_get_u32 (b);
+	rec->failed = pf_dist_get_u32 (b);
+	ts->start_ns = pf_dist_get_u64 (b);
+	ts->end_ns = pf_dist_get_u64 (b);
+
+#define X(n)    ts->n = pf_dist_get_u32 (b);
+	PF_TSTAT_GAUGES (X)
+#undef X
+#define X(n)    ts->n = pf_dist_get_u64 (b);
+	PF_TSTAT_COUNTERS (X)
+#undef X
+#define X(n)    pf_dist_get_hist (b, &ts->n);
+	PF_TSTAT_HISTS (X)
+#undef X
+
+	return b->bad ? -EPROTO : 0;
+}
+
+// add the differences in src to dst; gauges are replaced
+static void
+pf_dist_accumulate (pf_tstat_t *dst, const pf_tstat_t *src)
+{
+#define X(n)    dst->n += src->n;
+	PF_TSTAT_COUNTERS (X)
+#undef X
+#define X(n)    dst->n = src->n;
+	PF_TSTAT_GAUGES (X)
+#undef X
+#define X(n)    pf_hist_merge (&dst->n, &src->n);
+	PF_TSTAT_HISTS (X)
+#undef X
+
+	if (src->start_ns)
+		dst->start_ns = src->start_ns;
+	if (src->end_ns)
+		dst->end_ns = src->end_ns;
+}
+
+// ------------------------------------------------------------------------
+// hello: the worker sends a fresh nonce, and the coordinator proves that
+// it knows the token with a MAC of it; the token never goes on the wire
+
+static const char *
+pf_dist_token (void)
+{
+	const char *token = getenv (PF_DIST_TOKEN_ENV);
+
+	if (!token || !*token)
+		BAIL ("distributed runs need a shared secret in "
+				PF_DIST_TOKEN_ENV);
+	if (strlen (token) > PF_DIST_TOKEN_MAX)
+		BAIL (PF_DIST_TOKEN_ENV " is longer than %u",
+				PF_DIST_TOKEN_MAX);
+	return token;
+}
+
+// the layout of a stats record, which follows the fields of pf_tstat_t
+// rather than the protocol version: builds with different counters
+// would misparse each other's records
+static uint64_t
+pf_dist_records (void)
+{
+	static const char fields[] =
+#define X(n)    #n ","
+		"gauges:" PF_TSTAT_GAUGES (X)
+		" counters:" PF_TSTAT_COUNTERS (X)
+		" hists:" PF_TSTAT_HISTS (X);
+#undef X
+	pf_hash_t h;
+	uint32_t n[] = { htobe32 (PF_ERR_MAX), htobe32 (PF_HIST_BUCKETS) };
+
+	pf_hash_init (&h);
+	pf_hash_update (&h, fields, sizeof (fields));
+	pf_hash_update (&h, n, sizeof (n));
+	return pf_hash_final (&h);
+}
+
+static void
+pf_dist_put_hello (pf_dist_buf_t *b)
+{
+	b->len = 0;
+	pf_dist_put_u32 (b, PF_DIST_MAGIC);
+	pf_dist_put_u32 (b, PF_DIST_VERSION);
+	pf_dist_put_u64 (b, pf_dist_records ());
+}
+
+// HMAC (token, nonce | magic | version | records), this build's own, so
+// a coordinator of another build cannot produce it either
+static void
+pf_dist_mac (const char *token, const void *nonce, uint8_t *mac)
+{
+	pf_dist_buf_t b = { 0 };
+
+	pf_dist_put (&b, nonce, PF_DIST_NONCE_LEN);
+	pf_dist_put_u32 (&b, PF_DIST_MAGIC);
+	pf_dist_put_u32 (&b, PF_DIST_VERSION);
+	pf_dist_put_u64 (&b, pf_dist_records ());
+	pf_hmac_sha256 (token, strlen (token), b.data, b.len, mac);
+	free (b.data);
+}
+
+// in time independent of where the first difference is
+static int
+pf_dist_mac_eq (const uint8_t *a, const uint8_t *b)
+{
+	uint8_t diff = 0;
+	uint i;
+
+	for (i=0; i<PF_SHA256_LEN; i++)
+		diff |= a[i] ^ b[i];
+	return !diff;
+}
+
+// <host>:<port>, or [<v6 address>]:<port>
+static struct addrinfo *
+pf_dist_resolve (const char *spec, const char *what)
+{
+	struct addrinfo hints = { .ai_socktype = SOCK_STREAM }, *ai;
+	char *host = strdup (spec), *port;
+
+	port = rindex (host, ':');
+	if (!port || port == host || !port[1])
+		BAIL ("%s must be <host>:<port>: %s", what, spec);
+	*port++ = 0;
+	if (host[0] == '[' && port[-2] == ']') {
+		port[-2] = 0;
+		memmove (host, host+1, strlen (host));
+	}
+
+	if (getaddrinfo (host, port, &hints, &ai))
+		BAIL ("cannot resolve %s %s", what, spec);
+
+	free (host);
+	return ai;
+}
+
+// ------------------------------------------------------------------------
+// worker
+
+static int
+pf_dist_listen (const char *addr)
+{
+	struct addrinfo *ai;
+	int fd, one = 1, zero = 0;
+
+	// only where asked to; [::] takes IPv4 as well
+	ai = pf_dist_resolve (addr, "worker address");
+
+	fd = socket (ai->ai_family, SOCK_STREAM, 0);
+	if (fd<0) BAIL ("worker socket");
+	setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof (one));
+	if (ai->ai_family == AF_INET6)
+		setsockopt (fd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof (zero));
+	if (bind (fd, ai->ai_addr, ai->ai_addrlen) < 0)
+		BAIL ("bind worker address %s", addr);
+	if (listen (fd, 16) < 0)
+		BAIL ("listen on worker address %s", addr);
+
+	freeaddrinfo (ai);
+	return fd;
+}
+
+// a wrong answer gets no reply at all
+static int
+pf_dist_worker_hello (int fd, const char *token)
+{
+	pf_dist_buf_t b = { 0 };
+	uint8_t nonce[PF_DIST_NONCE_LEN], mac[PF_SHA256_LEN];
+	const void *got;
+	uint32_t magic;
+	int type, rc;
+
+	if (getrandom (nonce, sizeof (nonce), 0) != sizeof (nonce))
+		BAIL ("getrandom");
+
+	pf_dist_put_hello (&b);
+	pf_dist_put (&b, nonce, sizeof (nonce));
+	rc = pf_dist_send (fd, PF_DIST_HELLO, &b);
+	if (rc<0)
+		goto out;
+
+	type = pf_dist_recv (fd, &b);
+	magic = pf_dist_get_u32 (&b);
+	got = pf_dist_get (&b, PF_SHA256_LEN);
+	pf_dist_mac (token, nonce, mac);
+	if (type != PF_DIST_HELLO || magic != PF_DIST_MAGIC || !got
+			|| !pf_dist_mac_eq (got, mac)) {
+		rc = -EACCES;
+		goto out;
+	}
+
+	rc = pf_dist_send (fd, PF_DIST_HELLO, NULL);
+out:
+	free (b.data);
+	return rc;
+}
+
+static int
+pf_dist_worker_conf (pf_dist_t *dist)
+{
+	pf_dist_buf_t b = { 0 };
+	const char *s;
+	int rc, i;
+
+	rc = pf_dist_recv (dist->fd, &b);
+	if (rc<0)
+		return rc;
+	if (rc != PF_DIST_CONF)
+		return -EPROTO;
+
+	dist->index = pf_dist_get_u32 (&b);
+	dist->no_workers = pf_dist_get_u32 (&b);
+	dist->argc = pf_dist_get_u32 (&b);
+	if (b.bad || dist->index >= dist->no_workers
+			|| dist->argc < 1 || dist->argc > 1024)
+		return -EPROTO;
+
+	dist->argv = calloc (dist->argc + 1, sizeof (char*));
+	if (!dist->argv)
+		return -ENOMEM;
+
+	for (i=0; i<dist->argc; i++) {
+		s = (const char*)b.data + b.pos;
+		if (!memchr (s, 0, b.len - b.pos))
+			return -EPROTO;
+		dist->argv[i] = strdup (s);
+		b.pos += strlen (s) + 1;
+	}
+
+	free (b.data);
+	return 0;
+}
+
+int
+pf_dist_worker (pf_dist_t *dist, const char *addr)
+{
+	struct sockaddr_storage sa;
+	struct timeval tv = { .tv_sec = PF_DIST_HELLO_SEC };
+	socklen_t salen;
+	char peer[NI_MAXHOST];
+	const char *token;
+	int lfd, fd, one = 1, rc;
+	pid_t pid;
+
+	memset (dist, 0, sizeof (*dist));
+
+	token = pf_dist_token ();
+	lfd = pf_dist_listen (addr);
+	printf ("worker waiting for a coordinator on %s\n", addr);
+	fflush (stdout);
+
+	// children are not waited for
+	signal (SIGCHLD, SIG_IGN);
+
+	for (;;) {
+		salen = sizeof (sa);
+		fd = accept (lfd, (struct sockaddr*)&sa, &salen);
+		if (fd<0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			BAIL ("accept");
+		}
+
+		pid = fork ();
+		if (pid<0)
+			BAIL ("fork");
+
+		if (pid) {
+			close (fd);
+			continue;
+		}
+
+		// child: runs one test for this coordinator
+		close (lfd);
+		signal (SIGCHLD, SIG_DFL);
+		setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof (one));
+		if (getnameinfo ((struct sockaddr*)&sa, salen, peer,
+					sizeof (peer), NULL, 0, NI_NUMERICHOST))
+			strcpy (peer, "?");
+
+		// until the configuration is in; after that, the coordinator
+		// may take as long as its slowest worker
+		setsockopt (fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv));
+		rc = pf_dist_worker_hello (fd, token);
+		errno = 0;
+		if (rc<0)
+			BAIL ("refused coordinator %s: a wrong token, or a "
+					"different pf build", peer);
+
+		dist->fd = fd;
+		if (pf_dist_worker_conf (dist) < 0)
+			BAIL ("bad configuration from coordinator %s", peer);
+		tv.tv_sec = 0;
+		setsockopt (fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv));
+
+		dist->sent = calloc (1, sizeof (pf_tstat_t));
+		if (!dist->sent)
+			BAIL ("calloc (1, pf_tstat_t)");
+
+		printf ("worker %u of %u, for %s\n", dist->index,
+				dist->no_workers, peer);
+		return 0;
+	}
+}
+
+int
+pf_dist_worker_ready (pf_dist_t *dist)
+{
+	pf_dist_buf_t b = { 0 };
+	struct timespec at;
+	uint64_t ns;
+	int rc;
+
+	rc = pf_dist_send (dist->fd, PF_DIST_READY, NULL);
+	if (rc<0)
+		BAIL ("lost coordinator");
+
+	rc = pf_dist_recv (dist->fd, &b);
+	if (rc != PF_DIST_START)
+		BAIL ("lost coordinator before start");
+
+	ns = pf_dist_get_u64 (&b);
+	free (b.data);
+
+	// wall clock, so that workers on different hosts agree
+	at.tv_sec = ns / 1000000000ull;
+	at.tv_nsec = ns % 1000000000ull;
+	while (clock_nanosleep (CLOCK_REALTIME, TIMER_ABSTIME, &at, NULL)
+			== EINTR)
+		;
+
+	dist->start_ns = pf_clock_read ();
+	dist->seq = 1;
+	return 0;
+}
+
+int
+pf_dist_worker_wait (pf_dist_t *dist)
+{
+	struct pollfd p = { .fd = dist->fd, .events = POLLIN };
+	uint64_t at = dist->start_ns + dist->seq * PF_DIST_INTERVAL_NS;
+	uint64_t now;
+	int rc;
+
+	while ((now = pf_clock_read ()) < at) {
+		rc = poll (&p, 1, (at - now + 999999) / 1000000);
+		if (rc<0 && errno == EINTR)
+			continue;
+
+		// the coordinator never sends anything after the start;
+		// readable means it has gone away
+		if (rc)
+			return -EPIPE;
+	}
+
+	return 0;
+}
+
+int
+pf_dist_worker_report (pf_dist_t *dist, pf_stat_t *stat, int final)
+{
+	pf_dist_buf_t b = { 0 };
+	pf_dist_record_t rec = { 0 };
+	pf_tstat_t *cur;
+	uint completed, failed;
+	int rc;
+
+	cur = malloc (sizeof (*cur));
+	if (!cur) BAIL ("malloc (pf_tstat_t)");
+
+	completed = stat_atomic_read (stat, no_completed);
+	failed = stat_atomic_read (stat, no_failed);
+	pf_dist_snapshot (cur, stat, dist->start_ns);
+
+	rec.seq = dist->seq++;
+	rec.final = final;
+	rec.completed = completed - dist->sent_completed;
+	rec.failed = failed - dist->sent_failed;
+	pf_dist_put_record (&b, &rec, cur, dist->sent);
+
+	rc = pf_dist_send (dist->fd, PF_DIST_STATS, &b);
+
+	memcpy (dist->sent, cur, sizeof (*cur));
+	dist->sent_completed = completed;
+	dist->sent_failed = failed;
+
+	free (b.data);
+	free (cur);
+	return rc;
+}
+
+// ------------------------------------------------------------------------
+// coordinator
+
+typedef struct pf_dist_peer_s {
+	int             fd;
+	const char     *name;
+	uint            last_seq;       // UINT32_MAX once done
+} pf_dist_peer_t;
+
+// intervals being collected; workers may be a few seconds apart
+#define PF_DIST_PENDING         8
+
+typedef struct pf_dist_interval_s {
+	uint            seq;
+	uint            completed;
+	uint            failed;
+	pf_tstat_t      ts;
+} pf_dist_interval_t;
+
+static int
+pf_dist_connect (const char *spec, const char *token)
+{
+	struct addrinfo *ai, *p;
+	pf_dist_buf_t b = { 0 };
+	uint8_t mac[PF_SHA256_LEN];
+	const void *nonce;
+	uint32_t magic, version;
+	uint64_t records;
+	int fd = -1, one = 1, type;
+
+	ai = pf_dist_resolve (spec, "worker");
+
+	for (p=ai; p; p=p->ai_next) {
+		fd = socket (p->ai_family, p->ai_socktype, p->ai_protocol);
+		if (fd<0)
+			continue;
+		if (!connect (fd, p->ai_addr, p->ai_addrlen))
+			break;
+		close (fd);
+		fd = -1;
+	}
+	if (fd<0)
+		BAIL ("cannot connect to worker %s", spec);
+
+	setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof (one));
+	freeaddrinfo (ai);
+
+	// the worker goes first, with its version and a nonce
+	type = pf_dist_recv (fd, &b);
+	magic = pf_dist_get_u32 (&b);
+	version = pf_dist_get_u32 (&b);
+	records = pf_dist_get_u64 (&b);
+	nonce = pf_dist_get (&b, PF_DIST_NONCE_LEN);
+	errno = 0;
+	if (type != PF_DIST_HELLO || magic != PF_DIST_MAGIC || !nonce)
+		BAIL ("%s is not a pf worker, or one older than protocol "
+				"version %u", spec, PF_DIST_VERSION);
+	if (version != PF_DIST_VERSION)
+		BAIL ("worker %s speaks protocol version %u, this is %u",
+				spec, version, PF_DIST_VERSION);
+	if (records != pf_dist_records ())
+		BAIL ("worker %s is a pf build with different stats, its "
+				"records would not parse", spec);
+
+	pf_dist_mac (token, nonce, mac);
+	b.len = 0;
+	pf_dist_put_u32 (&b, PF_DIST_MAGIC);
+	pf_dist_put (&b, mac, sizeof (mac));
+	if (pf_dist_send (fd, PF_DIST_HELLO, &b) < 0)
+		BAIL ("lost worker %s", spec);
+	if (pf_dist_recv (fd, &b) != PF_DIST_HELLO) {
+		errno = 0;
+		BAIL ("worker %s refused us; is " PF_DIST_TOKEN_ENV
+				" the same on both?", spec);
+	}
+
+	free (b.data);
+	return fd;
+}
+
+static void
+pf_dist_print_interval (const pf_dist_interval_t *iv)
+{
+	const pf_tstat_t *ts = &iv->ts;
+	double sec = PF_DIST_INTERVAL_NS / 1e9;
+	uint e;
+
+	printf ("%5us  completed %8u  fail %6u  %10.0f conn/s  "
+			"%8.3f Gbit/s rx",
+			iv->seq, iv->completed, iv->failed, iv->completed / sec,
+			ts->recv_bytes * 8 / sec / 1e9);
+	if (ts->rtt.count)
+		printf ("  %10.0f rt/s  rtt us: p50 %.1f p99 %.1f",
+				ts->round_trips / sec,
+				pf_hist_percentile (&ts->rtt, 50) / 1e3,
+				pf_hist_percentile (&ts->rtt, 99) / 1e3);
+	for (e=0; e<PF_ERR_MAX; e++)
+		if (ts->errors[e])
+			printf ("  %s %"PRIu64, pf_err_name (e), ts->errors[e]);
+	printf ("\n");
+	fflush (stdout);
+}
+
+int
+pf_dist_coordinator (const char *workers, int argc, char **argv,
+		pf_stat_t *stat, uint warmup_sec)
+{
+	pf_dist_peer_t *peer;
+	pf_dist_interval_t *pending, *iv;
+	pf_dist_record_t *rec;
+	pf_dist_buf_t b = { 0 };
+	struct pollfd *pfd;
+	struct timespec now;
+	const char *token;
+	char *list, *s, *save;
+	uint n = 0, w, live, lost = 0, next_seq = 1, seq;
+	uint completed = 0, failed = 0;
+	int i, rc;
+
+	token = pf_dist_token ();
+
+	// who
+	list = strdup (workers);
+	for (s = strtok_r (list, ",", &save); s; s = strtok_r (NULL, ",", &save))
+		n++;
+	if (!n)
+		BAIL ("no workers given");
+
+	peer = calloc (n, sizeof (*peer));
+	pfd = calloc (n, sizeof (*pfd));
+	pending = calloc (PF_DIST_PENDING, sizeof (*pending));
+	rec = calloc (1, sizeof (*rec));
+	stat->thread = calloc (n, sizeof (pf_tstat_t));
+	if (!peer || !pfd || !pending || !rec || !stat->thread)
+		BAIL ("failed to allocate coordinator state");
+	stat->no_threads = n;
+	if (warmup_sec) {
+		stat->warm = calloc (n, sizeof (pf_tstat_t));
+		if (!stat->warm)
+			BAIL ("failed to allocate coordinator state");
+	}
+
+	strcpy (list, workers);
+	w = 0;
+	for (s = strtok_r (list, ",", &save); s; s = strtok_r (NULL, ",", &save)) {
+		peer[w].name = s;
+		peer[w].fd = pf_dist_connect (s, token);
+		w++;
+	}
+
+	// push the configuration; every worker sets up and reports ready
+	for (w=0; w<n; w++) {
+		b.len = 0;
+		pf_dist_put_u32 (&b, w);
+		pf_dist_put_u32 (&b, n);
+		pf_dist_put_u32 (&b, argc);
+		for (i=0; i<argc; i++)
+			pf_dist_put (&b, argv[i], strlen (argv[i]) + 1);
+		if (pf_dist_send (peer[w].fd, PF_DIST_CONF, &b) < 0)
+			BAIL ("lost worker %s", peer[w].name);
+	}
+	for (w=0; w<n; w++) {
+		if (pf_dist_recv (peer[w].fd, &b) != PF_DIST_READY)
+			BAIL ("worker %s failed to set up", peer[w].name);
+		printf ("worker %u ready: %s\n", w, peer[w].name);
+	}
+
+	// everyone starts at the same time
+	clock_gettime (CLOCK_REALTIME, &now);
+	b.len = 0;
+	pf_dist_put_u64 (&b, (uint64_t)now.tv_sec * 1000000000ull
+			+ now.tv_nsec + PF_DIST_START_DELAY_NS);
+	for (w=0; w<n; w++)
+		if (pf_dist_send (peer[w].fd, PF_DIST_START, &b) < 0)
+			BAIL ("lost worker %s", peer[w].name);
+
+	// collect
+	for (live = n; live; ) {
+		uint min_seq;
+
+		for (w=0; w<n; w++) {
+			pfd[w].fd = peer[w].last_seq == UINT32_MAX
+				? -1 : peer[w].fd;
+			pfd[w].events = POLLIN;
+		}
+
+		rc = poll (pfd, n, -1);
+		if (rc<0 && errno == EINTR)
+			continue;
+		if (rc<0)
+			BAIL ("poll");
+
+		for (w=0; w<n; w++) {
+			if (!pfd[w].revents)
+				continue;
+
+			rc = pf_dist_recv (peer[w].fd, &b);
+			if (rc != PF_DIST_STATS
+					|| pf_dist_get_record (&b, rec) < 0) {
+				fprintf (stderr, "lost worker %s, its last "
+						"interval is missing\n",
+						peer[w].name);
+				peer[w].last_seq = UINT32_MAX;
+				live--;
+				lost++;
+				continue;
+			}
+
+			// lossless: the worker's own total, and the interval
+			pf_dist_accumulate (&stat->thread[w], &rec->ts);
+			completed += rec->completed;
+			failed += rec->failed;
+
+			// the warm-up is over for this worker
+			if (warmup_sec && rec->seq == warmup_sec)
+				pf_tstat_copy (&stat->warm[w], &stat->thread[w],
+						0, warmup_sec * 1000000000ull);
+
+			seq = rec->seq;
+			iv = &pending[seq % PF_DIST_PENDING];
+			if (iv->seq != seq) {
+				// too far apart; let the old one go as it is
+				if (iv->seq >= next_seq) {
+					pf_dist_print_interval (iv);
+					next_seq = iv->seq + 1;
+				}
+				memset (iv, 0, sizeof (*iv));
+				iv->seq = seq;
+			}
+			pf_dist_accumulate (&iv->ts, &rec->ts);
+			iv->completed += rec->completed;
+			iv->failed += rec->failed;
+
+			peer[w].last_seq = seq;
+			if (rec->final) {
+				peer[w].last_seq = UINT32_MAX;
+				live--;
+			}
+		}
+
+		// an interval is complete once every worker is past it
+		min_seq = UINT32_MAX;
+		for (w=0; w<n; w++)
+			if (peer[w].last_seq < min_seq)
+				min_seq = peer[w].last_seq;
+
+		for (; next_seq <= min_seq; next_seq++) {
+			iv = &pending[next_seq % PF_DIST_PENDING];
+			if (iv->seq != next_seq) {
+				// nothing further arrived
+				if (min_seq == UINT32_MAX)
+					break;
+				continue;
+			}
+			pf_dist_print_interval (iv);
+			iv->seq = 0;
+		}
+	}
+
+	printf ("completed %u  (fail %u) across %u workers\n",
+			completed, failed, n);
+	if (lost)
+		fprintf (stderr, "%u of %u workers were lost, the totals are "
+				"short\n", lost, n);
+
+	for (w=0; w<n; w++)
+		close (peer[w].fd);
+
+	free (b.data);
+	free (rec);
+	free (pending);
+	free (pfd);
+	free (peer);
+	free (list);
+	return lost ? -EPIPE : 0;
+}
@@ -0,0 +1,66 @@
+#ifndef __included__pf_dist_h__
+#define __included__pf_dist_h__
+
+#include <stdint.h>
+
+#include "pf_stat.h"
+
+/*
+ * Distributed runs.  A worker, started with -W <addr>:<port>, waits for
+ * coordinators; each one that connects gets a forked child, which
+ * receives the coordinator's command line and sets the test up exactly
+ * as if it had been given locally.  A coordinator first has to prove it
+ * knows the token both sides take from PF_DIST_TOKEN, by answering a
+ * fresh nonce from the worker with an HMAC-SHA256 keyed with it, and both
+ * have to speak the same protocol version and lay out stats records the
+ * same way, or the worker drops the connection.  Once every worker is ready, the
+ * coordinator picks a wall clock time for all of them to start at.
+ *
+ * While running, a worker sends what changed in its counters and
+ * histograms every second, and the remainder when it is done.
+ * Histograms travel as raw bucket counts, so the coordinator merges
+ * them without loss, per interval and for the final report.
+ */
+
+typedef struct pf_dist_s {
+	int             fd;             // connection to the coordinator
+	uint            index;          // this worker, of no_workers
+	uint            no_workers;
+
+	// command line the coordinator sent
+	int             argc;
+	char          **argv;
+
+	// intervals since the synchronized start
+	uint64_t        start_ns;
+	uint            seq;
+
+	// what was reported so far, subtracted from the next report
+	pf_tstat_t     *sent;
+	uint            sent_completed;
+	uint            sent_failed;
+} pf_dist_t;
+
+// worker: listen on <addr>:<port>, and return in a child process once a
+// coordinator has said hello and sent its command line
+extern int pf_dist_worker (pf_dist_t *dist, const char *addr);
+
+// worker: setup is done; wait for the coordinator's start time
+extern int pf_dist_worker_ready (pf_dist_t *dist);
+
+// worker: wait for the end of the current interval; fails if the
+// coordinator went away
+extern int pf_dist_worker_wait (pf_dist_t *dist);
+
+// worker: send what changed since the last report
+extern int pf_dist_worker_report (pf_dist_t *dist, pf_stat_t *stat,
+		int final);
+
+// coordinator: run argv on every worker in the comma separated
+// <host>:<port> list, and collect their totals into stat, one
+// pf_tstat_t per worker; with a warm-up, stat->warm holds them as they
+// were after its last interval; -EPIPE if a worker was lost on the way
+extern int pf_dist_coordinator (const char *workers, int argc, char **argv,
+		pf_stat_t *stat, uint warmup_sec);
+
+#endif // __included__pf_dist_h__
@@ -0,0 +1,196 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+
+#include <zlib.h>
+#include <brotli/decode.h>
+
+#include "pf_enc.h"
+
+// decoded output, one per thread
+#define PF_DEC_BUF              (64*1024)
+
+struct pf_dec_s {
+	pf_dec_t               *next;           // in the free pool
+	enum pf_enc_e           enc;
+	uint                    done:1;
+	uint                    z_init:1;
+	z_stream                z;
+	BrotliDecoderState     *br;
+};
+
+static __thread pf_dec_t *pf_dec_pool;
+static __thread uint8_t *pf_dec_buf;
+
+static const char *pf_enc_names[PF_ENC_MAX] = {
+	[PF_ENC_NONE]           = "identity",
+	[PF_ENC_GZIP]           = "gzip",
+	[PF_ENC_DEFLATE]        = "deflate",
+	[PF_ENC_BR]             = "br",
+};
+
+const char *
+pf_enc_name (enum pf_enc_e enc)
+{
+	return enc < PF_ENC_MAX ? pf_enc_names[enc] : "?";
+}
+
+enum pf_enc_e
+pf_enc_parse (const char *name, size_t len)
+{
+	uint e;
+
+	if (len == 6 && !strncasecmp (name, "x-gzip", 6))
+		return PF_ENC_GZIP;
+
+	for (e=PF_ENC_NONE+1; e<PF_ENC_MAX; e++)
+		if (len == strlen (pf_enc_names[e])
+				&& !strncasecmp (name, pf_enc_names[e], len))
+			return e;
+
+	return PF_ENC_NONE;
+}
+
+pf_dec_t *
+pf_dec_get (enum pf_enc_e enc)
+{
+	pf_dec_t *dec = pf_dec_pool;
+
+	if (!pf_dec_buf && !(pf_dec_buf = malloc (PF_DEC_BUF)))
+		return NULL;
+
+	if (dec)
+		pf_dec_pool = dec->next;
+	else if (!(dec = calloc (1, sizeof (*dec))))
+		return NULL;
+
+	dec->enc = enc;
+	dec->done = 0;
+
+	switch (enc) {
+	case PF_ENC_GZIP:
+	case PF_ENC_DEFLATE:
+		// gzip or zlib, told apart by their headers
+		if (dec->z_init ? inflateReset (&dec->z) != Z_OK
+				: inflateInit2 (&dec->z, 15 + 32) != Z_OK)
+			goto fail;
+		dec->z_init = 1;
+		break;
+	case PF_ENC_BR:
+		if (dec->br)
+			BrotliDecoderDestroyInstance (dec->br);
+		dec->br = BrotliDecoderCreateInstance (NULL, NULL, NULL);
+		if (!dec->br)
+			goto fail;
+		break;
+	default:
+		goto fail;
+	}
+
+	return dec;
+
+fail:
+	pf_dec_put (dec);
+	return NULL;
+}
+
+void
+pf_dec_put (pf_dec_t *dec)
+{
+	dec->next = pf_dec_pool;
+	pf_dec_pool = dec;
+}
+
+static int
+pf_dec_zlib (pf_dec_t *dec, const void *in, size_t len, pf_dec_out_t out,
+		void *arg)
+{
+	z_stream *z = &dec->z;
+	int rc;
+
+	z->next_in = (Bytef *)in;
+	z->avail_in = len;
+
+	// until the input is used up and the output has room to spare
+	do {
+		z->next_out = pf_dec_buf;
+		z->avail_out = PF_DEC_BUF;
+		rc = inflate (z, Z_NO_FLUSH);
+		if (rc != Z_OK && rc != Z_STREAM_END && rc != Z_BUF_ERROR)
+			return -EPROTO;
+		if (z->avail_out < PF_DEC_BUF)
+			out (arg, pf_dec_buf, PF_DEC_BUF - z->avail_out);
+		if (rc == Z_STREAM_END) {
+			dec->done = 1;
+			break;
+		}
+	} while (rc == Z_OK && (z->avail_in || !z->avail_out));
+
+	return 0;
+}
+
+static int
+pf_dec_brotli (pf_dec_t *dec, const void *in, size_t len, pf_dec_out_t out,
+		void *arg)
+{
+	BrotliDecoderResult rc;
+	const uint8_t *next_in = in;
+	uint8_t *next_out;
+	size_t avail_out;
+
+	do {
+		next_out = pf_dec_buf;
+		avail_out = PF_DEC_BUF;
+		rc = BrotliDecoderDecompressStream (dec->br, &len, &next_in,
+				&avail_out, &next_out, NULL);
+		if (rc == BROTLI_DECODER_RESULT_ERROR)
+			return -EPROTO;
+		if (avail_out < PF_DEC_BUF)
+			out (arg, pf_dec_buf, PF_DEC_BUF - avail_out);
+	} while (rc == BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT);
+
+	if (rc == BROTLI_DECODER_RESULT_SUCCESS)
+		dec->done = 1;
+
+	return 0;
+}
+
+int
+pf_dec_run (pf_dec_t *dec, const void *in, size_t len, pf_dec_out_t out,
+		void *arg)
+{
+	// whatever follows the end of the stream is not looked at
+	if (dec->done || !len)
+		return 0;
+
+	if (dec->enc == PF_ENC_BR)
+		return pf_dec_brotli (dec, in, len, out, arg);
+	return pf_dec_zlib (dec, in, len, out, arg);
+}
+
+int
+pf_dec_done (const pf_dec_t *dec)
+{
+	return dec->done;
+}
+
+void
+pf_dec_thread_fini (void)
+{
+	pf_dec_t *dec;
+
+	while ((dec = pf_dec_pool)) {
+		pf_dec_pool = dec->next;
+		if (dec->z_init)
+			inflateEnd (&dec->z);
+		if (dec->br)
+			BrotliDecoderDestroyInstance (dec->br);
+		free (dec);
+	}
+
+	free (pf_dec_buf);
+	pf_dec_buf = NULL;
+}
@@ -0,0 +1,51 @@
+#ifndef __included__pf_enc_h__
+#define __included__pf_enc_h__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Content encodings: gzip and deflate, with zlib, and br, with brotli.
+ * A response body is decoded as it is read, in pieces, by a decoder
+ * taken from a per-thread pool when its header is through and given
+ * back when it ends.  A thread holds only as many decoders as it has
+ * encoded responses in flight at once, and each is reused: zlib's state
+ * is reset in place; brotli has no reset, so its state is made anew.
+ *
+ * Decoded data goes to a callback, a piece at a time, from one
+ * per-thread output buffer; nothing keeps it.
+ */
+
+enum pf_enc_e {
+	PF_ENC_NONE,
+	PF_ENC_GZIP,
+	PF_ENC_DEFLATE,
+	PF_ENC_BR,
+	PF_ENC_MAX
+};
+
+struct pf_dec_s;
+typedef struct pf_dec_s pf_dec_t;
+
+typedef void (*pf_dec_out_t) (void *arg, const void *data, size_t len);
+
+extern const char *pf_enc_name (enum pf_enc_e enc);
+
+// from a Content-Encoding value; PF_ENC_NONE for anything else
+extern enum pf_enc_e pf_enc_parse (const char *name, size_t len);
+
+// a decoder for one body, or NULL if out of memory
+extern pf_dec_t *pf_dec_get (enum pf_enc_e enc);
+extern void pf_dec_put (pf_dec_t *dec);
+
+// decode the next piece of the body; -EPROTO if it is not valid
+extern int pf_dec_run (pf_dec_t *dec, const void *in, size_t len,
+		pf_dec_out_t out, void *arg);
+
+// whether the encoded stream has come to its end
+extern int pf_dec_done (const pf_dec_t *dec);
+
+// free the calling thread's pool and output buffer
+extern void pf_dec_thread_fini (void);
+
+#endif // __included__pf_enc_h__
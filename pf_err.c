@@ -0,0 +1,49 @@
+#include <errno.h>
+
+#include "pf_err.h"
+
+enum pf_err_e
+pf_err_class (int err)
+{
+	switch (-err) {
+	case ECONNREFUSED:
+		return PF_ERR_REFUSED;
+
+	case ECONNRESET:
+	case ECONNABORTED:
+	case EPIPE:
+		return PF_ERR_RESET;
+
+	case ETIMEDOUT:
+		return PF_ERR_TIMEOUT;
+
+	case EMFILE:
+	case ENFILE:
+	case EADDRNOTAVAIL:
+	case EADDRINUSE:
+	case ENOBUFS:
+	case ENOMEM:
+	case EAGAIN:
+		return PF_ERR_EXHAUSTED;
+
+	case EPROTO:
+	case EBADMSG:
+		return PF_ERR_PROTOCOL;
+	}
+	return PF_ERR_OTHER;
+}
+
+const char *
+pf_err_name (enum pf_err_e cls)
+{
+	switch (cls) {
+	case PF_ERR_REFUSED:    return "refused";
+	case PF_ERR_RESET:      return "reset";
+	case PF_ERR_TIMEOUT:    return "timeout";
+	case PF_ERR_EXHAUSTED:  return "exhausted";
+	case PF_ERR_PROTOCOL:   return "protocol";
+	case PF_ERR_OTHER:      return "other";
+	case PF_ERR_MAX:        break;
+	}
+	return "?";
+}
@@ -0,0 +1,33 @@
+#ifndef __included__pf_err_h__
+#define __included__pf_err_h__
+
+/*
+ * Why a connection failed.  Under overload the kinds of failure say as
+ * much as the latencies do: a full accept queue refuses, a crashing or
+ * shedding server resets, a saturated one stops answering, and the
+ * generator itself may run out of descriptors or ephemeral ports.  None
+ * of these stop a run; each is counted per thread, by class.
+ */
+
+enum pf_err_e {
+	PF_ERR_REFUSED,         // connect refused
+	PF_ERR_RESET,           // reset or closed under us
+	PF_ERR_TIMEOUT,         // no answer in time: our deadline, or TCP
+	PF_ERR_EXHAUSTED,       // out of descriptors, ports or buffers
+	PF_ERR_PROTOCOL,        // the peer broke the protocol
+	PF_ERR_OTHER,
+	PF_ERR_MAX
+};
+
+// the pf_tstat_t errors[] counters, in the form PF_TSTAT_COUNTERS wants
+#define PF_TSTAT_ERRORS(X)                                              \
+	X(errors[PF_ERR_REFUSED]) X(errors[PF_ERR_RESET])               \
+	X(errors[PF_ERR_TIMEOUT]) X(errors[PF_ERR_EXHAUSTED])           \
+	X(errors[PF_ERR_PROTOCOL]) X(errors[PF_ERR_OTHER])
+
+// class of a failure, given as -errno
+extern enum pf_err_e pf_err_class (int err);
+
+extern const char *pf_err_name (enum pf_err_e cls);
+
+#endif // __included__pf_err_h__
@@ -0,0 +1,154 @@
+#include <stdint.h>
+#include <string.h>
+#include <endian.h>
+
+#include "pf_hash.h"
+
+#define P1      0x9e3779b185ebca87ull
+#define P2      0xc2b2ae3d27d4eb4full
+#define P3      0x165667b19e3779f9ull
+#define P4      0x85ebca77c2b2ae63ull
+#define P5      0x27d4eb2f165667c5ull
+
+static inline uint64_t
+pf_hash_rotl (uint64_t x, uint r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t
+pf_hash_read64 (const uint8_t *p)
+{
+	uint64_t v;
+
+	memcpy (&v, p, sizeof (v));
+	return le64toh (v);
+}
+
+static inline uint32_t
+pf_hash_read32 (const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy (&v, p, sizeof (v));
+	return le32toh (v);
+}
+
+static inline uint64_t
+pf_hash_round (uint64_t acc, uint64_t in)
+{
+	acc += in * P2;
+	acc = pf_hash_rotl (acc, 31);
+	return acc * P1;
+}
+
+static inline uint64_t
+pf_hash_merge (uint64_t acc, uint64_t v)
+{
+	acc ^= pf_hash_round (0, v);
+	return acc * P1 + P4;
+}
+
+// whole 32 byte stripes
+static const uint8_t *
+pf_hash_stripes (uint64_t *v, const uint8_t *p, const uint8_t *end)
+{
+	uint64_t v0 = v[0], v1 = v[1], v2 = v[2], v3 = v[3];
+
+	for (; p + 32 <= end; p += 32) {
+		v0 = pf_hash_round (v0, pf_hash_read64 (p));
+		v1 = pf_hash_round (v1, pf_hash_read64 (p + 8));
+		v2 = pf_hash_round (v2, pf_hash_read64 (p + 16));
+		v3 = pf_hash_round (v3, pf_hash_read64 (p + 24));
+	}
+
+	v[0] = v0;
+	v[1] = v1;
+	v[2] = v2;
+	v[3] = v3;
+	return p;
+}
+
+void
+pf_hash_init (pf_hash_t *h)
+{
+	// the seed is 0
+	h->v[0] = P1 + P2;
+	h->v[1] = P2;
+	h->v[2] = 0;
+	h->v[3] = -P1;
+	h->len = 0;
+}
+
+void
+pf_hash_update (pf_hash_t *h, const void *data, size_t len)
+{
+	const uint8_t *p = data, *end = p + len;
+	uint have = h->len % 32, n;
+
+	h->len += len;
+
+	// top up what an earlier call left
+	if (have) {
+		n = 32 - have < len ? 32 - have : len;
+		memcpy (h->buf + have, p, n);
+		p += n;
+		if (have + n < 32)
+			return;
+		pf_hash_stripes (h->v, h->buf, h->buf + 32);
+	}
+
+	p = pf_hash_stripes (h->v, p, end);
+	memcpy (h->buf, p, end - p);
+}
+
+uint64_t
+pf_hash_final (const pf_hash_t *h)
+{
+	const uint8_t *p = h->buf, *end = p + h->len % 32;
+	uint64_t acc;
+
+	if (h->len >= 32) {
+		acc = pf_hash_rotl (h->v[0], 1) + pf_hash_rotl (h->v[1], 7)
+			+ pf_hash_rotl (h->v[2], 12)
+			+ pf_hash_rotl (h->v[3], 18);
+		acc = pf_hash_merge (acc, h->v[0]);
+		acc = pf_hash_merge (acc, h->v[1]);
+		acc = pf_hash_merge (acc, h->v[2]);
+		acc = pf_hash_merge (acc, h->v[3]);
+	} else
+		acc = P5;
+
+	acc += h->len;
+
+	for (; p + 8 <= end; p += 8) {
+		acc ^= pf_hash_round (0, pf_hash_read64 (p));
+		acc = pf_hash_rotl (acc, 27) * P1 + P4;
+	}
+	if (p + 4 <= end) {
+		acc ^= pf_hash_read32 (p) * P1;
+		acc = pf_hash_rotl (acc, 23) * P2 + P3;
+		p += 4;
+	}
+	for (; p < end; p++) {
+		acc ^= *p * P5;
+		acc = pf_hash_rotl (acc, 11) * P1;
+	}
+
+	acc ^= acc >> 33;
+	acc *= P2;
+	acc ^= acc >> 29;
+	acc *= P3;
+	acc ^= acc >> 32;
+	return acc;
+}
+
+uint64_t
+pf_hash (const void *data, size_t len)
+{
+	pf_hash_t h;
+
+	pf_hash_init (&h);
+	pf_hash_update (&h, data, len);
+	return pf_hash_final (&h);
+}
@@ -0,0 +1,28 @@
+#ifndef __included__pf_hash_h__
+#define __included__pf_hash_h__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * XXH64, computed incrementally: data can be fed as it comes off the
+ * socket, in pieces of any size, and the result is the same as the
+ * reference xxhsum of the whole.  Four independent lanes take 32 bytes
+ * per step, several GB/s per core, so hashing every response costs
+ * little next to the read that brought it in.
+ */
+
+typedef struct pf_hash_s {
+	uint64_t                v[4];
+	uint64_t                len;            // total so far
+	uint8_t                 buf[32];        // len % 32 bytes not taken
+} pf_hash_t;
+
+extern void pf_hash_init (pf_hash_t *h);
+extern void pf_hash_update (pf_hash_t *h, const void *data, size_t len);
+extern uint64_t pf_hash_final (const pf_hash_t *h);
+
+// all at once
+extern uint64_t pf_hash (const void *data, size_t len);
+
+#endif // __included__pf_hash_h__
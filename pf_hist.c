@@ -0,0 +1,193 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <sys/types.h>
+
+#include "pf_hist.h"
+
+void
+pf_hist_reset (pf_hist_t *h)
+{
+	memset (h, 0, sizeof (*h));
+}
+
+void
+pf_hist_merge (pf_hist_t *dst, const pf_hist_t *src)
+{
+	uint64_t count = 0, n;
+	uint i;
+
+	if (!__hist_get (&src->count))
+		return;
+
+	// src may be live; take count from the buckets so they agree
+	for (i=0; i<PF_HIST_BUCKETS; i++) {
+		n = __hist_get (&src->bucket[i]);
+		dst->bucket[i] += n;
+		count += n;
+	}
+
+	n = __hist_get (&src->min);
+	if (!dst->count || n < dst->min)
+		dst->min = n;
+	n = __hist_get (&src->max);
+	if (n > dst->max)
+		dst->max = n;
+	dst->count += count;
+	dst->sum += __hist_get (&src->sum);
+}
+
+void
+pf_hist_sub (pf_hist_t *dst, const pf_hist_t *prev)
+{
+	uint i, lo = PF_HIST_BUCKETS, hi = 0;
+
+	for (i=0; i<PF_HIST_BUCKETS; i++) {
+		dst->bucket[i] -= prev->bucket[i];
+		if (!dst->bucket[i])
+			continue;
+		if (lo == PF_HIST_BUCKETS)
+			lo = i;
+		hi = i;
+	}
+	dst->count -= prev->count;
+	dst->sum -= prev->sum;
+
+	// the exact min and max may have been in what was taken out; then
+	// the bounds of what is left are the best there is
+	if (lo == PF_HIST_BUCKETS) {
+		dst->min = dst->max = 0;
+		return;
+	}
+	if (pf_hist_index (dst->min) != lo)
+		dst->min = pf_hist_bucket_low (lo);
+	if (pf_hist_index (dst->max) != hi)
+		dst->max = pf_hist_bucket_high (hi);
+}
+
+uint64_t
+pf_hist_bucket_low (uint i)
+{
+	uint shift;
+
+	if (i < 2*PF_HIST_SUB)
+		return i;
+
+	shift = (i >> PF_HIST_SUB_BITS) - 1;
+	return (uint64_t)((i & (PF_HIST_SUB-1)) | PF_HIST_SUB) << shift;
+}
+
+uint64_t
+pf_hist_bucket_high (uint i)
+{
+	if (i < 2*PF_HIST_SUB)
+		return i;
+
+	if (i == PF_HIST_BUCKETS-1)
+		return UINT64_MAX;
+
+	return pf_hist_bucket_low (i+1) - 1;
+}
+
+uint64_t
+pf_hist_percentile (const pf_hist_t *h, double pct)
+{
+	uint64_t want, seen = 0, v;
+	uint i;
+
+	if (!h->count)
+		return 0;
+
+	want = (uint64_t)(pct / 100.0 * h->count + 0.5);
+	if (want < 1)
+		want = 1;
+	if (want > h->count)
+		want = h->count;
+
+	for (i=0; i<PF_HIST_BUCKETS; i++) {
+		seen += h->bucket[i];
+		if (seen >= want)
+			break;
+	}
+
+	// middle of the bucket, but never outside of what was seen
+	v = pf_hist_bucket_low (i)
+		+ (pf_hist_bucket_high (i) - pf_hist_bucket_low (i)) / 2;
+	if (v < h->min)
+		v = h->min;
+	if (v > h->max)
+		v = h->max;
+
+	return v;
+}
+
+uint64_t
+pf_hist_count_below (const pf_hist_t *h, uint64_t v)
+{
+	uint64_t n = 0;
+	uint i;
+
+	for (i=0; i<PF_HIST_BUCKETS && pf_hist_bucket_high (i) <= v; i++)
+		n += h->bucket[i];
+
+	return n;
+}
+
+double
+pf_hist_mean (const pf_hist_t *h)
+{
+	if (!h->count)
+		return 0;
+	return (double)h->sum / h->count;
+}
+
+void
+pf_hist_encode (const pf_hist_t *h, FILE *f)
+{
+	uint i, last = 0;
+
+	fprintf (f, "%"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64,
+			h->count, h->sum, h->min, h->max);
+	for (i=0; i<PF_HIST_BUCKETS; i++) {
+		if (!h->bucket[i])
+			continue;
+		fprintf (f, " %u:%"PRIu64, i - last, h->bucket[i]);
+		last = i;
+	}
+}
+
+int
+pf_hist_decode (pf_hist_t *h, const char *s)
+{
+	uint64_t count = 0, gap, n;
+	uint i = 0;
+	char *end;
+	int len;
+
+	pf_hist_reset (h);
+	if (sscanf (s, "%"SCNu64" %"SCNu64" %"SCNu64" %"SCNu64"%n",
+			&h->count, &h->sum, &h->min, &h->max, &len) != 4)
+		return -EINVAL;
+
+	for (s += len; *s == ' '; s = end) {
+		gap = strtoull (s, &end, 10);
+		if (*end != ':' || i + gap >= PF_HIST_BUCKETS)
+			return -EINVAL;
+		s = end + 1;
+		n = strtoull (s, &end, 10);
+		if (end == s)
+			return -EINVAL;
+		i += gap;
+		h->bucket[i] = n;
+		count += n;
+	}
+
+	// the buckets must account for all of count
+	if ((*s && *s != '\n') || count != h->count)
+		return -EINVAL;
+
+	return 0;
+}
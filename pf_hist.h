@@ -0,0 +1,85 @@
+#ifndef __included__pf_hist_h__
+#define __included__pf_hist_h__
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+ * Log-linear histogram of 64bit values (usually nanoseconds).  Values
+ * below PF_HIST_SUB are exact, above that every power of two is split
+ * into PF_HIST_SUB linear buckets, so the relative error is bounded by
+ * 1/PF_HIST_SUB.  The layout is fixed, which makes merging two
+ * histograms a plain per-bucket addition.
+ *
+ * A histogram has a single writer, pf_hist_add(), but may be merged by
+ * another thread while it is being filled, hence the relaxed atomics.
+ */
+
+#define PF_HIST_SUB_BITS        5
+#define PF_HIST_SUB             (1 << PF_HIST_SUB_BITS)
+#define PF_HIST_BUCKETS         ((64 - PF_HIST_SUB_BITS + 1) * PF_HIST_SUB)
+
+typedef struct pf_hist_s {
+	uint64_t                count;
+	uint64_t                sum;
+	uint64_t                min;
+	uint64_t                max;
+	uint64_t                bucket[PF_HIST_BUCKETS];
+} pf_hist_t;
+
+static inline uint
+pf_hist_index (uint64_t v)
+{
+	uint shift;
+
+	if (v < PF_HIST_SUB)
+		return v;
+
+	shift = (63 - __builtin_clzll (v)) - PF_HIST_SUB_BITS;
+	return (shift << PF_HIST_SUB_BITS) + (v >> shift);
+}
+
+#define __hist_set(p,v) __atomic_store_n ((p), (v), __ATOMIC_RELAXED)
+#define __hist_get(p)   __atomic_load_n ((p), __ATOMIC_RELAXED)
+
+static inline void
+pf_hist_add (pf_hist_t *h, uint64_t v)
+{
+	uint64_t *b = &h->bucket[pf_hist_index (v)];
+
+	if (!h->count || v < h->min)
+		__hist_set (&h->min, v);
+	if (v > h->max)
+		__hist_set (&h->max, v);
+	__hist_set (b, *b + 1);
+	__hist_set (&h->sum, h->sum + v);
+	__hist_set (&h->count, h->count + 1);
+}
+
+extern void pf_hist_reset (pf_hist_t *h);
+extern void pf_hist_merge (pf_hist_t *dst, const pf_hist_t *src);
+
+// take an earlier snapshot of dst out of it, leaving what was added
+// since; min and max narrow to the buckets still in use
+extern void pf_hist_sub (pf_hist_t *dst, const pf_hist_t *prev);
+
+// smallest and largest value that land in bucket i
+extern uint64_t pf_hist_bucket_low (uint i);
+extern uint64_t pf_hist_bucket_high (uint i);
+
+// number of values in buckets entirely at or below v
+extern uint64_t pf_hist_count_below (const pf_hist_t *h, uint64_t v);
+
+// value at percentile pct (0..100), clamped to the observed min/max
+extern uint64_t pf_hist_percentile (const pf_hist_t *h, double pct);
+extern double pf_hist_mean (const pf_hist_t *h);
+
+// one line of text: count, sum, min and max, then every non-empty bucket
+// as <index since the last one>:<count>, so a few hundred bytes for a
+// typical latency distribution
+extern void pf_hist_encode (const pf_hist_t *h, FILE *f);
+
+// back from pf_hist_encode's text; -EINVAL if it is not that
+extern int pf_hist_decode (pf_hist_t *h, const char *s);
+
+#endif // __included__pf_hist_h__
@@ -2,8 +2,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <strings.h>
 #include <unistd.h>
+#include <fcntl.h>
 
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -11,56 +17,585 @@
 #include "pf_dbg.h"
 #include "pf_conf.h"
 #include "pf_ctx.h"
+#include "pf_stat.h"
+#include "pf_clock.h"
+#include "pf_module.h"
+#include "pf_tmpl.h"
+#include "pf_hash.h"
+#include "pf_enc.h"
+#include "pf_http.h"
 
-// TODO: make this thread-safe
-static char http_buf[4096];
-static const size_t http_buf_max = 4096;
+// receive buffer, one per thread
+static __thread char *http_buf;
+static size_t http_buf_max = 4096;
+
+// bulk download mode
+static uint http_bulk = 0;
+#define HTTP_BULK_BUF_DEFAULT   (1024*1024)
+
+// the request: header built once at setup and compiled into a template,
+// optional body shared by all connections (inline, random or an mmapped
+// file) and never copied
+static char *http_hdr;
+static size_t http_hdr_len;
+static pf_tmpl_t http_tmpl;
+static const char *http_body;
+static size_t http_body_len;
+static int http_body_fd = -1;
+static uint http_sendfile = 0;
+
+// what {counter} shows next, in steps of the thread count
+static __thread uint64_t http_counter;
+
+// response bodies checked against an expected length, hash, or both
+static uint http_verify_len;
+static uint http_verify_hash;
+static size_t http_expect_len;
+static uint64_t http_expect_hash;
+
+// Accept-Encoding is sent, and the bodies that come encoded are decoded
+static const char *http_encoding;
+static uint http_decode;
 
 typedef struct pf_http_s {
-	size_t req_len;
-	char *request;
+	// per connection response tracking
+	uint64_t        start_ns;
+	uint64_t        first_byte_ns;
+	uint64_t        body_bytes;
+	uint            hdr_match;      // chars of EOL EOL matched so far
+	uint            hdr_done:1;
+
+	// the body as the application sees it, decoded if it was encoded
+	uint64_t        out_bytes;
+	pf_hash_t       hash;           // when verifying
+
+	// the response's Content-Encoding, and its decoder, if decoding
+	enum pf_enc_e   enc;
+	pf_dec_t       *dec;
+
+	// the start of the header line being scanned, for Content-Encoding
+	uint8_t         line_len;
+	char            line[32];
+
+	// the template's variables, rendered for this request
+	char            scratch[];
 } pf_http_t;
 
 #define EOL "\r\n"
 
-int
-http_init (pf_ctx_t *ctx)
+static int
+http_setup_body (const char *file, const char *data, size_t random)
+{
+	struct stat st;
+	char *buf;
+	size_t i;
+
+	if (!!file + !!data + !!random > 1)
+		BAIL ("http: only one of file=, data= and random= can be used");
+
+	if (http_sendfile && !file)
+		BAIL ("http: sendfile needs a file= body");
+
+	if (data) {
+		http_body = data;
+		http_body_len = strlen (data);
+
+	} else if (random) {
+		buf = malloc (random);
+		if (!buf)
+			return -ENOMEM;
+		for (i=0; i<random; i++)
+			buf[i] = rand ();
+		http_body = buf;
+		http_body_len = random;
+
+	} else if (file) {
+		http_body_fd = open (file, O_RDONLY);
+		if (http_body_fd<0) BAIL ("open %s", file);
+		if (fstat (http_body_fd, &st)<0) BAIL ("stat %s", file);
+		http_body_len = st.st_size;
+
+		if (http_body_len && !http_sendfile) {
+			buf = mmap (NULL, http_body_len, PROT_READ,
+					MAP_SHARED | MAP_POPULATE,
+					http_body_fd, 0);
+			if (buf == MAP_FAILED) BAIL ("mmap %s", file);
+			http_body = buf;
+		}
+	}
+
+	return 0;
+}
+
+// expect=<file> stands for both, taken from a reference copy of the body
+static int
+http_setup_verify (const char *file, size_t len, const char *hash)
+{
+	struct stat st;
+	void *buf;
+	char *end;
+	int fd;
+
+	if (file && (len != SIZE_MAX || hash))
+		BAIL ("http: expect= covers expect_len= and expect_hash=");
+
+	if (file) {
+		fd = open (file, O_RDONLY);
+		if (fd<0) BAIL ("open %s", file);
+		if (fstat (fd, &st)<0) BAIL ("stat %s", file);
+		http_expect_len = st.st_size;
+		http_expect_hash = pf_hash (NULL, 0);
+		if (st.st_size) {
+			buf = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+					fd, 0);
+			if (buf == MAP_FAILED) BAIL ("mmap %s", file);
+			http_expect_hash = pf_hash (buf, st.st_size);
+			munmap (buf, st.st_size);
+		}
+		close (fd);
+		http_verify_len = http_verify_hash = 1;
+	}
+
+	if (len != SIZE_MAX) {
+		http_expect_len = len;
+		http_verify_len = 1;
+	}
+
+	if (hash) {
+		http_expect_hash = strtoull (hash, &end, 16);
+		if (end == hash || *end)
+			BAIL ("http: expect_hash must be an xxh64 in hex");
+		http_verify_hash = 1;
+	}
+
+	if (http_verify_len)
+		printf ("%9zu bytes per response body, verified\n",
+				http_expect_len);
+	if (http_verify_hash)
+		printf ("%9s %016"PRIx64" xxh64 per response body, "
+				"verified\n", "", http_expect_hash);
+
+	return 0;
+}
+
+// encoding=<e>[+<e>...], of gzip, deflate and br, into an Accept-Encoding
+// list
+static int
+http_setup_encoding (const char *encoding, uint decode)
 {
-	pf_http_t *http;
+	char *list, *p, *save, *out;
+	size_t len;
+
+	if (decode && !encoding)
+		BAIL ("http: decode needs encoding=gzip, br or gzip+br");
+	if (!encoding)
+		return 0;
+
+	list = strdup (encoding);
+	out = calloc (1, 2 * strlen (encoding) + 1);
+	if (!list || !out)
+		return -ENOMEM;
+
+	for (p = strtok_r (list, "+", &save); p;
+			p = strtok_r (NULL, "+", &save)) {
+		if (pf_enc_parse (p, strlen (p)) == PF_ENC_NONE)
+			BAIL ("http: encoding must be gzip, deflate or br, "
+					"joined by +");
+		len = strlen (out);
+		sprintf (out + len, "%s%s", len ? ", " : "", p);
+	}
+	free (list);
+
+	http_encoding = out;
+	http_decode = decode;
+	printf ("%9s accepted encoding, %s\n", out,
+			decode ? "decoded" : "not decoded");
 
-	http = malloc(sizeof(*http));
-	http->request = NULL;
-	http->req_len = asprintf(&http->request,
-		"GET %s HTTP/1.0"                                         EOL
+	return 0;
+}
+
+static int
+http_setup_request (const pf_conf_t *conf, const char *method,
+		const char *header)
+{
+	char clen[128] = "", aenc[128] = "";
+	int rc;
+
+	if (http_body_len || strcmp (method, "GET"))
+		snprintf (clen, sizeof (clen),
+			"Content-Type: application/octet-stream"          EOL
+			"Content-Length: %zu"                             EOL,
+			http_body_len);
+
+	if (http_encoding)
+		snprintf (aenc, sizeof (aenc),
+			"Accept-Encoding: %s"                             EOL,
+			http_encoding);
+
+	http_hdr_len = asprintf(&http_hdr,
+		"%s %s HTTP/1.0"                                          EOL
 		"User-Agent: pf/0.0.1"                                    EOL
 		"Accept: text/html, text/*;q=0.5, image/*, application/*" EOL
 		"Accept-Language: en;q=1.0"                               EOL
+		"%s"
 		"Host: %s"                                                EOL
+		"%s%s%s"
 		EOL,
-		ctx->conf->path ?: "/",
-		inet_ntoa(ctx->conf->server.sin_addr));
+		method,
+		conf->path ?: "/",
+		aenc,
+		conf->host,
+		header ?: "", header ? EOL : "",
+		clen);
+	if (http_hdr_len == (size_t)-1)
+		return -ENOMEM;
+
+	rc = pf_tmpl_compile (&http_tmpl, http_hdr);
+	if (rc == -E2BIG)
+		BAIL ("http: at most %u variables per request",
+				PF_TMPL_VARS_MAX);
+	if (rc<0)
+		BAIL ("http: bad variable, want {counter}, {uuid} or "
+				"{random:<a>-<b>}");
+	if (http_tmpl.no_vars)
+		printf ("%9u variables per request\n", http_tmpl.no_vars);
+
+	if (http_body_len)
+		printf ("%9s request with a %zu byte body%s\n", method,
+				http_body_len,
+				http_sendfile ? " (sendfile)" : "");
+
+	return 0;
+}
+
+int
+http_setup (pf_conf_t *conf, const char *args)
+{
+	int rc;
+	size_t rcvbuf = 0, bufsize = 0, random = 0, expect_len = SIZE_MAX;
+	const char *method = NULL, *file = NULL, *data = NULL, *header = NULL;
+	const char *expect = NULL, *expect_hash = NULL, *encoding = NULL;
+	uint decode = 0;
+	pf_module_opt_t opts[] = {
+		{ "bulk",       PF_OPT_FLAG,    &http_bulk },
+		{ "bufsize",    PF_OPT_SIZE,    &bufsize },
+		{ "rcvbuf",     PF_OPT_SIZE,    &rcvbuf },
+		{ "method",     PF_OPT_STR,     &method },
+		{ "header",     PF_OPT_STR,     &header },
+		{ "file",       PF_OPT_STR,     &file },
+		{ "random",     PF_OPT_SIZE,    &random },
+		{ "sendfile",   PF_OPT_FLAG,    &http_sendfile },
+		{ "expect",     PF_OPT_STR,     &expect },
+		{ "expect_len", PF_OPT_SIZE,    &expect_len },
+		{ "expect_hash", PF_OPT_STR,    &expect_hash },
+		{ "encoding",   PF_OPT_STR,     &encoding },
+		{ "decode",     PF_OPT_FLAG,    &decode },
+		{ "data",       PF_OPT_REST,    &data },
+		{ NULL }
+	};
+
+	rc = pf_module_parse_opts ("http", args, opts);
+	if (rc<0)
+		return rc;
+
+	rc = http_setup_body (file, data, random);
+	if (rc<0)
+		return rc;
+
+	if (!method)
+		method = http_body_len ? "POST" : "GET";
+
+	rc = http_setup_encoding (encoding, decode);
+	if (rc<0)
+		return rc;
+
+	rc = http_setup_request (conf, method, header);
+	if (rc<0)
+		return rc;
+
+	rc = http_setup_verify (expect, expect_len, expect_hash);
+	if (rc<0)
+		return rc;
+
+	if (bufsize)
+		http_buf_max = bufsize;
+	else if (http_bulk)
+		http_buf_max = HTTP_BULK_BUF_DEFAULT;
+
+	if (rcvbuf)
+		conf->so_rcvbuf = rcvbuf;
+	else if (http_bulk)
+		conf->so_rcvbuf = 4 * http_buf_max;
+
+	if (http_bulk || bufsize || rcvbuf)
+		printf ("%9zu bytes read buffer per thread\n"
+			"%9zu bytes SO_RCVBUF\n",
+			http_buf_max, conf->so_rcvbuf);
+
+	return 0;
+}
+
+int
+http_thread_init (const pf_conf_t *conf)
+{
+	http_buf = malloc (http_buf_max);
+	if (!http_buf)
+		return -ENOMEM;
+	return 0;
+}
+
+void
+http_thread_fini (const pf_conf_t *conf)
+{
+	free (http_buf);
+	http_buf = NULL;
+	pf_dec_thread_fini ();
+}
+
+int
+http_init (pf_ctx_t *ctx)
+{
+	pf_http_t *http = ctx->private_data;
+
+	// the tracking state is reset on connect, allocate it only once
+	if (http)
+		return 0;
+
+	http = calloc(1, sizeof(*http) + http_tmpl.scratch);
+	if (!http)
+		return -ENOMEM;
 	ctx->private_data = http;
 	return 0;
 }
 
+// back to the thread's pool, once the body is done with it
+static void
+http_release (pf_http_t *http)
+{
+	if (!http || !http->dec)
+		return;
+	pf_dec_put (http->dec);
+	http->dec = NULL;
+}
+
 int
 http_connected (pf_ctx_t *ctx)
 {
-        ctx->wants_to_send_more = 1;
-        return 0;
+	pf_http_t *http = ctx->private_data;
+	const pf_stat_t *stat = ctx->stat;
+	uint64_t counter;
+	int rc;
+
+	http->start_ns = pf_clock_now ();
+	http->first_byte_ns = 0;
+	http->body_bytes = 0;
+	http->hdr_match = 0;
+	http->hdr_done = 0;
+	http->out_bytes = 0;
+	http->enc = PF_ENC_NONE;
+	http->line_len = 0;
+	http_release (http);
+	if (http_verify_hash)
+		pf_hash_init (&http->hash);
+
+	// threads, and the workers of a distributed run, count in steps
+	// of their number, each from its own index
+	counter = (http_counter++ * stat->no_threads
+		+ (ctx->tstat - stat->thread)) * ctx->conf->no_workers
+		+ ctx->conf->worker + 1;
+
+	// queue the request; the header's literal parts and the body are
+	// shared, never copied, only variables are rendered
+	pf_ctx_out_reset (ctx);
+	rc = pf_tmpl_out (&http_tmpl, ctx, http->scratch, counter);
+	if (rc<0)
+		return rc;
+	if (http_sendfile)
+		return pf_ctx_out_add_file (ctx, http_body_fd, 0,
+				http_body_len);
+	return pf_ctx_out_add (ctx, http_body, http_body_len);
+}
+
+// one more header byte; at the end of a line, see if it named the
+// encoding.  Lines longer than line[] are not it.
+static void
+http_scan_line (pf_http_t *http, char c)
+{
+	static const char name[] = "content-encoding:";
+	const size_t n = sizeof (name) - 1;
+	char *v, *e;
+
+	if (c != '\n') {
+		if (http->line_len < sizeof (http->line))
+			http->line[http->line_len] = c;
+		if (http->line_len <= sizeof (http->line))
+			http->line_len++;
+		return;
+	}
+
+	if (http->line_len > n && http->line_len <= sizeof (http->line)
+			&& !strncasecmp (http->line, name, n)) {
+		v = http->line + n;
+		e = http->line + http->line_len;
+		while (v < e && (*v == ' ' || *v == '\t'))
+			v++;
+		while (e > v && (e[-1] == '\r' || e[-1] == ' '))
+			e--;
+		http->enc = pf_enc_parse (v, e - v);
+	}
+	http->line_len = 0;
+}
+
+// find the end of the response header, which may span reads; returns the
+// number of header bytes in buf
+static size_t
+http_scan_header (pf_http_t *http, const char *buf, size_t len)
+{
+	static const char eoh[] = EOL EOL;
+	size_t i;
+
+	for (i=0; i<len; i++) {
+		if (http_encoding)
+			http_scan_line (http, buf[i]);
+
+		if (buf[i] == eoh[http->hdr_match])
+			http->hdr_match ++;
+		else
+			http->hdr_match = (buf[i] == eoh[0]);
+
+		if (http->hdr_match == sizeof (eoh) - 1) {
+			http->hdr_done = 1;
+			return i + 1;
+		}
+	}
+
+	return len;
+}
+
+// a body counts once, by the first thing wrong with it
+static void
+http_verify (pf_ctx_t *ctx, pf_http_t *http)
+{
+	pf_tstat_t *ts = ctx->tstat;
+
+	if (http_verify_len && http->out_bytes != http_expect_len)
+		tstat_add (ts, verify_bad_len, 1);
+	else if (http_verify_hash
+			&& pf_hash_final (&http->hash) != http_expect_hash)
+		tstat_add (ts, verify_bad_hash, 1);
+	else
+		tstat_add (ts, verify_ok, 1);
+}
+
+// response finished, account per connection timing and goodput
+static void
+http_complete (pf_ctx_t *ctx, pf_http_t *http)
+{
+	pf_tstat_t *ts = ctx->tstat;
+	uint64_t now = pf_clock_now ();
+	uint64_t xfer_ns;
+
+	pf_ctx_round_trip (ctx, now - http->start_ns);
+
+	if (!http->first_byte_ns)
+		return;
+
+	xfer_ns = now - http->first_byte_ns;
+	pf_hist_add (&ts->ttfb, http->first_byte_ns - http->start_ns);
+	pf_hist_add (&ts->xfer, xfer_ns);
+
+	if (http->enc) {
+		tstat_add (ts, enc_responses, 1);
+		tstat_add (ts, enc_wire_bytes, http->body_bytes);
+		if (http->dec)
+			tstat_add (ts, enc_decoded_bytes, http->out_bytes);
+	}
+
+	tstat_add (ts, body_bytes, http->body_bytes);
+	if (xfer_ns && http->body_bytes)
+		pf_hist_add (&ts->goodput,
+				http->body_bytes * 1000000000ull / xfer_ns);
+}
+
+// body data, decoded if need be, as the application would see it
+static void
+http_body_out (void *arg, const void *data, size_t len)
+{
+	pf_http_t *http = arg;
+
+	http->out_bytes += len;
+	if (http_verify_hash)
+		pf_hash_update (&http->hash, data, len);
+}
+
+static int
+http_recv_body (pf_ctx_t *ctx, pf_http_t *http, const char *buf, size_t len)
+{
+	uint64_t start;
+	int rc;
+
+	if (!http->dec) {
+		http_body_out (http, buf, len);
+		return 0;
+	}
+
+	// fresh readings; the loop's cached time stands still in here
+	start = pf_clock_read ();
+	rc = pf_dec_run (http->dec, buf, len, http_body_out, http);
+	tstat_add (ctx->tstat, enc_decode_ns, pf_clock_read () - start);
+
+	return rc;
 }
 
 int 
 http_recv (pf_ctx_t *ctx)
 {
         int rc;
+	pf_http_t *http = ctx->private_data;
+	size_t hdr;
+	int err;
 
         rc = read (ctx->fd, http_buf, http_buf_max);
+	if (rc<0 && errno == EAGAIN)
+		return 1;
+	if (rc<0)
+		return -errno;
+
+	// whatever answered does not speak http
+	if (rc>0 && !ctx->recv_bytes
+			&& memcmp (http_buf, "HTTP/", rc < 5 ? rc : 5))
+		return -EPROTO;
 
         if (rc>0) {
                 ctx->recv_cnt ++;
                 ctx->recv_bytes += rc;
 
+		if (!http->first_byte_ns)
+			http->first_byte_ns = pf_clock_now ();
+
+		if (http->hdr_done)
+			hdr = 0;
+		else {
+			hdr = http_scan_header (http, http_buf, rc);
+
+			// just through the header: an encoded body gets a
+			// decoder for as long as it takes
+			if (http->hdr_done && http->enc && http_decode) {
+				http->dec = pf_dec_get (http->enc);
+				if (!http->dec)
+					return -ENOMEM;
+			}
+		}
+		http->body_bytes += rc - hdr;
+
+		// straight from the read buffer, nothing is copied
+		if ((size_t)rc > hdr) {
+			err = http_recv_body (ctx, http, http_buf + hdr,
+					rc - hdr);
+			if (err<0)
+				return err;
+		}
+
                 if (dbg_level >= 3) {
                         fprintf (stdout, "--------------\n");
                         fflush (stdout);
@@ -70,36 +605,61 @@ http_recv (pf_ctx_t *ctx)
                 }
         }
 
+	// closed before the response header was through
+	if (rc == 0 && !http->hdr_done)
+		return -EPIPE;
+
+	// an encoded body cut short
+	if (rc == 0 && http->dec && !pf_dec_done (http->dec))
+		return -EPROTO;
+
+	if (rc == 0 && (http_verify_len || http_verify_hash))
+		http_verify (ctx, http);
+	if (rc == 0) {
+		http_complete (ctx, http);
+		http_release (http);
+	}
+
         return rc;
 }
 
 int 
 http_send (pf_ctx_t *ctx)
 {
-        int rc;
-	pf_http_t *http = ctx->private_data;
+        ssize_t rc;
 
-        // only once
-        if (ctx->send_cnt)
-                return 0;
+	rc = pf_ctx_out_flush (ctx);
 
-        rc = write (ctx->fd, http->request, http->req_len);
+	// socket buffer is full, wait for it to drain
+	if (rc == -EAGAIN)
+		return 1;
 
-        if (rc>0) {
-                ctx->send_cnt ++;
-                ctx->send_bytes += rc;
-        }
-
-        if (rc >=0 && rc != http->req_len)
-                rc = -EIO;
-
-        ctx->wants_to_send_more = 0;
-
-        return rc;
+        return rc < 0 ? rc : 1;
 }
 
 int 
 http_closing (pf_ctx_t *ctx, int rc)
 {
+	http_release (ctx->private_data);
         return 0;
 }
+
+void
+http_fini (pf_ctx_t *ctx)
+{
+	http_release (ctx->private_data);
+	free (ctx->private_data);
+}
+
+const pf_module_t pf_http_module = {
+	PF_MODULE_INIT ("http"),
+	.do_setup       = http_setup,
+	.do_init        = http_init,
+	.do_connected   = http_connected,
+	.do_send        = http_send,
+	.do_recv        = http_recv,
+	.do_closing     = http_closing,
+	.do_fini        = http_fini,
+	.do_thread_init = http_thread_init,
+	.do_thread_fini = http_thread_fini,
+};
@@ -2,11 +2,19 @@
 #define __included__pf_http_h__
 
 struct pf_ctx_s;
+struct pf_conf_s;
+struct pf_module_s;
 
+extern int http_setup (struct pf_conf_s *conf, const char *args);
+extern int http_thread_init (const struct pf_conf_s *conf);
+extern void http_thread_fini (const struct pf_conf_s *conf);
 extern int http_init (struct pf_ctx_s *ctx);
 extern int http_connected (struct pf_ctx_s *ctx);
 extern int http_recv (struct pf_ctx_s *ctx);
 extern int http_send (struct pf_ctx_s *ctx);
 extern int http_closing (struct pf_ctx_s *ctx, int rc);
+extern void http_fini (struct pf_ctx_s *ctx);
+
+extern const struct pf_module_s pf_http_module;
 
 #endif /* __included__pf_http_h__ */
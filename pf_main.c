@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -7,6 +8,9 @@
 #include <pthread.h>
 #include <unistd.h>
 #include <limits.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <sched.h>
 
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -14,14 +18,23 @@
 #include <arpa/inet.h>
 #include <sys/time.h>
 #include <sys/wait.h>
+#include <sys/mman.h>
 //#include <asm/bitops.h>
 
 #include "pf_dbg.h"
-#include "pf_http.h"
+#include "pf_module.h"
 #include "pf_ctx.h"
 #include "pf_conf.h"
 #include "pf_stat.h"
 #include "pf_run.h"
+#include "pf_clock.h"
+#include "pf_ctl.h"
+#include "pf_dist.h"
+#include "pf_search.h"
+#include "pf_sockstat.h"
+#include "pf_sockopt.h"
+#include "pf_ab.h"
+#include "pf_baseline.h"
 
 // global debug verbosity level
 int dbg_level = 0;
@@ -33,60 +46,204 @@ typedef struct pf_main_info_s {
         // application configuration
         uint total_connections;
         uint no_threads;
+        const char             *url;
+        const char             *backends;
+        const char             *module_name;
+        const char             *module_args;
+        const char             *sockopts;
+        enum pf_clock_source_e  clock_source;
+        const char             *ctl_addr;
+        uint                    rate;
+
+        // run for a time instead of a number of connections; the
+        // warm-up is left out of the report, and at the end in-flight
+        // connections get a grace period before they are cut off
+        uint                    duration_sec;
+        uint                    warmup_sec;
+        uint                    grace_sec;
+
+        // capacity search, instead of a fixed number of connections
+        const char             *search;
+
+        // per second samples of two backends, with -l ab
+        pf_ab_t                *ab;
+
+        // save the run as a baseline, or check it against one
+        const char             *baseline;
+        const char             *gate_args;
+        pf_gate_t              *gate;
+
+        // distributed runs: listen as a worker, or drive these workers
+        const char             *worker_addr;
+        const char             *coordinator;
+        pf_dist_t              *dist;
+
+        // what the report calls a pf_tstat_t: a thread, or a worker
+        const char             *unit;
+
+        // fork a process per thread, instead of starting threads
+        uint                    processes;
+
+        // threads that have not returned yet
+        uint                    running;
 
         // thread config and status
         const pf_conf_t        *conf;
         pf_stat_t              *stat;
 
-        // when we started
-        struct timeval          start_time;
+        // when we started, and when we stopped adding load
+        uint64_t                start_ns;
+        uint64_t                stop_ns;
+
+        // failures as of the last display, for their rates
+        uint64_t                errors[PF_ERR_MAX];
+        uint64_t                errors_ns;
+
+        // TIME_WAIT sockets on this host, sampled while running
+        uint                    tw_samples;
+        int                     tw_start;
+        int                     tw_max;
+        int                     tw_stop;
 } pf_main_info_t;
 
+typedef struct pf_main_thread_s {
+        pthread_t               tid;
+        pid_t                   pid;
+        pf_main_info_t         *minfo;
+        pf_tstat_t             *tstat;
+} pf_main_thread_t;
+
+/*
+ * What the workers write and main reads while they run.  It is mapped
+ * shared, so with -p, where every worker is its own process, counters,
+ * histograms and control still live in one place; all of it is updated
+ * with atomics, never under a lock.
+ */
+typedef struct pf_main_shared_s {
+        pf_stat_t               stat;
+        pf_ctl_t                ctl;
+        pf_tstat_t              thread[];
+} pf_main_shared_t;
+
+static pf_main_shared_t *pf_main_shared_alloc (uint no_threads,
+                uint no_backends);
 static void* thread_helper (void*);
+static void process_helper (pf_main_thread_t *thread, uint t);
+static void reap_processes (pf_main_info_t *minfo,
+                pf_main_thread_t *threads, int wait);
+
+static void pf_main_signal (int sig);
+static void pf_main_pin (uint t);
+static void pf_main_busy_poll (pf_conf_t *conf);
+static void pf_main_sample_tw (pf_main_info_t *minfo);
+static pf_tstat_t *pf_main_snapshot (pf_main_info_t *minfo, uint64_t at_ns);
+static void pf_main_warm (pf_main_info_t *minfo);
+static void pf_main_sleep (pf_main_info_t *minfo);
+static void pf_main_drain (pf_main_info_t *minfo, pf_ctl_t *ctl,
+                pf_main_thread_t *threads);
 
 static void pf_display (pf_main_info_t *minfo);
+static int pf_report (pf_main_info_t *minfo);
+
+// what a signal stops
+static pf_ctl_t *pf_main_ctl;
 
 // ------------------------------------------------------------------------
 
 static void show_help(void)
 {
 	printf ("pf [-h] [-t <threads>] [-a <agents>] "
-		"[-c <connections>] [-d <what>=<delay>] "
-		"<url>\n"
+		"[-c <connections>] [-T <sec>] [-w <sec>] [-g <sec>] "
+		"[-d <what>=<delay>] [-O <timeout>] "
+		"[-k <think>] [-x <close>] [-s <sockopts>] [-B <usec>] "
+		"[-b <backends>] "
+		"[-l <balance>] "
+		"[-m <module>] [-o <options>] [-C <clock>] "
+		"[-p] [-r <rate>] [-M <port|path>] [-S <search>] "
+		"[-D <workers>] [-K <file>] [-G <gate>] <url>\n"
+		"pf -W <addr>:<port>\n"
 		"\n"
 		"Options:\n"
 		"  -h              print this help\n"
 		"  -t <num>        threads to run\n"
 		"  -a <num>        agents per thread\n"
 		"  -c <num>        total connections\n"
+		"  -T <sec>        run for # seconds; with -c, whichever ends\n"
+		"                  first\n"
+		"  -w <sec>        warm up for # seconds, left out of the report\n"
+		"  -g <sec>        at the end, give in-flight connections #\n"
+		"                  seconds to finish (default 5), outside of\n"
+		"                  the report\n"
 		"  -d start:<num>  delay for # sec after connect\n"
 		"  -d close:<num>  delay for # seconds before close\n"
+		"  -O <time>       fail a connect, or a request, that takes\n"
+		"                  longer (default 10s, 0 never); ms, or with\n"
+		"                  an s/ms/us/ns suffix\n"
+		"  -k <dist>       think time between an agent's connections:\n"
+		"                  fixed:<t>, uniform:<min>:<max>, exp:<mean>\n"
+		"                  or pareto:<scale>:<shape>; <t> in ms, or\n"
+		"                  with an s/ms/us/ns suffix\n"
+		"  -x <close>      how connections end: normal (default),\n"
+		"                  peer (the server closes first, and holds\n"
+		"                  TIME_WAIT) or rst (abortive, leaves no\n"
+		"                  TIME_WAIT)\n"
+		"  -s <options>    socket options: nodelay, quickack, fastopen,\n"
+		"                  rcvbuf=<size>, sndbuf=<size>, or the profiles\n"
+		"                  latency, bulk, default\n"
+		"  -B <usec>       spin for # us before sleeping in poll, with\n"
+		"                  SO_BUSY_POLL where permitted, threads pinned\n"
+		"  -b <list>       connect to these comma separated\n"
+		"                  <host>[:<port>], not to the url's host\n"
+		"  -l <balance>    spread connections over backends: rr\n"
+		"                  (round-robin, default), least (outstanding)\n"
+		"                  or ab (compare two, half the agents each)\n"
+		"  -m <module>     protocol module: http (default), raw, udp,\n"
+		"                  or a .so path\n"
+		"  -o <options>    options passed to the protocol module\n"
+		"  -C <clock>      time source: auto (default), tsc, mono\n"
+		"  -p              fork a process per thread, each pinned to a\n"
+		"                  cpu\n"
+		"  -r <num>        limit new connections per second\n"
+		"  -M <port|path>  serve metrics and control on 127.0.0.1:<port>\n"
+		"                  or on a unix socket\n"
+		"  -S <options>    search for the highest load within a latency\n"
+		"                  budget: p99=<time>[,by=agents|rate]\n"
+		"                  [,how=bisect|aimd][,stage=<sec>][,start=<n>]\n"
+		"                  [,max=<n>]; exits with 3 if no load was\n"
+		"                  within the budget\n"
+		"  -D <list>       coordinate a run on the comma separated\n"
+		"                  <host>:<port> workers\n"
+		"  -W <addr:port>  be a worker, wait for coordinators on this\n"
+		"                  address; both sides need the same secret in\n"
+		"                  PF_DIST_TOKEN\n"
+		"  -K <file>       save the run, counters and histograms, as a\n"
+		"                  baseline\n"
+		"  -G <options>    exit with 2 if the run regressed from a\n"
+		"                  baseline: file=<file>[,rate=<pct>][,p50=<pct>]\n"
+		"                  [,p90=<pct>][,p99=<pct>][,p999=<pct>];\n"
+		"                  default rate=5,p99=10\n"
 		"\n"
 		"Url format:\n"
-		"  [http://]<host>[:<port>][/<path>]\n");
+		"  [http://]<host>[:<port>][/<path>]\n"
+		"  host may be a name, an IPv4 address or an [IPv6] address;\n"
+		"  every address a name resolves to is used\n");
 }
 
 #define HTTP_PREFIX "http://"
 
-static void parse_url_arg (const char *optarg, pf_conf_t *conf)
+static void parse_url_arg (const char *optarg, const char *backends,
+		pf_conf_t *conf)
 {
 	char *buf = strdup(optarg);
 	char *p, *q;
-	char *addr, *port = "80", *path = NULL;
-	ulong tmp;
-	int rc;
+	char *host, *port = "80", *path = NULL;
+	char *list, *save;
 
 	p = buf;
 	if (!strncasecmp(p, HTTP_PREFIX, strlen(HTTP_PREFIX)))
 		p += strlen(HTTP_PREFIX);
 
-	addr = p;
-
-	q = index(p, ':');
-	if (q) {
-		*q = 0;
-		port = p = q+1;
-	}
+	host = p;
 
 	q = index(p, '/');
 	if (q) {
@@ -94,18 +251,27 @@ static void parse_url_arg (const char *optarg, pf_conf_t *conf)
 		*q = 0;
 	}
 
-	// set server info
-	conf->server.sin_family = PF_INET;
-
-	rc = inet_pton (conf->server.sin_family, addr,
-			&conf->server.sin_addr);
-	if (rc<0) 
-		BAIL ("inet_pton %s", addr);
-
-	tmp = strtoul (port, NULL, 0);
-	if (tmp == ULONG_MAX) 
-		BAIL ("strtoul %s", port);
-	conf->server.sin_port = htons(tmp);
+	// <host>:<port>, or [<v6 address>]:<port>
+	q = (host[0] == '[') ? index(host, ']') : host;
+	q = q ? index(q, ':') : NULL;
+	if (q && q[1])
+		port = q+1;
+
+	// the url's host for the Host header; connect to what it resolves
+	// to, unless told where exactly
+	conf->host = strdup(host);
+	if (!backends) {
+		pf_backend_add (&conf->backend, &conf->no_backends, host, "80");
+	} else {
+		list = strdup(backends);
+		for (p = strtok_r (list, ",", &save); p;
+				p = strtok_r (NULL, ",", &save))
+			pf_backend_add (&conf->backend, &conf->no_backends,
+					p, port);
+		free(list);
+	}
+	if (!conf->no_backends)
+		BAIL ("no address to connect to for %s", optarg);
 
 	conf->path = path;
 
@@ -141,42 +307,134 @@ static void parse_delay_arg (const char *optarg,  pf_conf_t *conf)
 	exit(EXIT_FAILURE);
 }
 
-int
-main (int argc, char *argv[])
+static void
+parse_args (int argc, char *argv[], pf_main_info_t *minfo, pf_conf_t *conf)
 {
-        int rc = 0;
-        pf_conf_t conf;
-        pf_stat_t stat;
-        pf_main_info_t minfo;
-        pthread_t *threads;
-        uint t;
-	int opt;
+	int opt, connections_given = 0;
+	char *end;
 
-        memset (&conf, 0, sizeof (conf));
-        memset (&stat, 0, sizeof (stat));
-        memset (&minfo, 0, sizeof (minfo));
+        memset (conf, 0, sizeof (*conf));
+        memset (minfo, 0, sizeof (*minfo));
 
         // read configuration from command line
-        minfo.no_threads = 10;
-        conf.no_agents = 10;	// per thread
-        minfo.total_connections = 100000;
-
-	while ((opt = getopt (argc, argv, "t:a:c:d:h")) != -1) {
+        minfo->no_threads = 10;
+        conf->no_agents = 10;	// per thread
+        minfo->total_connections = 100000;
+	minfo->module_name = "http";
+	minfo->clock_source = PF_CLOCK_AUTO;
+	minfo->unit = "thread";
+	minfo->grace_sec = 5;
+	conf->timeout_ns = 10000000000ull;
+	conf->no_workers = 1;
+
+	// a worker parses the coordinator's command line after its own
+	optind = 0;
+
+	while ((opt = getopt (argc, argv, "t:a:b:c:d:g:k:l:m:o:s:B:C:O:pr:M:S:D:T:w:W:x:K:G:h")) != -1) {
 		switch (opt) {
 		case 'h':
 			show_help();
-			return 0;
+			exit(EXIT_SUCCESS);
 		case 't':
-			minfo.no_threads = atoi(optarg);
+			minfo->no_threads = atoi(optarg);
 			break;
 		case 'a':
-			conf.no_agents = atoi(optarg);
+			conf->no_agents = atoi(optarg);
+			break;
+		case 'b':
+			minfo->backends = optarg;
+			break;
+		case 'k':
+			if (pf_think_parse (&conf->think, optarg) < 0)
+				BAIL ("think time must be fixed:<t>, "
+					"uniform:<t>:<t>, exp:<mean> or "
+					"pareto:<scale>:<shape>");
+			break;
+		case 'x':
+			if (!strcmp (optarg, "normal"))
+				conf->close_mode = PF_CLOSE_NORMAL;
+			else if (!strcmp (optarg, "peer"))
+				conf->close_mode = PF_CLOSE_PEER;
+			else if (!strcmp (optarg, "rst"))
+				conf->close_mode = PF_CLOSE_RST;
+			else
+				BAIL ("close must be one of normal, peer, rst");
+			break;
+		case 'l':
+			if (!strcmp (optarg, "rr"))
+				conf->balance = PF_BALANCE_RR;
+			else if (!strcmp (optarg, "least"))
+				conf->balance = PF_BALANCE_LEAST;
+			else if (!strcmp (optarg, "ab"))
+				conf->balance = PF_BALANCE_AB;
+			else
+				BAIL ("balance must be one of rr, least, ab");
 			break;
 		case 'c':
-			minfo.total_connections = atoi(optarg);
+			minfo->total_connections = atoi(optarg);
+			connections_given = 1;
+			break;
+		case 'T':
+			minfo->duration_sec = atoi(optarg);
+			break;
+		case 'w':
+			minfo->warmup_sec = atoi(optarg);
+			break;
+		case 'g':
+			minfo->grace_sec = atoi(optarg);
 			break;
 		case 'd':
-			parse_delay_arg (optarg, &conf);
+			parse_delay_arg (optarg, conf);
+			break;
+		case 'O':
+			if (pf_clock_parse_time (optarg, &end,
+						&conf->timeout_ns) < 0 || *end)
+				BAIL ("timeout must be a time, like 2s or 500ms");
+			break;
+		case 'm':
+			minfo->module_name = optarg;
+			break;
+		case 'o':
+			minfo->module_args = optarg;
+			break;
+		case 's':
+			minfo->sockopts = optarg;
+			break;
+		case 'B':
+			conf->busy_poll_us = atoi(optarg);
+			break;
+		case 'C':
+			if (!strcmp (optarg, "tsc"))
+				minfo->clock_source = PF_CLOCK_TSC;
+			else if (!strcmp (optarg, "mono"))
+				minfo->clock_source = PF_CLOCK_MONOTONIC;
+			else if (strcmp (optarg, "auto"))
+				BAIL ("clock must be one of auto, tsc, mono");
+			break;
+		case 'p':
+			minfo->processes = 1;
+			minfo->unit = "process";
+			break;
+		case 'r':
+			minfo->rate = atoi(optarg);
+			break;
+		case 'M':
+			minfo->ctl_addr = optarg;
+			break;
+		case 'S':
+			minfo->search = optarg;
+			break;
+		case 'D':
+			minfo->coordinator = optarg;
+			break;
+		case 'W':
+			minfo->worker_addr = optarg;
+			break;
+		case 'K':
+			minfo->baseline = optarg;
+			break;
+		case 'G':
+			minfo->gate_args = optarg;
 			break;
 		default:
 			show_help();
@@ -184,81 +442,365 @@ main (int argc, char *argv[])
 		}
 	}
 
+	// a worker gets everything else from the coordinator
+	if (minfo->worker_addr)
+		return;
+
 	if ((argc - optind) != 1)
 		BAIL ("need to provide <url>");
-	if (conf.no_agents < 1)
+	if (conf->no_agents < 1)
 		BAIL ("need at least one agent per thread");
-	if (minfo.no_threads < 1)
+	if (minfo->no_threads < 1)
 		BAIL ("need at least one thread");
-	if (minfo.total_connections < 1)
+	if (minfo->total_connections < 1)
 		BAIL ("need at least one connection");
+	if (minfo->duration_sec && minfo->search)
+		BAIL ("-S runs for as long as the search takes, drop -T");
+	if (minfo->duration_sec && minfo->warmup_sec >= minfo->duration_sec)
+		BAIL ("warm-up must be shorter than the run");
+
+	// a duration alone is not cut short by the default count
+	if (minfo->duration_sec && !connections_given)
+		minfo->total_connections = UINT_MAX;
+
+	minfo->url = argv[optind];
+	parse_url_arg (minfo->url, minfo->backends, conf);
+
+	if (conf->balance == PF_BALANCE_AB && conf->no_backends != 2)
+		BAIL ("a/b needs exactly two backends, -b <a>,<b>, has %u",
+				conf->no_backends);
+	if (conf->balance == PF_BALANCE_AB && conf->no_agents % 2)
+		BAIL ("a/b splits the agents in two, -a must be even");
+	if (conf->balance == PF_BALANCE_AB && minfo->coordinator)
+		BAIL ("a/b compares within one process, not with -D");
+}
 
-	parse_url_arg (argv[optind], &conf);
+// module options that name a file on this host; data= takes the rest
+static int
+has_file_opt (const char *args)
+{
+	const char *p;
+
+	for (p = args; p && *p; ) {
+		if (!strncmp (p, "data=", 5))
+			return 0;
+		if (!strncmp (p, "file=", 5) || !strncmp (p, "expect=", 7))
+			return 1;
+		p = index (p, ',');
+		if (p)
+			p++;
+	}
+	return 0;
+}
+
+// worker: take the coordinator's command line, and this worker's share
+// of the connections and of the rate
+static void
+parse_worker_args (pf_dist_t *dist, pf_main_info_t *minfo, pf_conf_t *conf)
+{
+	uint total;
+
+	parse_args (dist->argc, dist->argv, minfo, conf);
+
+	// it came over the network: nothing in it may load code, read
+	// files or open ports on this host
+	if (!pf_module_builtin (minfo->module_name))
+		BAIL ("coordinator asked for module %s, workers only run "
+				"built-in modules", minfo->module_name);
+	if (has_file_opt (minfo->module_args))
+		BAIL ("coordinator asked for file= or expect=, workers do "
+				"not read local files");
+	if (minfo->ctl_addr || minfo->worker_addr)
+		BAIL ("coordinator asked for -M or -W");
+	if (conf->balance == PF_BALANCE_AB)
+		BAIL ("coordinator asked for -l ab, which does not work "
+				"distributed");
+
+	total = minfo->total_connections;
+	if (total != UINT_MAX)
+		minfo->total_connections = total / dist->no_workers
+			+ (dist->index < total % dist->no_workers);
+	minfo->rate = minfo->rate / dist->no_workers;
+	if (minfo->total_connections < 1)
+		BAIL ("fewer connections than workers");
+
+	minfo->coordinator = NULL;
+	minfo->dist = dist;
+	conf->worker = dist->index;
+	conf->no_workers = dist->no_workers;
+
+	// baselines are the coordinator's, it sees the whole run
+	minfo->baseline = NULL;
+	minfo->gate_args = NULL;
+}
+
+// coordinator: the workers do the work, this collects and reports
+static int
+run_coordinator (pf_main_info_t *minfo, int argc, char *argv[])
+{
+        pf_stat_t stat;
+	int rc;
+
+        memset (&stat, 0, sizeof (stat));
 
-	printf ("connect to %s\n"
-		"%9u threads\n"
-		"%9u agents per thread\n"
-		"%9u total connections\n"
-		"%9u sec delay before a start\n"
-		"%9u sec delay before a close\n",
-		argv[optind],
+	if (minfo->ctl_addr)
+		BAIL ("-M is not supported with -D");
+	if (minfo->search)
+		BAIL ("-S is not supported with -D");
+
+	printf ("coordinate %s on %s\n", minfo->url, minfo->coordinator);
+
+	rc = pf_dist_coordinator (minfo->coordinator, argc, argv, &stat,
+			minfo->warmup_sec);
+
+	minfo->stat = &stat;
+	minfo->unit = "worker";
+
+	// a lost worker fails the run, unless the gate already did
+	return pf_report (minfo) ?: (rc<0 ? EXIT_FAILURE : 0);
+}
+
+int
+main (int argc, char *argv[])
+{
+        int rc = 0;
+        pf_conf_t conf;
+        pf_stat_t *stat;
+        pf_main_info_t minfo;
+        pf_ctl_t *ctl;
+        pf_main_shared_t *shm;
+        pf_dist_t dist;
+        pf_search_t search;
+        pf_main_thread_t *threads;
+        uint t;
+	const pf_module_t *module;
+	pf_tstat_t *stopped;
+	char think[64], sockopts[128];
+
+	parse_args (argc, argv, &minfo, &conf);
+
+	if (minfo.worker_addr) {
+		// returns in a child, once a coordinator has connected
+		pf_dist_worker (&dist, minfo.worker_addr);
+		parse_worker_args (&dist, &minfo, &conf);
+	}
+
+	// a bad baseline fails now, not after the run
+	if (minfo.gate_args) {
+		minfo.gate = malloc (sizeof (*minfo.gate));
+		if (!minfo.gate) BAIL ("malloc (pf_gate_t)");
+		if (pf_gate_parse (minfo.gate, minfo.gate_args) < 0)
+			BAIL ("bad gate options '%s'", minfo.gate_args);
+	}
+
+	if (minfo.coordinator)
+		return run_coordinator (&minfo, argc, argv);
+
+	// a search runs until it is done, not for a number of connections
+	if (minfo.search) {
+		if (pf_search_parse (&search, minfo.search, &conf) < 0)
+			BAIL ("bad search options '%s'", minfo.search);
+		minfo.total_connections = UINT_MAX;
+	}
+
+	pf_clock_init (minfo.clock_source);
+
+	module = pf_module_load (minfo.module_name);
+	rc = pf_module_apply (module, &conf, minfo.module_args);
+	if (rc<0)
+		BAIL ("module %s rejected options '%s'", module->name,
+				minfo.module_args ?: "");
+
+	// after the module, which may have its own idea of buffer sizes
+	if (minfo.sockopts && pf_sockopt_parse (&conf, minfo.sockopts) < 0)
+		BAIL ("bad socket options '%s'", minfo.sockopts);
+
+	if (conf.busy_poll_us)
+		pf_main_busy_poll (&conf);
+
+	pf_think_describe (&conf.think, think, sizeof (think));
+	pf_sockopt_describe (&conf, sockopts, sizeof (sockopts));
+
+	printf ("connect to %s\n", minfo.url);
+	for (t=0; t<conf.no_backends; t++)
+		printf ("%9s %s\n", t ? "" : "backends", conf.backend[t].name);
+	if (conf.no_backends > 1)
+		printf ("%9s balance\n", pf_balance_name (conf.balance));
+	printf ("%9s protocol\n"
+		"%9s clock\n"
+		"%9u %s\n"
+		"%9u agents per thread\n",
+		module->name,
+		pf_clock_name (),
 		minfo.no_threads,
-		conf.no_agents,
-		minfo.total_connections,
+		minfo.processes ? "processes" : "threads",
+		conf.no_agents);
+	if (minfo.total_connections != UINT_MAX)
+		printf ("%9u total connections\n", minfo.total_connections);
+	if (minfo.duration_sec)
+		printf ("%9u sec run\n", minfo.duration_sec);
+	if (minfo.warmup_sec)
+		printf ("%9u sec warm-up, not reported\n", minfo.warmup_sec);
+	if (conf.busy_poll_us)
+		printf ("%9u us busy poll before blocking%s\n",
+				conf.busy_poll_us, conf.so_busy_poll
+				? ", SO_BUSY_POLL too" : "");
+	if (conf.timeout_ns)
+		printf ("%9.3f sec timeout\n", conf.timeout_ns / 1e9);
+	printf ("%9u sec delay before a start\n"
+		"%9u sec delay before a close\n"
+		"%9s think time\n"
+		"%9s close\n"
+		"%9s socket options\n",
 		conf.start_delay_sec,
-		conf.close_delay_sec);
+		conf.close_delay_sec,
+		think,
+		pf_close_name (conf.close_mode),
+		sockopts);
 
         // configure main info structure
         minfo.conf = &conf;
-        minfo.stat = &stat;
-        gettimeofday (&minfo.start_time, NULL);
-        pthread_mutex_init (&stat.__lock, NULL);
 
-	// set handlers
-	conf.do_init = http_init;
-	conf.do_connected = http_connected;
-	conf.do_recv = http_recv;
-	conf.do_send = http_send;
-	conf.do_closing = http_closing;
+	// a server closing on us mid-request is a failed request, not a crash
+	signal (SIGPIPE, SIG_IGN);
+
+	// counters and control, shared with the workers
+	shm = pf_main_shared_alloc (minfo.no_threads, conf.no_backends);
+	stat = &shm->stat;
+	ctl = &shm->ctl;
+        minfo.stat = stat;
+
+	// runtime control
+	pf_ctl_init (ctl, &conf, stat);
+	ctl->rate = minfo.rate;
+	conf.ctl = ctl;
+
+	// ^C drains, a second one abandons what is in flight
+	pf_main_ctl = ctl;
+	signal (SIGINT, pf_main_signal);
+	signal (SIGTERM, pf_main_signal);
+
+	if (minfo.search)
+		pf_search_prepare (&search, ctl);
+	if (minfo.ctl_addr) {
+		pf_ctl_listen (ctl, minfo.ctl_addr);
+		printf ("control on %s\n", minfo.ctl_addr);
+	}
 
         // set number of connections
 	conf.no_connections = minfo.total_connections / minfo.no_threads;
-	conf.kill_switch = 0;
 
         // threading
-        threads = calloc (minfo.no_threads, sizeof (pthread_t));
-        if (!threads) BAIL ("calloc (%d, pthread_t)", minfo.no_threads);
+        threads = calloc (minfo.no_threads, sizeof (pf_main_thread_t));
+        if (!threads) BAIL ("calloc (%d, pf_main_thread_t)", minfo.no_threads);
+
+	// set up and ready; a worker starts when the coordinator says so
+	if (minfo.dist)
+		pf_dist_worker_ready (minfo.dist);
+        minfo.start_ns = pf_clock_read ();
+	if (conf.balance == PF_BALANCE_AB)
+		minfo.ab = pf_ab_alloc ();
+	minfo.running = minfo.no_threads;
 
         for (t=0; t<minfo.no_threads; t++) {
 
-                rc = pthread_create (&threads[t], NULL, thread_helper, &minfo);
+                threads[t].minfo = &minfo;
+                threads[t].tstat = &stat->thread[t];
+
+		if (minfo.processes) {
+			threads[t].pid = fork ();
+			if (threads[t].pid < 0) BAIL ("fork %d", t);
+			if (!threads[t].pid)
+				process_helper (&threads[t], t);
+
+			printf ("started process %u, pid %d\n", t,
+					threads[t].pid);
+			continue;
+		}
+
+                rc = pthread_create (&threads[t].tid, NULL, thread_helper,
+                                &threads[t]);
                 if (rc<0) BAIL ("pthread_create %d", t);
 
                 printf ("started thread %u\n", t);
         }
 
-        while (stat_atomic_read (minfo.stat,no_completed) < minfo.total_connections) {
-                sleep (1);
-                pf_display (&minfo);
+	// the search steers the load, then lets in-flight requests finish
+	if (minfo.search) {
+		rc = pf_search_run (&search, ctl, stat);
+		pf_ctl_set (ctl, &ctl->drain, 1);
+	}
+
+        while (stat_atomic_read (minfo.stat,no_completed) < minfo.total_connections
+			&& __atomic_load_n (&minfo.running, __ATOMIC_ACQUIRE)
+			&& !ctl_read (ctl, drain)) {
+		uint64_t now = pf_clock_read ();
+
+		if (minfo.processes)
+			reap_processes (&minfo, threads, 0);
+		pf_main_sample_tw (&minfo);
+
+		if (minfo.warmup_sec && !stat->warm && now >= minfo.start_ns
+				+ minfo.warmup_sec * 1000000000ull)
+			pf_main_warm (&minfo);
+		if (minfo.duration_sec && now >= minfo.start_ns
+				+ minfo.duration_sec * 1000000000ull)
+			break;
+
+		if (!minfo.dist) {
+			pf_main_sleep (&minfo);
+			if (minfo.ab)
+				pf_ab_sample (minfo.ab, stat,
+					!minfo.warmup_sec || stat->warm);
+			pf_display (&minfo);
+			continue;
+		}
+
+		// a worker with no coordinator has no one to report to
+		if (pf_dist_worker_wait (minfo.dist) < 0) {
+			fprintf (stderr, "lost coordinator, stopping\n");
+			exit (EXIT_FAILURE);
+		}
+		pf_dist_worker_report (minfo.dist, stat, 0);
         }
         printf ("\n");
+	minfo.stop_ns = pf_clock_read ();
+	stopped = pf_main_snapshot (&minfo, minfo.stop_ns);
+	pf_main_sample_tw (&minfo);
 
-	// force kill
-	conf.kill_switch = 1;
+	if (minfo.warmup_sec && !stat->warm)
+		printf ("stopped within the warm-up, reporting all of it\n");
 
-        for (t=0; t<minfo.no_threads; t++) {
+	pf_main_drain (&minfo, ctl, threads);
+
+	if (minfo.processes)
+		reap_processes (&minfo, threads, 1);
+
+        for (t=0; t<minfo.no_threads && !minfo.processes; t++) {
 
                 void *ret;
                 int rc;
 
-                pthread_join (threads[t], &ret);
+                pthread_join (threads[t].tid, &ret);
 
                 rc = (int)(long)ret;
 
                 printf ("stopped thread %u\n", t);
         }
 
-        return rc;
+	// rates are over the time load was applied; what finished in the
+	// drain is left out, as its time is
+	for (t=0; t<minfo.no_threads; t++)
+		pf_tstat_copy (&stat->thread[t], &stopped[t], conf.no_backends,
+				stopped[t].end_ns);
+	free (stopped[0].backend);
+	free (stopped);
+
+	if (minfo.dist)
+		pf_dist_worker_report (minfo.dist, stat, 1);
+
+        // a regression, or a baseline not saved, overrides
+        return pf_report (&minfo) ?: (rc == -ERANGE ? 3 : 0);
 }
 
 // ------------------------------------------------------------------------
@@ -267,43 +809,598 @@ static void*
 thread_helper (void *arg)
 {
         int rc;
-        pf_main_info_t *minfo = arg;
+        pf_main_thread_t *thread = arg;
+        pf_main_info_t *minfo = thread->minfo;
 
-        rc = pf_run (minfo->conf, minfo->stat);
+	// a spinning thread should not share its cpu, nor move off it
+	if (minfo->conf->busy_poll_us)
+		pf_main_pin (thread->tstat - minfo->stat->thread);
+
+        rc = pf_run (minfo->conf, minfo->stat, thread->tstat);
+        __atomic_sub_fetch (&minfo->running, 1, __ATOMIC_RELEASE);
 
         return (void*)(long)rc;
 }
 
+static pf_main_shared_t *
+pf_main_shared_alloc (uint no_threads, uint no_backends)
+{
+	pf_main_shared_t *shm;
+	pf_bstat_t *bstat;
+	size_t size = sizeof (*shm) + no_threads * sizeof (pf_tstat_t)
+		+ no_threads * no_backends * sizeof (pf_bstat_t);
+	uint t;
+
+	// zeroed, and survives fork() as the same pages
+	shm = mmap (NULL, size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (shm == MAP_FAILED)
+		BAIL ("mmap shared stats, %zu bytes", size);
+
+	shm->stat.thread = shm->thread;
+	shm->stat.no_threads = no_threads;
+
+	// per-backend stats follow the threads
+	bstat = (pf_bstat_t *)&shm->thread[no_threads];
+	for (t=0; t<no_threads; t++)
+		shm->thread[t].backend = &bstat[t * no_backends];
+	return shm;
+}
+
+// one per core, for as many as there are
+static void
+pf_main_pin (uint t)
+{
+	cpu_set_t cpus;
+	long ncpu;
+
+	ncpu = sysconf (_SC_NPROCESSORS_ONLN);
+	if (ncpu <= 0)
+		return;
+
+	CPU_ZERO (&cpus);
+	CPU_SET (t % ncpu, &cpus);
+	if (sched_setaffinity (0, sizeof (cpus), &cpus) < 0)
+		DBG (0, "%u: cannot pin to cpu %lu\n", t, t % ncpu);
+}
+
+static void
+process_helper (pf_main_thread_t *thread, uint t)
+{
+        pf_main_info_t *minfo = thread->minfo;
+	int rc;
+
+	// ^C reaches the whole process group; the parent alone handles it
+	signal (SIGINT, SIG_IGN);
+	signal (SIGTERM, SIG_IGN);
+
+	pf_main_pin (t);
+
+	rc = pf_run (minfo->conf, minfo->stat, thread->tstat);
+
+	_exit (rc<0 ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+static void
+reap_processes (pf_main_info_t *minfo, pf_main_thread_t *threads, int wait)
+{
+	int status;
+	uint t;
+
+	for (t=0; t<minfo->no_threads; t++) {
+		if (!threads[t].pid)
+			continue;
+		if (waitpid (threads[t].pid, &status, wait ? 0 : WNOHANG) <= 0)
+			continue;
+
+		threads[t].pid = 0;
+		minfo->running--;
+
+		if (!WIFEXITED (status) || WEXITSTATUS (status))
+			fprintf (stderr, "process %u failed, status %#x\n",
+					t, status);
+		else
+			printf ("stopped process %u\n", t);
+	}
+}
+
+// ------------------------------------------------------------------------
+
+static void
+pf_main_signal (int sig)
+{
+	pf_ctl_t *ctl = pf_main_ctl;
+
+	if (ctl_read (ctl, drain))
+		pf_ctl_set (ctl, &ctl->kill_switch, 1);
+	else
+		pf_ctl_set (ctl, &ctl->drain, 1);
+}
+
+static void
+pf_main_sample_tw (pf_main_info_t *minfo)
+{
+	int tw = pf_sockstat_time_wait ();
+
+	if (tw<0)
+		return;
+
+	if (!minfo->tw_samples++)
+		minfo->tw_start = tw;
+	if (tw > minfo->tw_max)
+		minfo->tw_max = tw;
+	minfo->tw_stop = tw;
+}
+
+// SO_BUSY_POLL needs CAP_NET_ADMIN to raise it past the sysctl; try it
+// once, rather than on every connection
+static void
+pf_main_busy_poll (pf_conf_t *conf)
+{
+	int fd, val = conf->busy_poll_us;
+
+	fd = socket (AF_INET, SOCK_STREAM, 0);
+	if (fd<0)
+		return;
+
+	if (!setsockopt (fd, SOL_SOCKET, SO_BUSY_POLL, &val, sizeof (val)))
+		conf->so_busy_poll = val;
+	else
+		printf ("SO_BUSY_POLL: %s, spinning in user space only\n",
+				strerror (errno));
+	close (fd);
+}
+
+// every thread's stats as they are, read while they run
+static pf_tstat_t *
+pf_main_snapshot (pf_main_info_t *minfo, uint64_t at_ns)
+{
+	pf_stat_t *stat = minfo->stat;
+	uint nb = minfo->conf->no_backends, t;
+	pf_tstat_t *snap;
+	pf_bstat_t *bsnap;
+
+	snap = calloc (stat->no_threads, sizeof (*snap));
+	bsnap = calloc (stat->no_threads * nb, sizeof (*bsnap));
+	if (!snap || !bsnap) BAIL ("calloc (%u, pf_tstat_t)", stat->no_threads);
+
+	for (t=0; t<stat->no_threads; t++) {
+		snap[t].backend = &bsnap[t * nb];
+		pf_tstat_copy (&snap[t], &stat->thread[t], nb, at_ns);
+	}
+	return snap;
+}
+
+// everything so far is warm-up; pf_report takes it out
+static void
+pf_main_warm (pf_main_info_t *minfo)
+{
+	minfo->stat->warm = pf_main_snapshot (minfo, pf_clock_read ());
+}
+
+// a second, or less if the warm-up or the run ends sooner
+static void
+pf_main_sleep (pf_main_info_t *minfo)
+{
+	uint64_t now = pf_clock_read (), wake = now + 1000000000ull, at;
+
+	at = minfo->start_ns + minfo->warmup_sec * 1000000000ull;
+	if (minfo->warmup_sec && !minfo->stat->warm && at > now && at < wake)
+		wake = at;
+	at = minfo->start_ns + minfo->duration_sec * 1000000000ull;
+	if (minfo->duration_sec && at > now && at < wake)
+		wake = at;
+
+	usleep ((wake - now) / 1000 + 1);
+}
+
+// stop adding load and let in-flight connections finish; past the grace
+// period, or on a second signal, the threads abandon them
+static void
+pf_main_drain (pf_main_info_t *minfo, pf_ctl_t *ctl,
+		pf_main_thread_t *threads)
+{
+	uint64_t deadline = pf_clock_read () + minfo->grace_sec * 1000000000ull;
+
+	if (!ctl_read (ctl, drain))
+		pf_ctl_set (ctl, &ctl->drain, 1);
+
+	while (__atomic_load_n (&minfo->running, __ATOMIC_ACQUIRE)
+			&& !ctl_read (ctl, kill_switch)) {
+		if (minfo->processes)
+			reap_processes (minfo, threads, 0);
+
+		if (pf_clock_read () >= deadline) {
+			printf ("drain: %u %ss still busy after %u sec, "
+					"cutting them off\n",
+					minfo->running, minfo->unit,
+					minfo->grace_sec);
+			pf_ctl_set (ctl, &ctl->kill_switch, 1);
+			break;
+		}
+		usleep (10000);
+	}
+}
+
 // ------------------------------------------------------------------------
 
+// failures since the last call, per class and second, on a line of their
+// own; nothing when there were none
+static void
+pf_display_errors (pf_main_info_t *minfo, double sec)
+{
+        pf_stat_t *stat = minfo->stat;
+        uint64_t now = pf_clock_read (), n[PF_ERR_MAX] = { 0 };
+        double dt = (now - (minfo->errors_ns ?: minfo->start_ns)) / 1e9;
+        uint e, t, any = 0;
+
+        for (t=0; t<stat->no_threads; t++)
+                for (e=0; e<PF_ERR_MAX; e++)
+                        n[e] += tstat_read (&stat->thread[t], errors[e]);
+
+        for (e=0; e<PF_ERR_MAX; e++) {
+                if (n[e] == minfo->errors[e] || !dt)
+                        continue;
+                if (!any++)
+                        printf ("\rerrors at %4.0fs:", sec);
+                printf ("  %s %.0f/s", pf_err_name (e),
+                                (n[e] - minfo->errors[e]) / dt);
+        }
+        if (any)
+                printf ("                    \n");
+
+        memcpy (minfo->errors, n, sizeof (n));
+        minfo->errors_ns = now;
+}
+
 static void 
 pf_display (pf_main_info_t *minfo)
 {
         //const pf_conf_t *conf = minfo->conf;
         pf_stat_t       *stat = minfo->stat;
-        struct timeval now, diff;
-        double us, conn_per_sec;
+        double sec, conn_per_sec;
         uint no_completed, no_failed;
 
         no_completed = stat_atomic_read (stat, no_completed);
         no_failed = stat_atomic_read (stat, no_failed);
 
-        gettimeofday (&now, NULL);
+        sec = (pf_clock_read () - minfo->start_ns) / 1e9;
+
+        conn_per_sec = sec ? no_completed / sec : 0;
+
+        pf_display_errors (minfo, sec);
+
+        if (minfo->total_connections == UINT_MAX)
+                fprintf (stdout, "completed %u in %.0fs  %f conn/sec  "
+                                "(fail %u)%s           \r",
+                                no_completed, sec, conn_per_sec, no_failed,
+                                minfo->warmup_sec && !stat->warm
+                                ? "  warming up" : "");
+        else
+                fprintf (stdout, "completed %u/%u  %f conn/sec  "
+                                "(fail %u)%s           \r",
+                                no_completed, minfo->total_connections,
+                                conn_per_sec, no_failed,
+                                minfo->warmup_sec && !stat->warm
+                                ? "  warming up" : "");
+        fflush (stdout);
+}
+
+// ------------------------------------------------------------------------
+
+static void
+pf_report_line (const char *name, const pf_tstat_t *ts, uint64_t ns)
+{
+        double sec = ns / 1e9;
+
+        if (!sec)
+                return;
 
-        timersub (&now, &minfo->start_time, &diff);
+        printf ("%-8s %8.3f Gbit/s tx %8.3f Gbit/s rx",
+                        name,
+                        ts->send_bytes * 8 / sec / 1e9,
+                        ts->recv_bytes * 8 / sec / 1e9);
 
-        us = diff.tv_sec + diff.tv_sec/1000000.0;
+        if (ts->rtt.count)
+                printf ("  %10.0f rt/s  rtt us: p50 %.1f p99 %.1f max %.1f",
+                                ts->round_trips / sec,
+                                pf_hist_percentile (&ts->rtt, 50) / 1e3,
+                                pf_hist_percentile (&ts->rtt, 99) / 1e3,
+                                ts->rtt.max / 1e3);
 
-        conn_per_sec = no_completed / us;
+        if (ts->goodput.count)
+                printf ("  goodput %.3f Gbit/s",
+                                ts->body_bytes * 8 / sec / 1e9);
 
-        fprintf (stdout, "completed %u/%u  %f conn/sec  "
-                        "(fail %u)           \r", 
-                        no_completed, minfo->total_connections, 
-                        conn_per_sec, no_failed);
-        fflush (stdout);
+        printf ("\n");
+}
+
+static void
+pf_report_transfers (const pf_tstat_t *ts)
+{
+        if (!ts->goodput.count)
+                return;
+
+        printf ("ttfb     ms: p50 %.3f p90 %.3f p99 %.3f max %.3f\n"
+                "transfer ms: p50 %.3f p90 %.3f p99 %.3f max %.3f\n"
+                "per-connection goodput Mbit/s: "
+                "min %.1f p10 %.1f p50 %.1f p90 %.1f max %.1f\n",
+                pf_hist_percentile (&ts->ttfb, 50) / 1e6,
+                pf_hist_percentile (&ts->ttfb, 90) / 1e6,
+                pf_hist_percentile (&ts->ttfb, 99) / 1e6,
+                ts->ttfb.max / 1e6,
+                pf_hist_percentile (&ts->xfer, 50) / 1e6,
+                pf_hist_percentile (&ts->xfer, 90) / 1e6,
+                pf_hist_percentile (&ts->xfer, 99) / 1e6,
+                ts->xfer.max / 1e6,
+                ts->goodput.min * 8 / 1e6,
+                pf_hist_percentile (&ts->goodput, 10) * 8 / 1e6,
+                pf_hist_percentile (&ts->goodput, 50) * 8 / 1e6,
+                pf_hist_percentile (&ts->goodput, 90) * 8 / 1e6,
+                ts->goodput.max * 8 / 1e6);
+}
+
+static void
+pf_report_connections (const pf_tstat_t *ts)
+{
+        if (!ts->conn.count)
+                return;
+
+        printf ("conn     ms: p50 %.3f p90 %.3f p99 %.3f max %.3f, "
+                "connect to done\n",
+                pf_hist_percentile (&ts->conn, 50) / 1e6,
+                pf_hist_percentile (&ts->conn, 90) / 1e6,
+                pf_hist_percentile (&ts->conn, 99) / 1e6,
+                ts->conn.max / 1e6);
+}
+
+static void
+pf_report_errors (const pf_tstat_t *ts, uint64_t ns)
+{
+        double sec = ns / 1e9;
+        uint e, any = 0;
+
+        for (e=0; e<PF_ERR_MAX; e++) {
+                if (!ts->errors[e])
+                        continue;
+                if (!any++)
+                        printf ("errors  ");
+                printf ("  %s %"PRIu64" (%.1f/s)", pf_err_name (e),
+                                ts->errors[e], sec ? ts->errors[e] / sec : 0);
+        }
+        if (any)
+                printf ("\n");
+}
+
+static void
+pf_report_fastopen (const pf_tstat_t *ts)
+{
+        uint64_t n = ts->tfo_hits + ts->tfo_misses;
+
+        if (!n)
+                return;
+
+        printf ("fastopen %"PRIu64" cookie hits, %"PRIu64" misses, "
+                        "%.1f%% of connections sent data on the SYN\n",
+                        ts->tfo_hits, ts->tfo_misses,
+                        100.0 * ts->tfo_hits / n);
+}
+
+static void
+pf_report_datagrams (const pf_tstat_t *ts)
+{
+        uint64_t lost = ts->errors[PF_ERR_TIMEOUT];
+
+        if (!ts->dgram_sent)
+                return;
+
+        printf ("datagrams %"PRIu64" sent, %"PRIu64" answered, %"PRIu64
+                        " lost (%.3f%%), %"PRIu64" late or unmatched\n",
+                        ts->dgram_sent, ts->round_trips, lost,
+                        100.0 * lost / ts->dgram_sent, ts->dgram_late);
+}
+
+static void
+pf_report_verify (const pf_tstat_t *ts)
+{
+        uint64_t bad = ts->verify_bad_len + ts->verify_bad_hash;
+
+        if (!ts->verify_ok && !bad)
+                return;
+
+        printf ("verify   %"PRIu64" bodies ok, %"PRIu64" of another length, "
+                        "%"PRIu64" with another hash, %.3f%% wrong\n",
+                        ts->verify_ok, ts->verify_bad_len,
+                        ts->verify_bad_hash,
+                        100.0 * bad / (ts->verify_ok + bad));
 }
 
+static void
+pf_report_encoding (const pf_tstat_t *ts)
+{
+        if (!ts->enc_responses)
+                return;
+
+        printf ("encoding %"PRIu64" of %"PRIu64" responses encoded, "
+                        "%.3f MB on the wire", ts->enc_responses,
+                        ts->round_trips, ts->enc_wire_bytes / 1e6);
+        if (ts->enc_decoded_bytes)
+                printf (", %.3f MB decoded (%.2fx), decode %.1f ms, "
+                        "%.2f ns per decoded byte",
+                        ts->enc_decoded_bytes / 1e6,
+                        ts->enc_wire_bytes ? (double)ts->enc_decoded_bytes
+                                / ts->enc_wire_bytes : 0.0,
+                        ts->enc_decode_ns / 1e6,
+                        (double)ts->enc_decode_ns / ts->enc_decoded_bytes);
+        printf ("\n");
+}
 
+static void
+pf_report_floor (const pf_main_info_t *minfo, const pf_tstat_t *ts)
+{
+        if (!ts->floor.count)
+                return;
+
+        printf ("floor    us: p50 %.1f p99 %.1f max %.1f, ready to noticed, "
+                "%s\n",
+                pf_hist_percentile (&ts->floor, 50) / 1e3,
+                pf_hist_percentile (&ts->floor, 99) / 1e3,
+                ts->floor.max / 1e3,
+                !minfo->conf || !minfo->conf->busy_poll_us ? "blocking poll"
+                : minfo->conf->so_busy_poll ? "busy poll"
+                : "busy poll, user space only");
+}
 
+static void
+pf_report_time_wait (const pf_main_info_t *minfo)
+{
+        if (!minfo->tw_samples)
+                return;
 
+        printf ("time_wait %d at start, %d max, %d at stop, host-wide\n",
+                        minfo->tw_start, minfo->tw_max, minfo->tw_stop);
+}
+
+static void
+pf_report_engine (const pf_stat_t *stat)
+{
+        uint64_t agents = 0, bytes = 0, iter = 0, active = 0, ns = 0;
+        const pf_tstat_t *ts = stat->thread;
+        uint t;
+
+        for (t=0; t<stat->no_threads; t++) {
+                agents += ts[t].no_agents;
+                bytes += (uint64_t)ts[t].no_agents
+                        * (ts[t].agent_hot_bytes + ts[t].agent_cold_bytes);
+                iter += ts[t].loop_iterations;
+                active += ts[t].loop_active;
+                ns += ts[t].loop_ns;
+        }
+
+        if (!agents || !iter)
+                return;
+
+        printf ("agents   %"PRIu64" x (%u hot + %u cold) bytes = %.1f MB, "
+                "plus protocol state\n",
+                agents, ts->agent_hot_bytes, ts->agent_cold_bytes,
+                bytes / 1048576.0);
+        printf ("loop     %"PRIu64" iterations, %.1f us each, "
+                "%.1f ns per active connection\n",
+                iter, ns / 1e3 / iter,
+                active ? (double)ns / active : 0.0);
+}
+
+static void
+pf_report_backends (const pf_conf_t *conf, const pf_stat_t *stat)
+{
+        pf_bstat_t *total;
+        uint b, t;
+
+        if (!conf || conf->no_backends < 2 || !stat->thread->backend)
+                return;
+
+        total = malloc (sizeof (*total));
+        if (!total) BAIL ("malloc (pf_bstat_t)");
+
+        for (b=0; b<conf->no_backends; b++) {
+                memset (total, 0, sizeof (*total));
+                for (t=0; t<stat->no_threads; t++) {
+                        const pf_bstat_t *bs = &stat->thread[t].backend[b];
+
+                        total->completed += bs->completed;
+                        total->failed += bs->failed;
+                        pf_hist_merge (&total->rtt, &bs->rtt);
+                }
+
+                printf ("backend  %-24s %10"PRIu64" ok %8"PRIu64" fail",
+                                conf->backend[b].name,
+                                total->completed, total->failed);
+                if (total->rtt.count)
+                        printf ("  rtt us: p50 %.1f p99 %.1f max %.1f",
+                                pf_hist_percentile (&total->rtt, 50) / 1e3,
+                                pf_hist_percentile (&total->rtt, 99) / 1e3,
+                                total->rtt.max / 1e3);
+                printf ("\n");
+        }
+
+        free (total);
+}
+
+// how the run ended: 0, 2 if it regressed from the baseline, or 1 if it
+// could not be saved as one
+static int
+pf_report (pf_main_info_t *minfo)
+{
+        pf_stat_t       *stat = minfo->stat;
+        pf_tstat_t      *total;
+        uint64_t         start = 0, end = 0;
+        char             name[24];
+        uint t;
+        int rc, ret = 0;
+
+        total = calloc (1, sizeof (*total));
+        if (!total) BAIL ("calloc (1, pf_tstat_t)");
+
+        // steady state only
+        if (stat->warm)
+                printf ("first %u sec of warm-up left out\n",
+                                minfo->warmup_sec);
+
+        for (t=0; t<stat->no_threads; t++) {
+                pf_tstat_t *ts = &stat->thread[t];
+
+                if (stat->warm)
+                        pf_tstat_sub (ts, &stat->warm[t], minfo->conf
+                                        ? minfo->conf->no_backends : 0);
+
+                snprintf (name, sizeof (name), "%s%u", minfo->unit, t);
+                pf_report_line (name, ts, ts->end_ns - ts->start_ns);
+
+                if (!start || ts->start_ns < start)
+                        start = ts->start_ns;
+                if (ts->end_ns > end)
+                        end = ts->end_ns;
+
+                // all of them, a baseline keeps everything
+#define X(n)    total->n += ts->n;
+                PF_TSTAT_COUNTERS (X)
+#undef X
+#define X(n)    pf_hist_merge (&total->n, &ts->n);
+                PF_TSTAT_HISTS (X)
+#undef X
+        }
+
+        pf_report_line ("total", total, end - start);
+        pf_report_transfers (total);
+        pf_report_connections (total);
+        pf_report_errors (total, end - start);
+        pf_report_fastopen (total);
+        pf_report_datagrams (total);
+        pf_report_verify (total);
+        pf_report_encoding (total);
+        pf_report_floor (minfo, total);
+        pf_report_time_wait (minfo);
+        pf_report_engine (stat);
+        pf_report_backends (minfo->conf, stat);
+        if (minfo->ab)
+                pf_ab_report (minfo->ab, minfo->conf);
+
+        if (minfo->gate && pf_gate_check (minfo->gate, total,
+                                end - start) < 0)
+                ret = 2;
+
+        if (minfo->baseline) {
+                rc = pf_baseline_save (minfo->baseline, minfo->url, total,
+                                end - start);
+                if (rc<0) {
+                        fprintf (stderr, "cannot save baseline %s: %s\n",
+                                        minfo->baseline, strerror (-rc));
+                        ret = ret ?: 1;
+                } else
+                        printf ("baseline saved to %s\n", minfo->baseline);
+        }
+
+        free (total);
+        return ret;
+}
 
@@ -0,0 +1,224 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <limits.h>
+#include <string.h>
+#include <dlfcn.h>
+
+#include "pf_dbg.h"
+#include "pf_conf.h"
+#include "pf_module.h"
+#include "pf_http.h"
+#include "pf_raw.h"
+#include "pf_udp.h"
+
+// modules compiled into pf
+static const pf_module_t *builtin_modules[] = {
+	&pf_http_module,
+	&pf_raw_module,
+	&pf_udp_module,
+	NULL
+};
+
+static const pf_module_t *
+pf_module_check (const pf_module_t *mod, const char *name)
+{
+	pf_module_t *copy;
+
+	if (mod->abi_version != PF_MODULE_ABI_VERSION)
+		BAIL ("module %s: ABI version %u, pf expects %u",
+				name, mod->abi_version, PF_MODULE_ABI_VERSION);
+
+	if (mod->size < offsetof (pf_module_t, do_setup))
+		BAIL ("module %s: bad descriptor size %u", name, mod->size);
+
+	if (mod->size >= sizeof (pf_module_t))
+		return mod;
+
+	// built against an older header; hooks it doesn't know are NULL
+	copy = calloc (1, sizeof (*copy));
+	if (!copy) BAIL ("failed to allocate module descriptor");
+	memcpy (copy, mod, mod->size);
+	copy->size = sizeof (*copy);
+
+	return copy;
+}
+
+int
+pf_module_builtin (const char *name)
+{
+	const pf_module_t **p;
+
+	for (p=builtin_modules; *p; p++)
+		if (!strcmp ((*p)->name, name))
+			return 1;
+	return 0;
+}
+
+const pf_module_t *
+pf_module_load (const char *name)
+{
+	const pf_module_t **p;
+	const pf_module_t *mod;
+	void *dl;
+
+	for (p=builtin_modules; *p; p++) {
+		if (!strcmp ((*p)->name, name))
+			return *p;
+	}
+
+	dl = dlopen (name, RTLD_NOW | RTLD_LOCAL);
+	if (!dl) BAIL ("dlopen %s: %s", name, dlerror ());
+
+	mod = dlsym (dl, PF_MODULE_SYMBOL);
+	if (!mod) BAIL ("module %s: no '" PF_MODULE_SYMBOL "' symbol", name);
+
+	// the handle is never closed, the hooks are used until exit
+	return pf_module_check (mod, name);
+}
+
+static int
+pf_module_parse_size (const char *str, size_t *value)
+{
+	char *end;
+	unsigned long long v;
+
+	str += strspn (str, " \t");
+	if (*str == '-')
+		return -EINVAL;
+
+	errno = 0;
+	v = strtoull (str, &end, 0);
+	if (errno || end == str)
+		return -EINVAL;
+
+	switch (*end) {
+	case 'g': case 'G': v <<= 10; // fall through
+	case 'm': case 'M': v <<= 10; // fall through
+	case 'k': case 'K': v <<= 10; end++; break;
+	}
+
+	if (*end)
+		return -EINVAL;
+
+	*value = v;
+	return 0;
+}
+
+static int
+pf_module_parse_uint (const char *str, uint *value)
+{
+	char *end;
+	unsigned long v;
+
+	// strtoul() takes "-1" as ULONG_MAX
+	str += strspn (str, " \t");
+	if (*str == '-')
+		return -EINVAL;
+
+	errno = 0;
+	v = strtoul (str, &end, 0);
+	if (errno || end == str || *end || v > UINT_MAX)
+		return -EINVAL;
+
+	*value = v;
+	return 0;
+}
+
+int
+pf_module_parse_opts (const char *module, const char *args,
+		const pf_module_opt_t *table)
+{
+	char *buf, *tok, *save = NULL;
+	const pf_module_opt_t *p;
+	int rc = 0;
+
+	if (!args)
+		return 0;
+
+	// string options point into this copy, so it is never freed; the
+	// rest option points into args itself
+	buf = strdup (args);
+	if (!buf) BAIL ("strdup");
+
+	for (tok = strtok_r (buf, ",", &save); tok && !rc;
+			tok = strtok_r (NULL, ",", &save)) {
+		char *val = index (tok, '=');
+
+		if (val)
+			*val++ = 0;
+
+		for (p=table; p->name; p++)
+			if (!strcmp (p->name, tok))
+				break;
+
+		if (!p->name || (p->type != PF_OPT_FLAG && !val)) {
+			rc = -EINVAL;
+			break;
+		}
+
+		switch (p->type) {
+		case PF_OPT_FLAG:
+			*(uint*)p->value = 1;
+			break;
+		case PF_OPT_UINT:
+			rc = pf_module_parse_uint (val, p->value);
+			break;
+		case PF_OPT_SIZE:
+			rc = pf_module_parse_size (val, p->value);
+			break;
+		case PF_OPT_STR:
+			*(const char**)p->value = val;
+			break;
+		case PF_OPT_REST:
+			*(const char**)p->value = args + (val - buf);
+			return 0;
+		}
+	}
+
+	if (rc<0) {
+		fprintf (stderr, "%s options: ", module);
+		for (p=table; p->name; p++)
+			fprintf (stderr, "%s%s ", p->name,
+					p->type == PF_OPT_FLAG ? "" : "=<val>");
+		fprintf (stderr, "\n");
+	}
+
+	return rc;
+}
+
+int
+pf_module_apply (const pf_module_t *mod, pf_conf_t *conf, const char *args)
+{
+	int rc = 0;
+
+	if (!mod->name)
+		BAIL ("module without a name");
+
+	conf->module = mod;
+	conf->do_init = mod->do_init;
+	conf->do_connected = mod->do_connected;
+	conf->do_send = mod->do_send;
+	conf->do_recv = mod->do_recv;
+	conf->do_closing = mod->do_closing;
+	conf->do_fini = mod->do_fini;
+	conf->do_thread_init = mod->do_thread_init;
+	conf->do_thread_fini = mod->do_thread_fini;
+	conf->do_dgram_request = mod->do_dgram_request;
+	conf->do_dgram_agent = mod->do_dgram_agent;
+	conf->do_dgram_reply = mod->do_dgram_reply;
+
+	if (mod->do_setup)
+		rc = mod->do_setup (conf, args);
+	else if (args)
+		BAIL ("module %s takes no options", mod->name);
+
+	if (conf->udp ? !mod->do_dgram_request || !mod->do_dgram_agent
+				|| !mod->do_dgram_reply
+			: !mod->do_send || !mod->do_recv)
+		BAIL ("module %s: needs do_send and do_recv, or with conf->udp "
+				"the do_dgram_* hooks", mod->name);
+
+	return rc;
+}
@@ -0,0 +1,134 @@
+#ifndef __included__pf_module_h__
+#define __included__pf_module_h__
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct pf_ctx_s;
+struct pf_conf_s;
+struct iovec;
+
+/*
+ * Protocol modules plug into the connection engine through the hooks
+ * below.  A loadable module is a shared object that exports a
+ * pf_module_t named PF_MODULE_SYMBOL, initialized with PF_MODULE_INIT:
+ *
+ *   const pf_module_t pf_module = {
+ *           PF_MODULE_INIT ("myproto"),
+ *           .do_init      = my_init,
+ *           .do_send      = my_send,
+ *           .do_recv      = my_recv,
+ *   };
+ *
+ * PF_MODULE_ABI_VERSION changes whenever pf_module_t, or the parts of
+ * pf_ctx_t and pf_conf_t a module may touch, change incompatibly.  New
+ * hooks are only ever appended; a module built against an older header
+ * of the same ABI version simply reports a smaller size and the missing
+ * hooks are treated as NULL.
+ */
+
+// what changed, newest first:
+//  12  do_send returns 0 on a successful end of the exchange
+//  11  do_connected fails with -errno; pf_conf_t.worker, no_workers
+//  10  do_dgram_* hooks, pf_conf_t.do_dgram_*; pf_udp_conf_t has no
+//      req_size
+//   9  pf_conf_t.so_busy_poll, busy_poll_us
+//   8  pf_conf_t.so_* socket options; pf_ctx_t.connect_ns
+//   7  pf_conf_t.close_mode; pf_ctx_t.lingering; pf_ctx_linger()
+//   6  do_recv/do_send fail with -errno; pf_conf_t.timeout_ns;
+//      PF_CTX_CONNECTING; delay_finish_ns is the deadline when active
+//   5  pf_conf_t.think; PF_CTX_THINK
+//   4  pf_ctx_t.backend; pf_conf_t backend list instead of server
+#define PF_MODULE_ABI_VERSION   12
+#define PF_MODULE_SYMBOL        "pf_module"
+
+#define PF_MODULE_INIT(n) \
+	.abi_version = PF_MODULE_ABI_VERSION, \
+	.size = sizeof (pf_module_t), \
+	.name = (n)
+
+typedef struct pf_module_s {
+	uint32_t                abi_version;
+	uint32_t                size;
+	const char             *name;
+
+	// called once from main() before threads start, with the -o string
+	int (*do_setup) (struct pf_conf_s *conf, const char *args);
+
+	// called every time an agent is (re)initialized; ctx->private_data
+	// is preserved across resets, so the allocation can be reused
+	int (*do_init) (struct pf_ctx_s *ctx);
+
+	// connection is established; -errno fails the exchange before
+	// anything is sent
+	int (*do_connected) (struct pf_ctx_s *ctx);
+
+	// socket is writable and ctx->wants_to_send_more is set; the
+	// socket is non-blocking, pf_ctx_out_add() and pf_ctx_out_flush()
+	// take care of short writes; return 0 on a successful end of the
+	// exchange, as do_recv, -errno on failure, > 0 to keep going
+	int (*do_send) (struct pf_ctx_s *ctx);
+
+	// socket is readable; return 0 on a successful end of the
+	// exchange, -errno on failure, > 0 to keep going; the errno
+	// picks the failure's class, see pf_err.h, with -EPROTO for a
+	// peer that broke the protocol
+	int (*do_recv) (struct pf_ctx_s *ctx);
+
+	// the connection is about to be closed, rc is the last result
+	int (*do_closing) (struct pf_ctx_s *ctx, int rc);
+
+	// agent is going away for good, release ctx->private_data
+	void (*do_fini) (struct pf_ctx_s *ctx);
+
+	// called by each worker thread before its first and after its last
+	// agent, to set up and release per-thread (__thread) state
+	int (*do_thread_init) (const struct pf_conf_s *conf);
+	void (*do_thread_fini) (const struct pf_conf_s *conf);
+
+	// datagrams instead of connections, for a module that sets
+	// conf->udp in do_setup; see pf_udp.h.  Fill in iov, at most
+	// PF_UDP_IOV pieces that stay put until the reply or the timeout,
+	// with ctx's next request; returns how many, or -errno to fail it
+	int (*do_dgram_request) (struct pf_ctx_s *ctx, struct iovec *iov);
+
+	// the agent, by ctx->number, a reply is for; -1 if it cannot tell
+	int (*do_dgram_agent) (const struct pf_conf_s *conf, const void *buf,
+			size_t len);
+
+	// a reply for ctx: 0 if it answers the request in flight, > 0 if
+	// an earlier one, -errno if it fails the request
+	int (*do_dgram_reply) (struct pf_ctx_s *ctx, const void *buf,
+			size_t len);
+} pf_module_t;
+
+// -o parsing helper for modules: "name=value,name,..."
+enum pf_module_opt_type_e {
+	PF_OPT_FLAG,            // uint, set to 1 when present
+	PF_OPT_UINT,            // uint
+	PF_OPT_SIZE,            // size_t, accepts k/m/g suffixes
+	PF_OPT_STR,             // const char *, points into a private copy
+	PF_OPT_REST,            // const char *, the rest of args, commas and all
+};
+
+typedef struct pf_module_opt_s {
+	const char                     *name;
+	enum pf_module_opt_type_e       type;
+	void                           *value;
+} pf_module_opt_t;
+
+// table is terminated by a NULL name; returns -EINVAL on unknown options
+extern int pf_module_parse_opts (const char *module, const char *args,
+		const pf_module_opt_t *table);
+
+// whether name is compiled into pf, and so needs no dlopen()
+extern int pf_module_builtin (const char *name);
+
+// look up a built-in module by name, or dlopen() a shared object
+extern const pf_module_t *pf_module_load (const char *name);
+
+// run the module setup and install its hooks into conf
+extern int pf_module_apply (const pf_module_t *mod, struct pf_conf_s *conf,
+		const char *args);
+
+#endif // __included__pf_module_h__
@@ -0,0 +1,25 @@
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "pf_rand.h"
+
+__thread uint64_t pf_rand_state[4];
+
+static uint64_t
+pf_rand_splitmix (uint64_t *x)
+{
+	uint64_t z = (*x += 0x9e3779b97f4a7c15ull);
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+	return z ^ (z >> 31);
+}
+
+void
+pf_rand_seed (uint64_t seed)
+{
+	uint i;
+
+	for (i=0; i<4; i++)
+		pf_rand_state[i] = pf_rand_splitmix (&seed);
+}
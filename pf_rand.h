@@ -0,0 +1,53 @@
+#ifndef __included__pf_rand_h__
+#define __included__pf_rand_h__
+
+#include <stdint.h>
+
+/*
+ * Fast per-thread pseudo random numbers, xoshiro256** seeded through
+ * splitmix64.  Not for anything that needs to be unpredictable; every
+ * thread seeds its own state once with pf_rand_seed().
+ */
+
+extern __thread uint64_t pf_rand_state[4];
+
+extern void pf_rand_seed (uint64_t seed);
+
+static inline uint64_t
+pf_rand_rotl (uint64_t x, int k)
+{
+	return (x << k) | (x >> (64 - k));
+}
+
+static inline uint64_t
+pf_rand_u64 (void)
+{
+	uint64_t *s = pf_rand_state;
+	uint64_t r = pf_rand_rotl (s[1] * 5, 7) * 9;
+	uint64_t t = s[1] << 17;
+
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = pf_rand_rotl (s[3], 45);
+
+	return r;
+}
+
+// uniform in [0, 1)
+static inline double
+pf_rand_double (void)
+{
+	return (pf_rand_u64 () >> 11) * 0x1.0p-53;
+}
+
+// uniform in [0, n), a multiply instead of a division
+static inline uint64_t
+pf_rand_below (uint64_t n)
+{
+	return (uint64_t)(((unsigned __int128)pf_rand_u64 () * n) >> 64);
+}
+
+#endif // __included__pf_rand_h__
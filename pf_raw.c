@@ -0,0 +1,213 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+
+#include "pf_dbg.h"
+#include "pf_conf.h"
+#include "pf_ctx.h"
+#include "pf_stat.h"
+#include "pf_clock.h"
+#include "pf_module.h"
+#include "pf_raw.h"
+
+/*
+ * raw TCP payload exchange: write req_size bytes, read resp_size bytes
+ * back, and repeat for a number of rounds on the same connection.
+ */
+
+static size_t raw_req_size = 64;
+static size_t raw_resp_size = 64;
+static uint raw_echo = 0;
+static uint raw_rounds = 100;
+
+// payload buffers, preallocated once per thread
+static __thread char *raw_tx_buf;
+static __thread char *raw_rx_buf;
+static __thread size_t raw_rx_max;
+
+typedef struct pf_raw_s {
+	size_t          sent;           // bytes of this round written
+	size_t          received;       // bytes of this round read
+	uint            rounds;         // round trips completed
+	uint64_t        round_start_ns;
+} pf_raw_t;
+
+int
+raw_setup (pf_conf_t *conf, const char *args)
+{
+	int rc;
+	pf_module_opt_t opts[] = {
+		{ "req",        PF_OPT_SIZE,    &raw_req_size },
+		{ "resp",       PF_OPT_SIZE,    &raw_resp_size },
+		{ "echo",       PF_OPT_FLAG,    &raw_echo },
+		{ "rounds",     PF_OPT_UINT,    &raw_rounds },
+		{ NULL }
+	};
+
+	rc = pf_module_parse_opts ("raw", args, opts);
+	if (rc<0)
+		return rc;
+
+	if (raw_echo)
+		raw_resp_size = raw_req_size;
+
+	if (!raw_req_size || !raw_resp_size || !raw_rounds)
+		BAIL ("raw: req, resp and rounds must be non-zero");
+
+	printf ("%9zu bytes per request\n"
+		"%9zu bytes per response%s\n"
+		"%9u round trips per connection\n",
+		raw_req_size, raw_resp_size, raw_echo ? " (echo)" : "",
+		raw_rounds);
+
+	return 0;
+}
+
+int
+raw_thread_init (const pf_conf_t *conf)
+{
+	size_t i;
+
+	raw_tx_buf = malloc (raw_req_size);
+	if (!raw_tx_buf)
+		return -ENOMEM;
+
+	// recognizable, non-zero, pattern
+	for (i=0; i<raw_req_size; i++)
+		raw_tx_buf[i] = 'a' + i % 26;
+
+	raw_rx_max = raw_resp_size;
+	if (raw_rx_max < 4096)
+		raw_rx_max = 4096;
+	if (raw_rx_max > 1024*1024)
+		raw_rx_max = 1024*1024;
+
+	raw_rx_buf = malloc (raw_rx_max);
+	if (!raw_rx_buf)
+		return -ENOMEM;
+
+	return 0;
+}
+
+void
+raw_thread_fini (const pf_conf_t *conf)
+{
+	free (raw_tx_buf);
+	free (raw_rx_buf);
+	raw_tx_buf = raw_rx_buf = NULL;
+}
+
+int
+raw_init (pf_ctx_t *ctx)
+{
+	pf_raw_t *raw = ctx->private_data;
+
+	if (!raw) {
+		raw = malloc (sizeof (*raw));
+		if (!raw)
+			return -ENOMEM;
+		ctx->private_data = raw;
+	}
+
+	memset (raw, 0, sizeof (*raw));
+	return 0;
+}
+
+static void
+raw_start_round (pf_ctx_t *ctx, pf_raw_t *raw)
+{
+	raw->sent = 0;
+	raw->received = 0;
+	raw->round_start_ns = pf_clock_now ();
+
+	pf_ctx_out_reset (ctx);
+	pf_ctx_out_add (ctx, raw_tx_buf, raw_req_size);
+}
+
+// a round is over once both the request and the response are through,
+// in whichever order; returns 0 after the last round, 1 to keep going
+static int
+raw_end_round (pf_ctx_t *ctx, pf_raw_t *raw)
+{
+	if (raw->received < raw_resp_size || raw->sent < raw_req_size)
+		return 1;
+
+	pf_ctx_round_trip (ctx, pf_clock_now () - raw->round_start_ns);
+
+	if (++ raw->rounds == raw_rounds)
+		return 0;
+
+	raw_start_round (ctx, raw);
+	return 1;
+}
+
+int
+raw_connected (pf_ctx_t *ctx)
+{
+	raw_start_round (ctx, ctx->private_data);
+	return 0;
+}
+
+int
+raw_send (pf_ctx_t *ctx)
+{
+	pf_raw_t *raw = ctx->private_data;
+	ssize_t rc;
+
+	rc = pf_ctx_out_flush (ctx);
+	if (rc == -EAGAIN)
+		return 1;
+	if (rc<0)
+		return rc;
+
+	raw->sent += rc;
+	return raw_end_round (ctx, raw);
+}
+
+int
+raw_recv (pf_ctx_t *ctx)
+{
+	pf_raw_t *raw = ctx->private_data;
+	size_t want = raw_resp_size - raw->received;
+	int rc;
+
+	// whole response is in, still pushing out the request
+	if (!want)
+		return 1;
+
+	rc = read (ctx->fd, raw_rx_buf, want < raw_rx_max ? want : raw_rx_max);
+	if (rc<0 && errno == EAGAIN)
+		return 1;
+	if (rc == 0)
+		return -EPIPE;  // peer closed mid-exchange
+	if (rc<0)
+		return -errno;
+
+	ctx->recv_cnt ++;
+	ctx->recv_bytes += rc;
+	raw->received += rc;
+
+	return raw_end_round (ctx, raw);
+}
+
+void
+raw_fini (pf_ctx_t *ctx)
+{
+	free (ctx->private_data);
+}
+
+const pf_module_t pf_raw_module = {
+	PF_MODULE_INIT ("raw"),
+	.do_setup       = raw_setup,
+	.do_init        = raw_init,
+	.do_connected   = raw_connected,
+	.do_send        = raw_send,
+	.do_recv        = raw_recv,
+	.do_fini        = raw_fini,
+	.do_thread_init = raw_thread_init,
+	.do_thread_fini = raw_thread_fini,
+};
@@ -0,0 +1,19 @@
+#ifndef __included__pf_raw_h__
+#define __included__pf_raw_h__
+
+struct pf_ctx_s;
+struct pf_conf_s;
+struct pf_module_s;
+
+extern int raw_setup (struct pf_conf_s *conf, const char *args);
+extern int raw_thread_init (const struct pf_conf_s *conf);
+extern void raw_thread_fini (const struct pf_conf_s *conf);
+extern int raw_init (struct pf_ctx_s *ctx);
+extern int raw_connected (struct pf_ctx_s *ctx);
+extern int raw_recv (struct pf_ctx_s *ctx);
+extern int raw_send (struct pf_ctx_s *ctx);
+extern void raw_fini (struct pf_ctx_s *ctx);
+
+extern const struct pf_module_s pf_raw_module;
+
+#endif /* __included__pf_raw_h__ */
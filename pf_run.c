@@ -1,9 +1,13 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
 #include <sys/types.h>
 
 #include <sys/socket.h>
@@ -17,53 +21,382 @@
 #include "pf_ctx.h"
 #include "pf_conf.h"
 #include "pf_stat.h"
+#include "pf_clock.h"
+#include "pf_ctl.h"
 #include "pf_bitops.h"
-#include "pf_list.h"
+#include "pf_rand.h"
+#include "pf_udp.h"
 
 // ------------------------------------------------------------------------
 
+/*
+ * Agent storage is split in two.  What the loop looks at for every agent
+ * on every iteration lives in pf_agent_t, 16 bytes, in one dense array
+ * that is walked in index order.  Everything else -- configuration, protocol
+ * state, counters, the output queue -- stays in the pf_ctx_t array and
+ * is only touched when the agent actually has something to do.
+ *
+ * Which agents are in which state is tracked with one bitmap per state,
+ * so finding work is a word-at-a-time scan that skips 64 idle agents per
+ * compare.  The delayed states must also be processed in deadline order;
+ * those agents are additionally kept on lists threaded through the hot
+ * array with 32-bit indices rather than pointers.  Thinking agents each
+ * have their own random deadline, so they sit on a binary min-heap.
+ *
+ * Connects in flight and active exchanges are ordered too: each gets the
+ * same timeout from when it starts, so a list in the order they started
+ * is in deadline order.  An exchange that completes a round trip starts
+ * the next with a new deadline, and goes to the back of the list.
+ *
+ * With a datagram module an agent is a request rather than a connection.
+ * Available agents queue a datagram each, in PF_CTX_CONN until their
+ * batch is sent, then wait in PF_CTX_REPLY, an ordered state: all share
+ * one timeout from when they went out, so the list is in deadline order
+ * too.  The poll set is a socket per backend, and a backend whose send
+ * buffer filled up waits for POLLOUT with its batch still queued.
+ */
+
+#define PF_AGENT_NIL    UINT32_MAX
+
+typedef struct pf_agent_s {
+	uint32_t        next;           // delay list links
+	uint32_t        prev;
+	int32_t         fd;             // copy of ctx->fd
+	uint8_t         state;          // enum pf_ctx_state_e
+	uint8_t         want_send;      // copy of ctx->wants_to_send_more
+	uint16_t        failures;       // in a row, sets the backoff
+} pf_agent_t;
+
+typedef struct pf_agent_list_s {
+	uint32_t        head;
+	uint32_t        tail;
+} pf_agent_list_t;
+
+typedef struct pf_agent_timer_s {
+	uint64_t        at;             // ns
+	uint32_t        agent;
+} pf_agent_timer_t;
+
 typedef struct {
         const pf_conf_t *conf;
         pf_stat_t       *stat;
+        pf_tstat_t      *tstat;
 
-        // variables for select
-        uint max_fd;
-        fd_set rd_set, wr_set, er_set;
-        uint rd_cnt, wr_cnt, er_cnt;
+        // agents: hot and cold halves, same index
+        pf_agent_t     *agent;
+        pf_ctx_t       *ctx;
 
-        // agents
-        pf_ctx_t       *agents;
+        // variables for poll, one slot per active agent
+        struct pollfd  *pfd;
+        uint32_t       *pfd_agent;
+        uint            pfd_cnt;
+        uint            wr_cnt;
 
-	// a list per state
-	struct list_head state_list[PF_CTX_STATE_MAX];
+	// a bitmap per state, lists for the ordered ones
+	unsigned long  *state_map[PF_CTX_STATE_MAX];
+	pf_agent_list_t state_list[PF_CTX_STATE_MAX];
 	uint		state_count[PF_CTX_STATE_MAX];
 
+	// thinking agents, earliest deadline first
+	pf_agent_timer_t *think;
+	uint            think_cnt;
+
+	// sockets and batches, with conf->udp
+	pf_udp_t        udp;
+
         // what is completed
         uint            no_failed;
         uint            no_completed;
+
+        // backend selection: requests in flight to each, until when one
+        // that refused a connection is left alone, and where round-robin
+        // goes next
+        uint           *outstanding;
+        uint64_t       *backoff_ns;
+        uint            rr_next;
+
+        // runtime control, refreshed when ctl->generation moves
+        uint            ctl_generation;
+        uint            agents_limit;
+        uint            paused;
+        uint            drain;
+        uint            kill_switch;
+
+        // new connection pacing: this thread's share of the rate, in
+        // connections per ns, and the token bucket it fills
+        double          rate;
+        double          tokens;
+        uint64_t        tokens_ns;
 } pf_run_t;
 
 // ------------------------------------------------------------------------
 
-static int pf_run_init (pf_run_t *run, const pf_conf_t *conf, pf_stat_t *stat);
+static int pf_run_init (pf_run_t *run, const pf_conf_t *conf, pf_stat_t *stat,
+		pf_tstat_t *tstat);
+static void pf_run_check_ctl (pf_run_t *run, int force);
 static void pf_run_cleanup (pf_run_t *run);
 static int pf_run_open_sockets (pf_run_t *run);
 static int pf_run_create_connections (pf_run_t *run);
 static int pf_run_check_delayed_start (pf_run_t *run);
 static int pf_run_prepare_for_io (pf_run_t *run);
-static int pf_run_perform_select (pf_run_t *run);
+static int pf_run_perform_poll (pf_run_t *run);
 static int pf_run_perform_io (pf_run_t *run);
 static int pf_run_check_delayed_close (pf_run_t *run);
+static void pf_run_check_deadlines (pf_run_t *run);
+static void pf_run_close (pf_run_t *run, uint32_t i, int rc, int success);
+static void pf_run_floor (pf_run_t *run);
 
 // ------------------------------------------------------------------------
 
-int 
-pf_run (const pf_conf_t *conf, pf_stat_t *stat)
+// states whose agents have to be handled in the order they entered
+static inline int
+pf_run_state_ordered (enum pf_ctx_state_e state)
+{
+	return state == PF_CTX_DELAY_ACTIVE || state == PF_CTX_DELAY_CLOSE
+		|| state == PF_CTX_REPLY || state == PF_CTX_CONNECTING
+		|| state == PF_CTX_ACTIVE;
+}
+
+// oldest agent on an ordered state list
+static inline uint32_t
+pf_run_first (pf_run_t *r, enum pf_ctx_state_e state)
+{
+	return r->state_list[state].head;
+}
+
+// move agent i from its current state to another one
+static void
+pf_run_move (pf_run_t *r, uint32_t i, enum pf_ctx_state_e state)
+{
+	pf_agent_t *a = &r->agent[i];
+	pf_agent_list_t *l;
+
+	if (a->state < PF_CTX_STATE_MAX) {
+		clear_bit (i, r->state_map[a->state]);
+		r->state_count[a->state]--;
+	}
+
+	if (a->state < PF_CTX_STATE_MAX && pf_run_state_ordered (a->state)) {
+		l = &r->state_list[a->state];
+
+		if (a->prev != PF_AGENT_NIL)
+			r->agent[a->prev].next = a->next;
+		else
+			l->head = a->next;
+
+		if (a->next != PF_AGENT_NIL)
+			r->agent[a->next].prev = a->prev;
+		else
+			l->tail = a->prev;
+	}
+
+	a->state = state;
+	set_bit (i, r->state_map[state]);
+	r->state_count[state]++;
+
+	if (!pf_run_state_ordered (state))
+		return;
+
+	l = &r->state_list[state];
+	a->next = PF_AGENT_NIL;
+	a->prev = l->tail;
+	if (l->tail != PF_AGENT_NIL)
+		r->agent[l->tail].next = i;
+	else
+		l->head = i;
+	l->tail = i;
+}
+
+// refresh the hot copies after the cold side may have changed them
+static inline void
+pf_run_sync (pf_run_t *r, uint32_t i)
+{
+	r->agent[i].fd = r->ctx[i].fd;
+	r->agent[i].want_send = r->ctx[i].wants_to_send_more;
+}
+
+// when a connect or an exchange starting now has to be over
+static inline uint64_t
+pf_run_deadline (pf_run_t *r)
+{
+	return r->conf->timeout_ns ? pf_clock_now () + r->conf->timeout_ns
+		: UINT64_MAX;
+}
+
+// a backend that refused a connection is skipped for this long, or a
+// dead one, with nothing outstanding, would draw every new connection
+#define PF_RUN_BACKOFF_NS       1000000000ull
+
+// a datagram backend whose batch is full is waiting for its socket to
+// drain, and takes no more requests until then
+static inline int
+pf_run_backend_full (const pf_run_t *r, uint b)
+{
+	return r->conf->udp && r->udp.out[b].cnt == r->udp.conf->batch;
+}
+
+// backend for a new connection
+static uint
+pf_run_pick_backend (pf_run_t *r, uint32_t agent)
+{
+	const pf_conf_t *conf = r->conf;
+	uint64_t now = pf_clock_now ();
+	uint n = conf->no_backends, b, c, i, best = n;
+
+	if (n == 1)
+		return 0;
+
+	// a comparison gives each side half the agents, even with one side
+	// failing, so a slower side completes fewer requests
+	if (conf->balance == PF_BALANCE_AB)
+		return agent % 2;
+
+	b = r->rr_next;
+	r->rr_next = (b + 1) % n;
+
+	// round-robin takes the next one up, least-outstanding the one
+	// with fewest in flight, ties rotating like round-robin
+	for (i=0; i<n; i++) {
+		c = (b + i) % n;
+		if (r->backoff_ns[c] > now || pf_run_backend_full (r, c))
+			continue;
+		if (best == n || r->outstanding[c] < r->outstanding[best])
+			best = c;
+		if (conf->balance == PF_BALANCE_RR)
+			break;
+	}
+
+	// all of them are backing off, or full
+	return best == n ? b : best;
+}
+
+// the request on ctx is over: err is 0 on success, or -errno
+static void
+pf_run_done (pf_run_t *r, pf_ctx_t *ctx, int err)
+{
+	pf_agent_t *a = &r->agent[ctx - r->ctx];
+	pf_bstat_t *bs = r->tstat->backend;
+	enum pf_err_e cls;
+
+	r->outstanding[ctx->backend]--;
+	if (bs)
+		bs = &bs[ctx->backend];
+
+	if (!err) {
+		r->no_completed ++;
+		stat_atomic_inc (r->stat,no_completed);
+		if (bs)
+			tstat_add (bs, completed, 1);
+		a->failures = 0;
+		return;
+	}
+
+	r->no_failed ++;
+	stat_atomic_inc (r->stat,no_failed);
+	if (bs)
+		tstat_add (bs, failed, 1);
+
+	cls = pf_err_class (err);
+	tstat_add (r->tstat, errors[cls], 1);
+	if (a->failures < UINT16_MAX)
+		a->failures ++;
+
+	// the backend is not answering; running out of descriptors or
+	// ports is our problem, not the backend's, and one lost datagram
+	// says little about it
+	if (cls != PF_ERR_EXHAUSTED && cls != PF_ERR_PROTOCOL
+			&& !(r->conf->udp && cls == PF_ERR_TIMEOUT))
+		r->backoff_ns[ctx->backend] = pf_clock_now ()
+			+ PF_RUN_BACKOFF_NS;
+}
+
+static void
+pf_run_think_push (pf_run_t *r, uint64_t at, uint32_t agent)
+{
+	pf_agent_timer_t *h = r->think;
+	uint n = r->think_cnt++, p;
+
+	for (; n; n = p) {
+		p = (n - 1) / 2;
+		if (h[p].at <= at)
+			break;
+		h[n] = h[p];
+	}
+	h[n].at = at;
+	h[n].agent = agent;
+}
+
+static uint32_t
+pf_run_think_pop (pf_run_t *r)
+{
+	pf_agent_timer_t *h = r->think, last;
+	uint32_t agent = h[0].agent;
+	uint n = --r->think_cnt, i = 0, c;
+
+	last = h[n];
+	for (; (c = 2*i + 1) < n; i = c) {
+		if (c+1 < n && h[c+1].at < h[c].at)
+			c++;
+		if (last.at <= h[c].at)
+			break;
+		h[i] = h[c];
+	}
+	h[i] = last;
+
+	return agent;
+}
+
+// an agent that failed waits 1ms before it tries again, doubling with
+// every failure in a row up to 1s
+#define PF_RUN_RETRY_MIN_NS     1000000ull
+#define PF_RUN_RETRY_MAX_NS     1000000000ull
+
+// agent i is done with a connection, or about to start: think first, if
+// so configured, or back off after a failure, then become available
+static void
+pf_run_idle (pf_run_t *r, uint32_t i)
+{
+	uint64_t ns = pf_think_sample (&r->conf->think), retry;
+	uint f = r->agent[i].failures;
+
+	if (f) {
+		retry = PF_RUN_RETRY_MIN_NS << (f < 11 ? f - 1 : 10);
+		if (retry > PF_RUN_RETRY_MAX_NS)
+			retry = PF_RUN_RETRY_MAX_NS;
+
+		// jittered, or agents that failed together retry together
+		ns += retry / 2 + pf_rand_below (retry / 2);
+	}
+
+	if (!ns) {
+		pf_run_move (r, i, PF_CTX_AVAIL);
+		return;
+	}
+
+	pf_run_think_push (r, pf_clock_now () + ns, i);
+	pf_run_move (r, i, PF_CTX_THINK);
+}
+
+static void
+pf_run_check_think (pf_run_t *r)
+{
+	uint64_t now = pf_clock_now ();
+
+	while (r->think_cnt && r->think[0].at <= now)
+		pf_run_move (r, pf_run_think_pop (r), PF_CTX_AVAIL);
+}
+
+// ------------------------------------------------------------------------
+
+int
+pf_run (const pf_conf_t *conf, pf_stat_t *stat, pf_tstat_t *tstat)
 {
         int rc;
         pf_run_t run;
+	uint64_t t_start, t_wait, t_woke;
+	uint active;
 
-        rc = pf_run_init (&run, conf, stat);
+        rc = pf_run_init (&run, conf, stat, tstat);
         if (rc<0) {
                 DBG (1, "failed to init state structure, rc=%d\n", rc);
                 return rc;
@@ -71,11 +404,25 @@ pf_run (const pf_conf_t *conf, pf_stat_t *stat)
 
         DBG (1, "main loop\n");
         // main loop
-        while (run.no_completed < conf->no_connections && !conf->kill_switch) {
+        while (run.no_completed < conf->no_connections) {
+
+		t_start = pf_clock_tick ();
+
+		// safe point to pick up runtime changes
+		pf_run_check_ctl (&run, 0);
+		if (run.kill_switch)
+			break;
+
+		// draining, and every agent is back to idle
+		if (run.drain && run.state_count[PF_CTX_AVAIL]
+				+ run.state_count[PF_CTX_THINK] == conf->no_agents)
+			break;
+
+		pf_run_check_think (&run);
 
                 DBG (1, "\n------------------------------------------------------------\n");
-                DBG (1, "completed %u/%u  (avail %u, conn %u, active %u), fail %u", 
-                        run.no_completed, conf->no_connections, 
+                DBG (1, "completed %u/%u  (avail %u, conn %u, active %u), fail %u",
+                        run.no_completed, conf->no_connections,
 			run.state_count[PF_CTX_AVAIL],
 			run.state_count[PF_CTX_CONN],
 			run.state_count[PF_CTX_ACTIVE],
@@ -102,7 +449,7 @@ pf_run (const pf_conf_t *conf, pf_stat_t *stat)
 			return rc;
 		}
 
-                // prepare the select bits
+                // prepare the poll set
                 rc = pf_run_prepare_for_io (&run);
                 if (rc<0) {
                         DBG (1, "failed to prepare for IO, rc=%d\n", rc);
@@ -110,12 +457,14 @@ pf_run (const pf_conf_t *conf, pf_stat_t *stat)
                 }
 
                 // wait for IO to become available
-                rc = pf_run_perform_select (&run);
+		t_wait = pf_clock_read ();
+                rc = pf_run_perform_poll (&run);
+		t_woke = pf_clock_tick ();
                 if (rc<0) {
                         if (errno == EINTR)
                                 continue;
 
-                        DBG (1, "failed to perform IO select, rc=%d\n", rc);
+                        DBG (1, "failed to perform IO poll, rc=%d\n", rc);
                         return rc;
                 }
 
@@ -131,6 +480,17 @@ pf_run (const pf_conf_t *conf, pf_stat_t *stat)
 			DBG (1, "failed to perform delayed close, rc=%d\n", rc);
 			return rc;
 		}
+
+		pf_run_check_deadlines (&run);
+
+		// what the loop itself costs, not counting the wait
+		active = conf->udp ? run.state_count[PF_CTX_REPLY]
+			+ run.state_count[PF_CTX_CONN] : run.pfd_cnt;
+		tstat_set (tstat, active, active);
+		tstat_add (tstat, loop_iterations, 1);
+		tstat_add (tstat, loop_active, active);
+		tstat_add (tstat, loop_ns,
+				(t_wait - t_start) + (pf_clock_read () - t_woke));
         }
         DBG (1, "\n");
 
@@ -141,198 +501,552 @@ pf_run (const pf_conf_t *conf, pf_stat_t *stat)
 
 // ------------------------------------------------------------------------
 
-static int 
-pf_run_init (pf_run_t *r, const pf_conf_t *conf, pf_stat_t *stat)
+static int
+pf_run_init (pf_run_t *r, const pf_conf_t *conf, pf_stat_t *stat,
+		pf_tstat_t *tstat)
 {
-        uint i;
+        uint i, no_pfd;
+	int rc;
 
         memset (r, 0, sizeof (*r));
         r->conf = conf;
         r->stat = stat;
+        r->tstat = tstat;
+
+	if (conf->do_thread_init) {
+		rc = conf->do_thread_init (conf);
+		if (rc<0) return rc;
+	}
+
+	// a slot per agent, or per backend socket with udp
+	no_pfd = conf->udp && conf->no_backends > conf->no_agents
+		? conf->no_backends : conf->no_agents;
 
         // allocate agents
-        r->agents = calloc (conf->no_agents, sizeof (pf_ctx_t));
-        if (!r->agents) BAIL ("failed to allocate array");
+        r->agent = calloc (conf->no_agents, sizeof (pf_agent_t));
+        r->ctx = calloc (conf->no_agents, sizeof (pf_ctx_t));
+        r->pfd = calloc (no_pfd, sizeof (struct pollfd));
+        r->pfd_agent = calloc (no_pfd, sizeof (uint32_t));
+        r->outstanding = calloc (conf->no_backends, sizeof (uint));
+        r->backoff_ns = calloc (conf->no_backends, sizeof (uint64_t));
+        r->think = calloc (conf->no_agents, sizeof (pf_agent_timer_t));
+        if (!r->agent || !r->ctx || !r->pfd || !r->pfd_agent
+			|| !r->outstanding || !r->backoff_ns || !r->think)
+		BAIL ("failed to allocate array");
+
+	// threads start round-robin at different backends
+	r->rr_next = (tstat - stat->thread) % conf->no_backends;
+
+	for (i=0; i<PF_CTX_STATE_MAX; i++) {
+		r->state_map[i] = calloc (BITS_TO_LONGS (conf->no_agents),
+				sizeof (unsigned long));
+		if (!r->state_map[i]) BAIL ("failed to allocate bitmap");
+		r->state_list[i].head = r->state_list[i].tail = PF_AGENT_NIL;
+	}
 
-	for (i=0; i<PF_CTX_STATE_MAX; i++)
-		INIT_LIST_HEAD (&r->state_list[i]);
+	if (conf->udp) {
+		rc = pf_udp_init (&r->udp, conf);
+		if (rc<0) return rc;
+	}
+
+	// this thread's own sequence, for think times and the like
+	pf_rand_seed (pf_clock_read () ^ (uintptr_t)tstat);
+	pf_clock_tick ();
 
 	// initialize
 	DBG (1, "initialzie contexts\n");
 	for (i=0; i<conf->no_agents; i++) {
-		pf_ctx_t *ctx = &r->agents[i];
-		pf_ctx_init (ctx, conf, stat);
+		pf_ctx_t *ctx = &r->ctx[i];
+		pf_ctx_init (ctx, conf, stat, tstat);
 		ctx->number = i;
-		list_add_tail (&ctx->link,
-				&r->state_list[ctx->state]);
-		r->state_count[ctx->state]++;
+		r->agent[i].state = PF_CTX_STATE_MAX;
+		pf_run_sync (r, i);
+		pf_run_idle (r, i);
 	}
 
+	tstat->agent_hot_bytes = sizeof (pf_agent_t) + sizeof (struct pollfd)
+		+ sizeof (uint32_t) + (PF_CTX_STATE_MAX + 7) / 8
+		+ sizeof (pf_agent_timer_t);
+	tstat->agent_cold_bytes = sizeof (pf_ctx_t);
+	tstat->no_agents = conf->no_agents;
+
+	pf_run_floor (r);
+
+	tstat->start_ns = pf_clock_tick ();
+
+	r->agents_limit = conf->no_agents;
+	r->tokens_ns = tstat->start_ns;
+	pf_run_check_ctl (r, 1);
+
 	return 0;
 }
 
+static void
+pf_run_check_ctl (pf_run_t *r, int force)
+{
+	pf_ctl_t *ctl = r->conf->ctl;
+	uint gen, rate;
+
+	if (!ctl)
+		return;
+
+	gen = ctl_read (ctl, generation);
+	if (gen == r->ctl_generation && !force)
+		return;
+	r->ctl_generation = gen;
+
+	r->agents_limit = ctl_read (ctl, agents);
+	if (r->agents_limit > r->conf->no_agents)
+		r->agents_limit = r->conf->no_agents;
+	r->paused = ctl_read (ctl, paused);
+	r->drain = ctl_read (ctl, drain);
+	r->kill_switch = ctl_read (ctl, kill_switch);
+
+	rate = ctl_read (ctl, rate);
+	r->rate = rate ? rate / 1e9 / r->stat->no_threads : 0;
+
+	DBG (1, "control: agents %u, rate %u, paused %u, drain %u\n",
+			r->agents_limit, rate, r->paused, r->drain);
+}
+
+// refill the token bucket; allow a burst of up to 10ms worth
+static void
+pf_run_refill_tokens (pf_run_t *r)
+{
+	uint64_t now = pf_clock_now ();
+	double burst = 1 + r->rate * 10e6;
+
+	r->tokens += (now - r->tokens_ns) * r->rate;
+	r->tokens_ns = now;
+	if (r->tokens > burst)
+		r->tokens = burst;
+}
+
 static void
 pf_run_cleanup (pf_run_t *r)
 {
-	free (r->agents);
+	uint i;
+
+	r->tstat->end_ns = pf_clock_read ();
+
+	for (i=0; i<r->conf->no_agents; i++)
+		pf_ctx_fini (&r->ctx[i]);
+
+	free (r->agent);
+	free (r->ctx);
+	free (r->pfd);
+	free (r->pfd_agent);
+	free (r->outstanding);
+	free (r->backoff_ns);
+	free (r->think);
+	for (i=0; i<PF_CTX_STATE_MAX; i++)
+		free (r->state_map[i]);
+	if (r->conf->udp)
+		pf_udp_fini (&r->udp);
+
+	if (r->conf->do_thread_fini)
+		r->conf->do_thread_fini (r->conf);
 }
 
-static int 
-pf_run_open_sockets (pf_run_t *r)
+// ------------------------------------------------------------------------
+// datagrams
+
+// send the requests queued for backend b
+static void
+pf_run_udp_flush (pf_run_t *r, uint b)
+{
+	pf_udp_out_t *o = &r->udp.out[b];
+	uint n = o->cnt, sent, k;
+	uint64_t now;
+	size_t bytes = 0;
+	uint32_t i;
+	int err;
+
+	if (!n)
+		return;
+
+	sent = pf_udp_flush (&r->udp, b, &bytes, &err);
+	tstat_add (r->tstat, dgram_sent, sent);
+	tstat_add (r->tstat, send_bytes, bytes);
+
+	// the timeout runs from when the request is out, so the list is
+	// still in deadline order
+	now = pf_clock_now ();
+	for (k=0; k<sent; k++) {
+		i = o->slot[k].agent;
+		r->ctx[i].connect_ns = now;
+		r->ctx[i].delay_finish_ns = now + r->conf->udp->timeout_ns;
+		pf_run_move (r, i, PF_CTX_REPLY);
+	}
+
+	// a full send buffer: the rest waits for the socket to be writable;
+	// anything else fails now, not at the timeout
+	if (err != -EAGAIN) {
+		for (k=sent; k<n; k++) {
+			i = o->slot[k].agent;
+			pf_run_done (r, &r->ctx[i], err ?: -EIO);
+			pf_run_idle (r, i);
+		}
+		sent = n;
+	}
+	pf_udp_drop (&r->udp, b, sent);
+}
+
+static int
+pf_run_udp_all_full (const pf_run_t *r)
+{
+	uint b;
+
+	for (b=0; b<r->conf->no_backends; b++)
+		if (!pf_run_backend_full (r, b))
+			return 0;
+	return 1;
+}
+
+// agent i sends a request, in the next batch to its backend; returns
+// -EAGAIN when every backend it may use has a full batch
+static int
+pf_run_udp_queue (pf_run_t *r, uint32_t i)
 {
+	pf_ctx_t *ctx = &r->ctx[i];
+	pf_udp_slot_t *slot;
+	uint b = pf_run_pick_backend (r, i);
 	int rc;
+
+	slot = pf_udp_slot (&r->udp, b);
+	if (!slot)
+		return -EAGAIN;
+
+	ctx->backend = b;
+	r->outstanding[b]++;
+
+	rc = r->conf->do_dgram_request (ctx, slot->iov);
+	if (rc<=0 || rc > PF_UDP_IOV) {
+		pf_run_done (r, ctx, rc<0 ? rc : -EINVAL);
+		pf_run_idle (r, i);
+		return 0;
+	}
+	slot->agent = i;
+	slot->iov_cnt = rc;
+
+	// queued, until it is sent
+	pf_run_move (r, i, PF_CTX_CONN);
+
+	if (pf_udp_queue (&r->udp, b))
+		pf_run_udp_flush (r, b);
+	return 0;
+}
+
+// reply n of the batch just read from backend b
+static void
+pf_run_udp_reply (pf_run_t *r, uint b, uint n)
+{
 	const pf_conf_t *conf = r->conf;
+	size_t len;
+	const void *buf = pf_udp_reply (&r->udp, n, &len);
+	int i = conf->do_dgram_agent (conf, buf, len);
+	pf_ctx_t *ctx;
+	int rc;
 
-	DBG (2, "\n - open sockets\n");
-	while (! list_empty (&r->state_list[PF_CTX_AVAIL])) {
-		struct list_head *first;
-		pf_ctx_t *ctx;
+	tstat_add (r->tstat, recv_bytes, len);
 
-		// get the first available one
-		first = r->state_list[PF_CTX_AVAIL].next;
+	// an answer to a request already given up on, or not ours at all
+	if (i<0 || i >= conf->no_agents
+			|| r->agent[i].state != PF_CTX_REPLY
+			|| r->ctx[i].backend != b
+			|| (rc = conf->do_dgram_reply (&r->ctx[i], buf, len)) > 0) {
+		tstat_add (r->tstat, dgram_late, 1);
+		return;
+	}
 
-		ctx = list_entry (first, pf_ctx_t, link);
+	ctx = &r->ctx[i];
+	if (!rc)
+		pf_ctx_round_trip (ctx, pf_clock_now () - ctx->connect_ns);
+	pf_run_done (r, ctx, rc);
+	pf_run_idle (r, i);
+}
 
-		DBG (2, "  new socket on agent %u/%u\n",
-				ctx->number, conf->no_agents);
+static int
+pf_run_udp_prepare (pf_run_t *r)
+{
+	uint b;
+
+	r->wr_cnt = 0;
+	for (b=0; b<r->udp.no_out; b++) {
+		r->pfd[b].fd = r->udp.out[b].fd;
+		r->pfd[b].events = POLLIN;
+		if (r->udp.out[b].blocked) {
+			r->pfd[b].events |= POLLOUT;
+			r->wr_cnt++;
+		}
+		r->pfd[b].revents = 0;
+		r->pfd_agent[b] = b;
+	}
+	r->pfd_cnt = b;
 
-		// start it up
-		rc = pf_ctx_socket (ctx);
-		if (rc<0) break;
+	return 0;
+}
 
-		// remove from avail state
-		list_del (first);
-		r->state_count[PF_CTX_AVAIL]--;
+static int
+pf_run_udp_recv (pf_run_t *r)
+{
+	uint n, k, b;
+	int rc;
 
-		// put into need-conn state
-		ctx->state = PF_CTX_CONN;
-		list_add_tail (&ctx->link, &r->state_list[ctx->state]);
-		r->state_count[ctx->state]++;
+	for (n=0; n<r->pfd_cnt; n++) {
+		if (!r->pfd[n].revents)
+			continue;
+		b = r->pfd_agent[n];
+
+		if (r->pfd[n].revents & (POLLOUT | POLLERR))
+			pf_run_udp_flush (r, b);
+
+		// until the socket is empty
+		for (;;) {
+			rc = pf_udp_recv (&r->udp, b);
+
+			// an ICMP error for an earlier datagram; what is in
+			// flight times out, new requests go elsewhere
+			if (rc == -ECONNREFUSED) {
+				r->backoff_ns[b] = pf_clock_now ()
+					+ PF_RUN_BACKOFF_NS;
+				continue;
+			}
+			if (rc<0 && rc != -EAGAIN)
+				DBG (1, "  recvmmsg from %s: %s\n",
+						r->conf->backend[b].name,
+						strerror (-rc));
+			if (rc<=0)
+				break;
+
+			for (k=0; k<rc; k++)
+				pf_run_udp_reply (r, b, k);
+			if (rc < r->conf->udp->batch)
+				break;
+		}
 	}
+
 	return 0;
 }
 
-static int 
-pf_run_create_connections (pf_run_t *r)
+// ------------------------------------------------------------------------
+
+static int
+pf_run_open_sockets (pf_run_t *r)
 {
 	int rc;
+	uint i;
 	const pf_conf_t *conf = r->conf;
 
-	DBG (2, "\n - start connections\n");
-	while (! list_empty (&r->state_list[PF_CTX_CONN])) {
-		struct list_head *first;
-		pf_ctx_t *ctx;
+	if (r->paused || r->drain)
+		return 0;
 
-		// get the first available one
-		first = r->state_list[PF_CTX_CONN].next;
+	if (r->rate)
+		pf_run_refill_tokens (r);
 
-		ctx = list_entry (first, pf_ctx_t, link);
+	DBG (2, "\n - open sockets\n");
+	for_each_set_bit (i, r->state_map[PF_CTX_AVAIL], r->agents_limit) {
+		pf_ctx_t *ctx = &r->ctx[i];
+
+		// paced: wait for the next token
+		if (r->rate) {
+			if (r->tokens < 1)
+				break;
+			r->tokens -= 1;
+		}
 
-		DBG (1, "  new connection on agent %u/%u\n", ctx->number, conf->no_agents);
+		// a full batch holds up only this agent, unless all are
+		if (conf->udp) {
+			if (pf_run_udp_queue (r, i) == 0)
+				continue;
+			if (r->rate)
+				r->tokens += 1;
+			if (pf_run_udp_all_full (r))
+				break;
+			continue;
+		}
 
-		// remove from avail state
-		list_del (first);
-		r->state_count[PF_CTX_CONN]--;
+		DBG (2, "  new socket on agent %u/%u\n",
+				ctx->number, conf->no_agents);
 
-		// connect
-		rc = pf_ctx_connect (ctx);
+		// start it up
+		ctx->backend = pf_run_pick_backend (r, i);
+		r->outstanding[ctx->backend]++;
+		rc = pf_ctx_socket (ctx);
 		if (rc<0) {
-			DBG (0, "  - failed to connect %u/%u\n", ctx->number, conf->no_agents);
+			// no descriptor; this agent backs off, others
+			// would most likely fail the same way
+			pf_run_done (r, ctx, rc);
+			pf_run_idle (r, i);
+			break;
+		}
+		pf_run_sync (r, i);
 
-			pf_ctx_close (ctx);
-			pf_ctx_reset (ctx);
+		// put into need-conn state
+		pf_run_move (r, i, PF_CTX_CONN);
+	}
 
-			// put into avail state
-			ctx->state = PF_CTX_AVAIL;
-			list_add_tail (&ctx->link, &r->state_list[ctx->state]);
-			r->state_count[ctx->state]++;
+	// what did not fill a batch goes out now, no backend always first
+	if (conf->udp) {
+		uint first = pf_rand_below (conf->no_backends);
 
-			r->no_failed ++;
-			stat_atomic_inc (r->stat,no_failed);
-			break;
+		for (i=0; i<conf->no_backends; i++) {
+			uint b = (first + i) % conf->no_backends;
+
+			if (!r->udp.out[b].blocked)
+				pf_run_udp_flush (r, b);
 		}
+	}
+	return 0;
+}
 
-		if (conf->start_delay_sec) {
-			// put into delayed active state
-			ctx->state = PF_CTX_DELAY_ACTIVE;
-			ctx->delay_finish_time = time(NULL) + conf->start_delay_sec;
+// agent i starts its exchange, which has until its deadline
+static void
+pf_run_activate (pf_run_t *r, uint32_t i)
+{
+	pf_ctx_t *ctx = &r->ctx[i];
+	int rc = 0;
 
-			list_add_tail (&ctx->link, &r->state_list[ctx->state]);
-			r->state_count[ctx->state]++;
+	ctx->delay_finish_ns = pf_run_deadline (r);
+	if (r->conf->do_connected)
+		rc = r->conf->do_connected (ctx);
+	pf_run_sync (r, i);
 
-		} else {
-			// put into active state
-			conf->do_connected (ctx);
+	// put into active state
+	pf_run_move (r, i, PF_CTX_ACTIVE);
 
-			ctx->state = PF_CTX_ACTIVE;
+	// no request to send, the exchange fails before it starts
+	if (rc<0)
+		pf_run_close (r, i, rc, 0);
+}
 
-			list_add_tail (&ctx->link, &r->state_list[ctx->state]);
-			r->state_count[ctx->state]++;
-		}
+// agent i is connected: active now, or after the start delay
+static void
+pf_run_connected (pf_run_t *r, uint32_t i)
+{
+	const pf_conf_t *conf = r->conf;
+
+	if (!conf->start_delay_sec) {
+		pf_run_activate (r, i);
+		return;
 	}
 
-	return 0;
+	// put into delayed active state
+	r->ctx[i].delay_finish_ns = pf_clock_now ()
+		+ conf->start_delay_sec * 1000000000ull;
+	pf_run_move (r, i, PF_CTX_DELAY_ACTIVE);
 }
 
-static int pf_run_check_delayed_start (pf_run_t *r)
+// agent i did not get a connection; it backs off, then is available
+static void
+pf_run_connect_failed (pf_run_t *r, uint32_t i, int rc)
+{
+	pf_ctx_t *ctx = &r->ctx[i];
+
+	DBG (1, "  - failed to connect %u/%u\n", ctx->number,
+			r->conf->no_agents);
+
+	pf_run_done (r, ctx, rc);
+	pf_ctx_close (ctx);
+	pf_ctx_reset (ctx);
+	pf_run_sync (r, i);
+	pf_run_idle (r, i);
+}
+
+static int
+pf_run_create_connections (pf_run_t *r)
 {
-	pf_ctx_t *ctx, *tmp;
+	int rc;
+	uint i;
 	const pf_conf_t *conf = r->conf;
-	time_t now = time(NULL);
 
-	list_for_each_entry_safe (ctx, tmp, &r->state_list[PF_CTX_DELAY_ACTIVE], link) {
+	// queued datagrams wait in PF_CTX_CONN, for their batch to go out
+	if (conf->udp)
+		return 0;
+
+	DBG (2, "\n - start connections\n");
+	for_each_set_bit (i, r->state_map[PF_CTX_CONN], conf->no_agents) {
+		pf_ctx_t *ctx = &r->ctx[i];
+
+		DBG (1, "  new connection on agent %u/%u\n", ctx->number, conf->no_agents);
 
-		if (ctx->delay_finish_time > now)
+		// the handshake goes on while the loop does other things
+		ctx->connect_ns = pf_clock_now ();
+		ctx->delay_finish_ns = pf_run_deadline (r);
+		rc = pf_ctx_connect (ctx);
+		if (rc == -EINPROGRESS) {
+			pf_run_move (r, i, PF_CTX_CONNECTING);
+			continue;
+		}
+		if (rc<0) {
+			pf_run_connect_failed (r, i, rc);
 			break;
+		}
 
-		// remove from waiting state
-		list_del (&ctx->link);
-		r->state_count[PF_CTX_DELAY_ACTIVE]--;
+		pf_run_connected (r, i);
+	}
+
+	return 0;
+}
+
+static int pf_run_check_delayed_start (pf_run_t *r)
+{
+	uint32_t i;
+	uint64_t now = pf_clock_now ();
 
-		conf->do_connected (ctx);
+	while ((i = pf_run_first (r, PF_CTX_DELAY_ACTIVE)) != PF_AGENT_NIL) {
+		if (r->ctx[i].delay_finish_ns > now)
+			break;
 
-		// put into avail state
-		ctx->state = PF_CTX_ACTIVE;
-		list_add_tail (&ctx->link, &r->state_list[ctx->state]);
-		r->state_count[ctx->state]++;
+		pf_run_activate (r, i);
 	}
 
 	return 0;
 }
 
-static int 
+static int
 pf_run_prepare_for_io (pf_run_t *r)
 {
-	pf_ctx_t *ctx;
-	const pf_conf_t *conf = r->conf;
+	uint i;
 
-	r->max_fd = 0;
-	FD_ZERO (&r->rd_set);
-	FD_ZERO (&r->wr_set);
-	FD_ZERO (&r->er_set);
-	r->rd_cnt = r->wr_cnt = r->er_cnt = 0;
+	if (r->conf->udp)
+		return pf_run_udp_prepare (r);
 
-	// figure out what to select on
-	DBG (2, "\n - select selection\n");
-	list_for_each_entry (ctx, &r->state_list[PF_CTX_ACTIVE], link) {
+	r->pfd_cnt = 0;
+	r->wr_cnt = 0;
 
-		DBG (2, "  doing IO on %u/%u %s\n", ctx->number, conf->no_agents,
-				(ctx->wants_to_send_more) ? "[W]" : "");
+	// a connect in flight is done when the socket is writable
+	for_each_set_bit (i, r->state_map[PF_CTX_CONNECTING],
+			r->conf->no_agents) {
+		struct pollfd *p = &r->pfd[r->pfd_cnt];
 
-		if (r->max_fd < ctx->fd)
-			r->max_fd = ctx->fd;
+		r->pfd_agent[r->pfd_cnt++] = i;
+		p->fd = r->agent[i].fd;
+		p->events = POLLOUT;
+		p->revents = 0;
+		r->wr_cnt ++;
+	}
+
+	// figure out what to poll on, walking the active agents in order
+	DBG (2, "\n - poll selection\n");
+	for_each_set_bit (i, r->state_map[PF_CTX_ACTIVE], r->conf->no_agents) {
+		const pf_agent_t *a = &r->agent[i];
+		struct pollfd *p;
+
+		DBG (2, "  doing IO on %u/%u %s\n", i, r->conf->no_agents,
+				(a->want_send) ? "[W]" : "");
 
-		// we always want exceptions
-		FD_SET (ctx->fd, &r->er_set);
-		r->er_cnt ++;
+		p = &r->pfd[r->pfd_cnt];
+		r->pfd_agent[r->pfd_cnt++] = i;
 
-		// we always want to read
-		FD_SET (ctx->fd, &r->rd_set);
-		r->rd_cnt ++;
+		// we always want to read, and exceptions
+		p->fd = a->fd;
+		p->events = POLLIN | POLLPRI;
+		p->revents = 0;
 
 		// we sometimes want to write
-		if (ctx->wants_to_send_more) {
-			FD_SET (ctx->fd, &r->wr_set);
+		if (a->want_send) {
+			p->events |= POLLOUT;
 			r->wr_cnt ++;
 		}
 	}
@@ -340,128 +1054,320 @@ pf_run_prepare_for_io (pf_run_t *r)
 	return 0;
 }
 
-static void
-pf_run_calculate_timeout (pf_run_t *r, struct timeval *result)
+// lower *result_ns to when the next deadline expires
+static inline void
+pf_run_timeout_at (uint64_t at, uint64_t now, uint64_t *result_ns)
 {
-	if (! list_empty (&r->state_list[PF_CTX_DELAY_CLOSE])) {
-		struct list_head *first = r->state_list[PF_CTX_CONN].next;
-		pf_ctx_t *ctx = list_entry (first, pf_ctx_t, link);
-		time_t left = ctx->delay_finish_time - time(NULL);
-		struct timeval to;
+	uint64_t to = at <= now ? 0 : at - now;
 
-		if (left < 0)
-			to = (struct timeval){ .tv_sec = 0, .tv_usec = 1 };
-		else
-			to.tv_sec = left;
+	if (*result_ns > to)
+		*result_ns = to;
+}
 
-		if (timercmp(result, &to, >))
-			*result = to;
+static void
+pf_run_calculate_timeout (pf_run_t *r, uint64_t *result_ns)
+{
+	static const enum pf_ctx_state_e delayed[] = {
+		PF_CTX_DELAY_CLOSE, PF_CTX_DELAY_ACTIVE, PF_CTX_REPLY,
+		PF_CTX_CONNECTING, PF_CTX_ACTIVE };
+	uint64_t now = pf_clock_now ();
+	uint d;
+
+	// lists are in deadline order, the head expires first
+	for (d=0; d<sizeof (delayed)/sizeof (delayed[0]); d++) {
+		uint32_t i = pf_run_first (r, delayed[d]);
+
+		if (i != PF_AGENT_NIL)
+			pf_run_timeout_at (r->ctx[i].delay_finish_ns, now,
+					result_ns);
 	}
 
-	if (! list_empty (&r->state_list[PF_CTX_DELAY_ACTIVE])) {
-		struct list_head *first = r->state_list[PF_CTX_CONN].next;
-		pf_ctx_t *ctx = list_entry (first, pf_ctx_t, link);
-		time_t left = ctx->delay_finish_time - time(NULL);
-		struct timeval to;
+	// as is the top of the think heap
+	if (r->think_cnt)
+		pf_run_timeout_at (r->think[0].at, now, result_ns);
 
-		if (left < 0)
-			to = (struct timeval){ .tv_sec = 0, .tv_usec = 1 };
-		else
-			to.tv_sec = left;
+	// paced, and an agent is waiting for the next token
+	if (r->rate && r->tokens < 1 && !r->paused && !r->drain
+			&& my_find_first_bit (r->state_map[PF_CTX_AVAIL],
+				r->agents_limit) < r->agents_limit)
+		pf_run_timeout_at (now + (1 - r->tokens) / r->rate, now,
+				result_ns);
+}
+
+/*
+ * Wait up to to_ns for events; ppoll, so deadlines need not round to a
+ * ms.  A thread asleep in poll takes a wake-up, tens of microseconds,
+ * to notice it has work; with busy_ns it first spins on a non-blocking
+ * poll, so readiness is seen as it happens, and only then sleeps.
+ */
+static int
+pf_run_wait (struct pollfd *pfd, uint n, uint64_t to_ns, uint64_t busy_ns)
+{
+	static const struct timespec zero;
+	struct timespec ts;
+	uint64_t start, spun;
+	int rc;
+
+	if (busy_ns) {
+		start = pf_clock_read ();
+		do {
+			rc = ppoll (pfd, n, &zero, NULL);
+			if (rc)
+				return rc;
+			spun = pf_clock_read () - start;
+		} while (spun < busy_ns && spun < to_ns);
 
-		if (timercmp(result, &to, >))
-			*result = to;
+		to_ns = spun < to_ns ? to_ns - spun : 0;
 	}
+
+	ts.tv_sec = to_ns / 1000000000;
+	ts.tv_nsec = to_ns % 1000000000;
+	return ppoll (pfd, n, &ts, NULL);
 }
 
-static int 
-pf_run_perform_select (pf_run_t *r)
+static int
+pf_run_perform_poll (pf_run_t *r)
 {
 	int rc;
-	struct timeval to = { .tv_sec = 5, .tv_usec = 0 };
+	uint64_t to = 250000000;
 
-	DBG (1, "\n - selecting (r=%u, w=%u, e=%u)\n", 
-			r->rd_cnt, r->wr_cnt, r->er_cnt);
+	DBG (1, "\n - polling (r=%u, w=%u)\n", r->pfd_cnt, r->wr_cnt);
 
 	pf_run_calculate_timeout (r, &to);
 
-	// wait for events
-	rc = select (r->max_fd+1, &r->rd_set, &r->wr_set, &r->er_set, &to);
+	rc = pf_run_wait (r->pfd, r->pfd_cnt, to,
+			r->conf->busy_poll_us * 1000ull);
 	DBG (2, "  return %d\n", rc);
 
 	return rc;
 }
 
-static int 
+// ------------------------------------------------------------------------
+// the generator's own latency floor
+
+#define PF_RUN_FLOOR_SAMPLES    256
+
+typedef struct pf_run_floor_s {
+	int             fd;
+	uint64_t        gap_ns;
+} pf_run_floor_t;
+
+// stamp the time into the pipe every gap_ns
+static void *
+pf_run_floor_writer (void *arg)
+{
+	pf_run_floor_t *f = arg;
+	struct timespec gap = { 0, f->gap_ns };
+	uint64_t now;
+	uint i;
+
+	for (i=0; i<PF_RUN_FLOOR_SAMPLES; i++) {
+		nanosleep (&gap, NULL);
+		now = pf_clock_read ();
+		if (write (f->fd, &now, sizeof (now)) != sizeof (now))
+			break;
+	}
+	return NULL;
+}
+
+/*
+ * Before the run, time how long it takes this thread, waiting the way
+ * the loop does, to notice a pipe that another thread wrote a timestamp
+ * into.  That is the least it adds to every latency it measures.  The
+ * writer stays within the busy poll window, as a loaded loop would.
+ */
+static void
+pf_run_floor (pf_run_t *r)
+{
+	uint64_t busy_ns = r->conf->busy_poll_us * 1000ull, then;
+	pf_run_floor_t f;
+	struct pollfd p;
+	pthread_attr_t attr;
+	cpu_set_t cur, others;
+	pthread_t tid;
+	long ncpu = sysconf (_SC_NPROCESSORS_ONLN);
+	int fds[2], rc;
+	uint i;
+
+	if (pipe (fds) < 0)
+		return;
+
+	// a pinned thread's writer would inherit its cpu, and wait for it
+	pthread_attr_init (&attr);
+	CPU_ZERO (&others);
+	if (!sched_getaffinity (0, sizeof (cur), &cur))
+		for (i=0; i<ncpu && i<CPU_SETSIZE; i++)
+			if (!CPU_ISSET (i, &cur))
+				CPU_SET (i, &others);
+	if (CPU_COUNT (&others))
+		pthread_attr_setaffinity_np (&attr, sizeof (others), &others);
+
+	f.fd = fds[1];
+	f.gap_ns = busy_ns ? busy_ns / 2 : 50000;
+	rc = pthread_create (&tid, &attr, pf_run_floor_writer, &f);
+	pthread_attr_destroy (&attr);
+	if (rc) {
+		close (fds[0]);
+		close (fds[1]);
+		return;
+	}
+
+	p.fd = fds[0];
+	p.events = POLLIN;
+	for (i=0; i<PF_RUN_FLOOR_SAMPLES; i++) {
+		if (pf_run_wait (&p, 1, 1000000000, busy_ns) <= 0)
+			break;
+		if (read (fds[0], &then, sizeof (then)) != sizeof (then))
+			break;
+		pf_hist_add (&r->tstat->floor, pf_clock_read () - then);
+	}
+
+	pthread_join (tid, NULL);
+	close (fds[0]);
+	close (fds[1]);
+}
+
+// agent i is done with its connection: close it, now or after the close
+// delay, and think, then into avail state
+static void
+pf_run_release (pf_run_t *r, uint32_t i)
+{
+	const pf_conf_t *conf = r->conf;
+	pf_ctx_t *ctx = &r->ctx[i];
+
+	if (conf->close_delay_sec > 0) {
+
+		ctx->delay_finish_ns = pf_clock_now ()
+			+ conf->close_delay_sec * 1000000000ull;
+
+		// put into delayed close state
+		pf_run_move (r, i, PF_CTX_DELAY_CLOSE);
+
+	} else {
+		pf_ctx_close (ctx);
+		pf_ctx_reset (ctx);
+		pf_run_idle (r, i);
+	}
+
+	pf_run_sync (r, i);
+}
+
+// agent i's exchange is over; rc is what the module last returned, or
+// why the loop gave up on it
+static void
+pf_run_close (pf_run_t *r, uint32_t i, int rc, int success)
+{
+	const pf_conf_t *conf = r->conf;
+	pf_ctx_t *ctx = &r->ctx[i];
+
+	DBG (1, "  closing %u/%u\n", ctx->number, conf->no_agents);
+
+	if (conf->do_closing)
+		conf->do_closing (ctx, rc);
+	pf_ctx_fastopen_result (ctx);
+
+	tstat_add (r->tstat, send_bytes, ctx->send_bytes);
+	tstat_add (r->tstat, recv_bytes, ctx->recv_bytes);
+
+	pf_run_done (r, ctx, success ? 0 : rc < 0 ? rc : -EIO);
+	if (success)
+		pf_hist_add (&r->tstat->conn,
+			pf_clock_now () - ctx->connect_ns);
+
+	// stays active, with a deadline, until the server's FIN is in
+	if (success && conf->close_mode == PF_CLOSE_PEER) {
+		ctx->lingering = 1;
+		ctx->delay_finish_ns = pf_run_deadline (r);
+		pf_run_move (r, i, PF_CTX_ACTIVE);
+		pf_run_sync (r, i);
+		return;
+	}
+
+	pf_run_release (r, i);
+}
+
+static int
 pf_run_perform_io (pf_run_t *r)
 {
-	int rc;
+	int rc = 0;
 	const pf_conf_t *conf = r->conf;
-	pf_ctx_t *ctx, *tmp;
+	uint n;
 
-	list_for_each_entry_safe (ctx, tmp, &r->state_list[PF_CTX_ACTIVE], link) {
+	if (conf->udp)
+		return pf_run_udp_recv (r);
+
+	for (n=0; n<r->pfd_cnt; n++) {
+		const struct pollfd *p = &r->pfd[n];
+		uint32_t i = r->pfd_agent[n];
+		pf_ctx_t *ctx;
+		uint64_t deadline;
 
 		int closing = 0;
 		int success = 0;
 
-		if (FD_ISSET (ctx->fd, &r->rd_set)) {
+		if (!p->revents)
+			continue;
+
+		ctx = &r->ctx[i];
+
+		// the handshake is through, one way or the other
+		if (r->agent[i].state == PF_CTX_CONNECTING) {
+			rc = pf_ctx_connected (ctx);
+			if (rc<0)
+				pf_run_connect_failed (r, i, rc);
+			else
+				pf_run_connected (r, i);
+			continue;
+		}
+
+		// the exchange is done, the server is to close first
+		if (ctx->lingering) {
+			if (pf_ctx_linger (ctx) != -EAGAIN)
+				pf_run_release (r, i);
+			continue;
+		}
+
+		deadline = ctx->delay_finish_ns;
+
+		// errors and hangups are picked up by the read
+		if (p->revents & (POLLIN | POLLERR | POLLHUP)) {
 
 			DBG (2, "  read on %u/%u\n", ctx->number, conf->no_agents);
 			rc = conf->do_recv (ctx);
 			DBG (2, "  %d\n", rc);
 			if (rc<=0) closing = 1;
 			if (rc==0) success = 1;
+			if (rc>0) pf_ctx_quickack (ctx);
 		}
 
-		if (!closing && ctx->wants_to_send_more 
-				&& FD_ISSET (ctx->fd, &r->wr_set)) {
+		if (!closing && ctx->wants_to_send_more
+				&& (p->revents & POLLOUT)) {
 
 			DBG (2, "  write on %u/%u\n", ctx->number, conf->no_agents);
 			rc = conf->do_send (ctx);
 			DBG (2, "  %d\n", rc);
 			if (rc<=0) closing = 1;
+			if (rc==0) success = 1;
 		}
 
-		if (!closing && FD_ISSET (ctx->fd, &r->er_set)) {
+		// urgent data is nothing any module speaks
+		if (!closing && (p->revents & POLLPRI)) {
 
-			BAIL ("exception on %u/%u\n", ctx->number, conf->no_agents);
+			DBG (1, "  exception on %u/%u\n", ctx->number, conf->no_agents);
+			rc = -EPROTO;
 			closing = 1;
 		}
 
 		if (closing) {
-			DBG (1, "  closing %u/%u\n", ctx->number, conf->no_agents);
-
-			// remove from active state
-			list_del (&ctx->link);
-			r->state_count[PF_CTX_ACTIVE]--;
-
-			if (success) {
-				r->no_completed ++;
-				stat_atomic_inc (r->stat,no_completed);
-			} else {
-				r->no_failed ++;
-				stat_atomic_inc (r->stat,no_failed);
-			}
-
-			if (conf->close_delay_sec > 0) {
-
-				ctx->delay_finish_time = time(NULL) + conf->close_delay_sec;
-
-				// put into avail state
-				ctx->state = PF_CTX_DELAY_CLOSE;
-				list_add_tail (&ctx->link, &r->state_list[ctx->state]);
-				r->state_count[ctx->state]++;
+			pf_run_close (r, i, rc, success);
+			continue;
+		}
 
-			} else {
-				pf_ctx_close (ctx);
-				pf_ctx_reset (ctx);
+		// a round trip completed, the next one has a later deadline
+		if (ctx->delay_finish_ns != deadline)
+			pf_run_move (r, i, PF_CTX_ACTIVE);
 
-				// put into avail state
-				ctx->state = PF_CTX_AVAIL;
-				list_add_tail (&ctx->link, &r->state_list[ctx->state]);
-				r->state_count[ctx->state]++;
-			}
-		}
+		pf_run_sync (r, i);
 	}
 
 	return 0;
@@ -469,28 +1375,53 @@ pf_run_perform_io (pf_run_t *r)
 
 static int pf_run_check_delayed_close (pf_run_t *r)
 {
-	pf_ctx_t *ctx, *tmp;
-	time_t now = time(NULL);
+	uint32_t i;
+	uint64_t now = pf_clock_now ();
 
-	list_for_each_entry_safe (ctx, tmp, &r->state_list[PF_CTX_DELAY_CLOSE], link) {
+	while ((i = pf_run_first (r, PF_CTX_DELAY_CLOSE)) != PF_AGENT_NIL) {
+		pf_ctx_t *ctx = &r->ctx[i];
 
-		if (ctx->delay_finish_time > now)
+		if (ctx->delay_finish_ns > now)
 			break;
 
-		// remove from waiting state
-		list_del (&ctx->link);
-		r->state_count[PF_CTX_DELAY_CLOSE]--;
-
 		// close
 		pf_ctx_close (ctx);
 		pf_ctx_reset (ctx);
+		pf_run_sync (r, i);
 
-		// put into avail state
-		ctx->state = PF_CTX_AVAIL;
-		list_add_tail (&ctx->link, &r->state_list[ctx->state]);
-		r->state_count[ctx->state]++;
+		// think, then into avail state
+		pf_run_idle (r, i);
 	}
 
 	return 0;
 }
 
+// connects and exchanges that are overdue fail, and their agents start
+// over; datagrams whose reply is overdue are lost
+static void
+pf_run_check_deadlines (pf_run_t *r)
+{
+	uint32_t i;
+	uint64_t now = pf_clock_now ();
+
+	while ((i = pf_run_first (r, PF_CTX_CONNECTING)) != PF_AGENT_NIL
+			&& r->ctx[i].delay_finish_ns <= now)
+		pf_run_connect_failed (r, i, -ETIMEDOUT);
+
+	// a server that does not close after all leaves it to us
+	while ((i = pf_run_first (r, PF_CTX_ACTIVE)) != PF_AGENT_NIL
+			&& r->ctx[i].delay_finish_ns <= now) {
+		if (r->ctx[i].lingering)
+			pf_run_release (r, i);
+		else
+			pf_run_close (r, i, -ETIMEDOUT, 0);
+	}
+
+	while ((i = pf_run_first (r, PF_CTX_REPLY)) != PF_AGENT_NIL) {
+		if (r->ctx[i].delay_finish_ns > now)
+			break;
+
+		pf_run_done (r, &r->ctx[i], -ETIMEDOUT);
+		pf_run_idle (r, i);
+	}
+}
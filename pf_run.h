@@ -4,7 +4,8 @@
 
 struct pf_conf_s;
 struct pf_stat_s;
+struct pf_tstat_s;
 
-extern int pf_run (const pf_conf_t *conf, pf_stat_t *stat);
+extern int pf_run (const pf_conf_t *conf, pf_stat_t *stat, pf_tstat_t *tstat);
 
 #endif // __included__pf_run_h__
@@ -0,0 +1,302 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <limits.h>
+
+#include "pf_dbg.h"
+#include "pf_conf.h"
+#include "pf_stat.h"
+#include "pf_hist.h"
+#include "pf_clock.h"
+#include "pf_ctl.h"
+#include "pf_module.h"
+#include "pf_search.h"
+
+// settle after a load change before measuring
+#define PF_SEARCH_SETTLE_NS     1000000000ull
+
+// stages run at most, whatever the method
+#define PF_SEARCH_STAGES_MAX    40
+
+typedef struct pf_search_stage_s {
+	uint            load;
+	double          rt_per_sec;
+	double          conn_per_sec;
+	uint64_t        p50_ns;
+	uint64_t        p99_ns;
+	uint            fail;
+	int             ok;
+} pf_search_stage_t;
+
+// what all threads have done so far
+typedef struct pf_search_sample_s {
+	uint64_t        ns;
+	uint64_t        round_trips;
+	uint            completed;
+	uint            failed;
+	pf_hist_t       rtt;
+} pf_search_sample_t;
+
+static const char *
+pf_search_by_name (const pf_search_t *search)
+{
+	return search->by == PF_SEARCH_AGENTS ? "agents" : "rate";
+}
+
+int
+pf_search_parse (pf_search_t *search, const char *args, const pf_conf_t *conf)
+{
+	const char *p99 = NULL, *by = NULL, *how = NULL;
+	char *end;
+	int rc;
+	pf_module_opt_t opts[] = {
+		{ "p99",        PF_OPT_STR,     &p99 },
+		{ "by",         PF_OPT_STR,     &by },
+		{ "how",        PF_OPT_STR,     &how },
+		{ "stage",      PF_OPT_UINT,    &search->stage_sec },
+		{ "start",      PF_OPT_UINT,    &search->start },
+		{ "max",        PF_OPT_UINT,    &search->max },
+		{ NULL }
+	};
+
+	memset (search, 0, sizeof (*search));
+	search->stage_sec = 5;
+
+	rc = pf_module_parse_opts ("search", args, opts);
+	if (rc<0)
+		return rc;
+
+	if (!p99 || pf_clock_parse_time (p99, &end, &search->slo_ns) < 0
+			|| *end || !search->slo_ns)
+		BAIL ("search needs a latency budget, p99=<num>[s|ms|us]");
+
+	if (!by || !strcmp (by, "agents"))
+		search->by = PF_SEARCH_AGENTS;
+	else if (!strcmp (by, "rate"))
+		search->by = PF_SEARCH_RATE;
+	else
+		BAIL ("search by must be one of agents, rate");
+
+	if (!how || !strcmp (how, "bisect"))
+		search->how = PF_SEARCH_BISECT;
+	else if (!strcmp (how, "aimd"))
+		search->how = PF_SEARCH_AIMD;
+	else
+		BAIL ("search how must be one of aimd, bisect");
+
+	if (!search->stage_sec)
+		BAIL ("search stage must be at least a second");
+
+	// agents are bounded by what was allocated, the rate is not
+	if (search->by == PF_SEARCH_AGENTS) {
+		if (!search->max || search->max > conf->no_agents)
+			search->max = conf->no_agents;
+		if (!search->start)
+			search->start = 1;
+	} else {
+		if (!search->max)
+			search->max = INT_MAX;
+		if (!search->start)
+			search->start = 100;
+	}
+	if (search->start > search->max)
+		search->start = search->max;
+
+	return 0;
+}
+
+static void
+pf_search_set (pf_search_t *search, pf_ctl_t *ctl, uint load)
+{
+	if (search->by == PF_SEARCH_AGENTS)
+		pf_ctl_set (ctl, &ctl->agents, load);
+	else
+		pf_ctl_set (ctl, &ctl->rate, load);
+}
+
+void
+pf_search_prepare (pf_search_t *search, pf_ctl_t *ctl)
+{
+	if (search->by == PF_SEARCH_AGENTS)
+		ctl->agents = search->start;
+	else
+		ctl->rate = search->start;
+}
+
+static void
+pf_search_sample (pf_search_sample_t *s, pf_stat_t *stat)
+{
+	uint t;
+
+	s->ns = pf_clock_read ();
+	s->completed = stat_atomic_read (stat, no_completed);
+	s->failed = stat_atomic_read (stat, no_failed);
+	s->round_trips = 0;
+	pf_hist_reset (&s->rtt);
+
+	for (t=0; t<stat->no_threads; t++) {
+		s->round_trips += tstat_read (&stat->thread[t], round_trips);
+		pf_hist_merge (&s->rtt, &stat->thread[t].rtt);
+	}
+}
+
+// sleep until ns on the pf clock; fails when asked to stop meanwhile
+static int
+pf_search_sleep_until (pf_ctl_t *ctl, uint64_t ns)
+{
+	uint64_t now;
+
+	while ((now = pf_clock_read ()) < ns) {
+		if (ctl_read (ctl, drain) || ctl_read (ctl, kill_switch))
+			return -EINTR;
+		now = ns - now;
+		usleep (now > 100000000 ? 100000 : now / 1000 + 1);
+	}
+	return 0;
+}
+
+// run one stage at a load, and measure it
+static int
+pf_search_stage (pf_search_t *search, pf_ctl_t *ctl, pf_stat_t *stat,
+		pf_search_sample_t *a, pf_search_sample_t *b,
+		pf_search_stage_t *st)
+{
+	double sec;
+	int rc;
+
+	memset (st, 0, sizeof (*st));
+	st->load = search->by == PF_SEARCH_AGENTS
+		? ctl_read (ctl, agents) : ctl_read (ctl, rate);
+
+	rc = pf_search_sleep_until (ctl, pf_clock_read () + PF_SEARCH_SETTLE_NS);
+	if (rc<0)
+		return rc;
+	pf_search_sample (a, stat);
+
+	rc = pf_search_sleep_until (ctl, a->ns + search->stage_sec * 1000000000ull);
+	if (rc<0)
+		return rc;
+	pf_search_sample (b, stat);
+
+	// only what happened during the stage
+	pf_hist_sub (&b->rtt, &a->rtt);
+	sec = (b->ns - a->ns) / 1e9;
+
+	st->rt_per_sec = (b->round_trips - a->round_trips) / sec;
+	st->conn_per_sec = (b->completed - a->completed) / sec;
+	st->fail = b->failed - a->failed;
+	st->p50_ns = pf_hist_percentile (&b->rtt, 50);
+	st->p99_ns = pf_hist_percentile (&b->rtt, 99);
+	st->ok = b->rtt.count && st->p99_ns <= search->slo_ns;
+
+	printf ("stage    %s %-8u %10.0f rt/s %10.0f conn/s  "
+			"p50 %.3f ms  p99 %.3f ms  fail %u  %s\n",
+			pf_search_by_name (search), st->load,
+			st->rt_per_sec, st->conn_per_sec,
+			st->p50_ns / 1e6, st->p99_ns / 1e6, st->fail,
+			st->ok ? "ok" : "over");
+	fflush (stdout);
+
+	return 0;
+}
+
+// next load, or 0 when the search is over
+static uint
+pf_search_next (pf_search_t *search, const pf_search_stage_t *st,
+		uint *lo, uint *hi, uint *backoffs)
+{
+	uint load = st->load, next;
+
+	if (search->how == PF_SEARCH_AIMD) {
+		if (st->ok) {
+			if (load == search->max)
+				return 0;
+			next = load + search->start;
+			return next > search->max ? search->max : next;
+		}
+		if (++ *backoffs == 3 || load == 1)
+			return 0;
+		return load / 2 ?: 1;
+	}
+
+	// bisect: double until over budget, then halve the interval
+	if (st->ok) {
+		*lo = load;
+		if (!*hi) {
+			if (load == search->max)
+				return 0;
+			next = load > search->max / 2 ? search->max : load * 2;
+			return next;
+		}
+	} else {
+		*hi = load;
+		if (load == 1)
+			return 0;
+	}
+
+	if (*hi - *lo <= (*lo / 20 ?: 1))
+		return 0;
+	next = *lo + (*hi - *lo) / 2;
+	return next == *lo ? 0 : next;
+}
+
+int
+pf_search_run (pf_search_t *search, pf_ctl_t *ctl, pf_stat_t *stat)
+{
+	pf_search_sample_t *a, *b;
+	pf_search_stage_t stages[PF_SEARCH_STAGES_MAX], *st, *best = NULL,
+		*knee = NULL;
+	uint n, lo = 0, hi = 0, backoffs = 0, load;
+
+	a = malloc (sizeof (*a));
+	b = malloc (sizeof (*b));
+	if (!a || !b) BAIL ("malloc (pf_search_sample_t)");
+
+	printf ("search   %s, %s, p99 within %.3f ms, %us stages\n",
+			pf_search_by_name (search),
+			search->how == PF_SEARCH_AIMD ? "aimd" : "bisect",
+			search->slo_ns / 1e6, search->stage_sec);
+
+	for (n=0; n<PF_SEARCH_STAGES_MAX; n++) {
+		st = &stages[n];
+		if (pf_search_stage (search, ctl, stat, a, b, st) < 0)
+			break;
+
+		load = pf_search_next (search, st, &lo, &hi, &backoffs);
+		if (!load) {
+			n++;
+			break;
+		}
+		pf_search_set (search, ctl, load);
+	}
+
+	// best: most throughput within budget; knee: where throughput per
+	// unit of latency peaks, past which load mostly buys queueing
+	for (st=stages; st<stages+n; st++) {
+		if (st->ok && (!best || st->rt_per_sec > best->rt_per_sec))
+			best = st;
+		if (st->p99_ns && (!knee || st->rt_per_sec / st->p99_ns
+					> knee->rt_per_sec / knee->p99_ns))
+			knee = st;
+	}
+
+	printf ("\n");
+	if (best)
+		printf ("best     %s %u: %.0f rt/s, p99 %.3f ms within %.3f ms\n",
+				pf_search_by_name (search), best->load,
+				best->rt_per_sec, best->p99_ns / 1e6,
+				search->slo_ns / 1e6);
+	else
+		printf ("best     no stage met p99 within %.3f ms\n",
+				search->slo_ns / 1e6);
+	if (knee)
+		printf ("knee     %s %u: %.0f rt/s, p99 %.3f ms\n",
+				pf_search_by_name (search), knee->load,
+				knee->rt_per_sec, knee->p99_ns / 1e6);
+
+	free (a);
+	free (b);
+	return best ? 0 : -ERANGE;
+}
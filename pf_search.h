@@ -0,0 +1,53 @@
+#ifndef __included__pf_search_h__
+#define __included__pf_search_h__
+
+#include <stdint.h>
+
+struct pf_conf_s;
+struct pf_ctl_s;
+struct pf_stat_s;
+
+/*
+ * Capacity search: run the test in stages, each at a fixed load, and
+ * steer the load through pf_ctl until the highest one whose p99 round
+ * trip latency stays within the budget is found.  The load is either
+ * the active agents per thread or the new connection rate.
+ *
+ * aimd adds the starting load after every stage that meets the budget
+ * and halves it after one that does not, until it has backed off three
+ * times.  bisect doubles until the budget is broken, then bisects down
+ * to 5% between the best good and the worst bad load.
+ */
+
+enum pf_search_by_e {
+	PF_SEARCH_AGENTS,
+	PF_SEARCH_RATE,
+};
+
+enum pf_search_how_e {
+	PF_SEARCH_AIMD,
+	PF_SEARCH_BISECT,
+};
+
+typedef struct pf_search_s {
+	uint64_t                slo_ns;         // p99 budget
+	enum pf_search_by_e     by;
+	enum pf_search_how_e    how;
+	uint                    stage_sec;      // measured, after 1s settling
+	uint                    start;          // first load tried
+	uint                    max;            // never go above
+} pf_search_t;
+
+// p99=<time>[,by=agents|rate][,how=aimd|bisect][,stage=<sec>]
+// [,start=<n>][,max=<n>]
+extern int pf_search_parse (pf_search_t *search, const char *args,
+		const struct pf_conf_s *conf);
+
+// starting load, to be set before the threads start
+extern void pf_search_prepare (pf_search_t *search, struct pf_ctl_s *ctl);
+
+// steer the running test until the search is over, then report
+extern int pf_search_run (pf_search_t *search, struct pf_ctl_s *ctl,
+		struct pf_stat_s *stat);
+
+#endif // __included__pf_search_h__
@@ -0,0 +1,151 @@
+#include <stdint.h>
+#include <string.h>
+#include <endian.h>
+
+#include "pf_sha256.h"
+
+static const uint32_t pf_sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static inline uint32_t
+pf_sha256_rotr (uint32_t x, uint r)
+{
+	return (x >> r) | (x << (32 - r));
+}
+
+// one 64 byte block
+static void
+pf_sha256_block (uint32_t *h, const uint8_t *p)
+{
+	uint32_t w[64], a, b, c, d, e, f, g, k, t1, t2;
+	uint i;
+
+	for (i=0; i<16; i++) {
+		memcpy (&w[i], p + 4*i, 4);
+		w[i] = be32toh (w[i]);
+	}
+	for (; i<64; i++)
+		w[i] = w[i-16] + w[i-7]
+			+ (pf_sha256_rotr (w[i-15], 7)
+				^ pf_sha256_rotr (w[i-15], 18) ^ (w[i-15] >> 3))
+			+ (pf_sha256_rotr (w[i-2], 17)
+				^ pf_sha256_rotr (w[i-2], 19) ^ (w[i-2] >> 10));
+
+	a = h[0]; b = h[1]; c = h[2]; d = h[3];
+	e = h[4]; f = h[5]; g = h[6]; k = h[7];
+
+	for (i=0; i<64; i++) {
+		t1 = k + (pf_sha256_rotr (e, 6) ^ pf_sha256_rotr (e, 11)
+				^ pf_sha256_rotr (e, 25))
+			+ ((e & f) ^ (~e & g)) + pf_sha256_k[i] + w[i];
+		t2 = (pf_sha256_rotr (a, 2) ^ pf_sha256_rotr (a, 13)
+				^ pf_sha256_rotr (a, 22))
+			+ ((a & b) ^ (a & c) ^ (b & c));
+		k = g; g = f; f = e; e = d + t1;
+		d = c; c = b; b = a; a = t1 + t2;
+	}
+
+	h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+	h[4] += e; h[5] += f; h[6] += g; h[7] += k;
+}
+
+void
+pf_sha256_init (pf_sha256_t *s)
+{
+	static const uint32_t iv[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+		0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+	};
+
+	memcpy (s->h, iv, sizeof (iv));
+	s->len = 0;
+}
+
+void
+pf_sha256_update (pf_sha256_t *s, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+	uint have = s->len % 64, n;
+
+	s->len += len;
+
+	// top up what an earlier call left
+	if (have) {
+		n = 64 - have < len ? 64 - have : len;
+		memcpy (s->buf + have, p, n);
+		p += n;
+		len -= n;
+		if (have + n < 64)
+			return;
+		pf_sha256_block (s->h, s->buf);
+	}
+
+	for (; len >= 64; p += 64, len -= 64)
+		pf_sha256_block (s->h, p);
+	memcpy (s->buf, p, len);
+}
+
+void
+pf_sha256_final (pf_sha256_t *s, uint8_t out[PF_SHA256_LEN])
+{
+	uint64_t bits = htobe64 (s->len * 8);
+	uint8_t pad[72] = { 0x80 };
+	uint i;
+
+	// a one bit, zeros up to 56 mod 64, then the length in bits
+	pf_sha256_update (s, pad, 1 + (119 - s->len % 64) % 64);
+	pf_sha256_update (s, &bits, sizeof (bits));
+
+	for (i=0; i<8; i++) {
+		uint32_t v = htobe32 (s->h[i]);
+
+		memcpy (out + 4*i, &v, 4);
+	}
+}
+
+void
+pf_hmac_sha256 (const void *key, size_t key_len, const void *data,
+		size_t len, uint8_t out[PF_SHA256_LEN])
+{
+	uint8_t k[64] = { 0 }, pad[64];
+	pf_sha256_t s;
+	uint i;
+
+	// a key longer than a block is hashed down first
+	if (key_len > sizeof (k)) {
+		pf_sha256_init (&s);
+		pf_sha256_update (&s, key, key_len);
+		pf_sha256_final (&s, k);
+	} else
+		memcpy (k, key, key_len);
+
+	for (i=0; i<64; i++)
+		pad[i] = k[i] ^ 0x36;
+	pf_sha256_init (&s);
+	pf_sha256_update (&s, pad, sizeof (pad));
+	pf_sha256_update (&s, data, len);
+	pf_sha256_final (&s, out);
+
+	for (i=0; i<64; i++)
+		pad[i] = k[i] ^ 0x5c;
+	pf_sha256_init (&s);
+	pf_sha256_update (&s, pad, sizeof (pad));
+	pf_sha256_update (&s, out, PF_SHA256_LEN);
+	pf_sha256_final (&s, out);
+}
@@ -0,0 +1,31 @@
+#ifndef __included__pf_sha256_h__
+#define __included__pf_sha256_h__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * SHA-256 and HMAC-SHA256, for the distributed run handshake: a worker
+ * challenges a coordinator with a nonce, and the answer is a MAC keyed
+ * with the shared token, so the token itself never goes on the wire and
+ * an answer seen once is no good for the next nonce.  Only a few short
+ * messages per run go through it; it is plain and not tuned.
+ */
+
+#define PF_SHA256_LEN           32
+
+typedef struct pf_sha256_s {
+	uint32_t                h[8];
+	uint64_t                len;            // total so far
+	uint8_t                 buf[64];        // len % 64 bytes not taken
+} pf_sha256_t;
+
+extern void pf_sha256_init (pf_sha256_t *s);
+extern void pf_sha256_update (pf_sha256_t *s, const void *data, size_t len);
+extern void pf_sha256_final (pf_sha256_t *s, uint8_t out[PF_SHA256_LEN]);
+
+// RFC 2104, with SHA-256
+extern void pf_hmac_sha256 (const void *key, size_t key_len,
+		const void *data, size_t len, uint8_t out[PF_SHA256_LEN]);
+
+#endif // __included__pf_sha256_h__
@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "pf_dbg.h"
+#include "pf_conf.h"
+#include "pf_module.h"
+#include "pf_sockopt.h"
+
+static const struct {
+	const char     *name;
+	const char     *opts;
+} pf_sockopt_profiles[] = {
+	{ "default",    "" },
+	{ "latency",    "nodelay,quickack,fastopen" },
+	{ "bulk",       "rcvbuf=4m,sndbuf=4m" },
+	{ NULL }
+};
+
+int
+pf_sockopt_parse (pf_conf_t *conf, const char *args)
+{
+	char *list, *tok, *save, *expanded, *p;
+	size_t len = 1;
+	uint i;
+	int rc;
+	pf_module_opt_t opts[] = {
+		{ "nodelay",    PF_OPT_FLAG,    &conf->so_nodelay },
+		{ "quickack",   PF_OPT_FLAG,    &conf->so_quickack },
+		{ "fastopen",   PF_OPT_FLAG,    &conf->so_fastopen },
+		{ "rcvbuf",     PF_OPT_SIZE,    &conf->so_rcvbuf },
+		{ "sndbuf",     PF_OPT_SIZE,    &conf->so_sndbuf },
+		{ NULL }
+	};
+
+	// profiles expand in place; nothing they hold is longer than this
+	for (i=0; pf_sockopt_profiles[i].name; i++)
+		len += strlen (pf_sockopt_profiles[i].opts);
+	len = strlen (args) * (len + 1) + 1;
+
+	list = strdup (args);
+	p = expanded = calloc (1, len);
+	if (!list || !expanded) BAIL ("failed to allocate -s options");
+
+	for (tok = strtok_r (list, ",", &save); tok;
+			tok = strtok_r (NULL, ",", &save)) {
+		const char *add = tok;
+
+		for (i=0; pf_sockopt_profiles[i].name; i++)
+			if (!strcmp (tok, pf_sockopt_profiles[i].name))
+				add = pf_sockopt_profiles[i].opts;
+		if (!*add)
+			continue;
+
+		p += sprintf (p, "%s%s", p == expanded ? "" : ",", add);
+	}
+
+	rc = pf_module_parse_opts ("sockopt", expanded, opts);
+
+	free (expanded);
+	free (list);
+	return rc;
+}
+
+void
+pf_sockopt_describe (const pf_conf_t *conf, char *buf, size_t len)
+{
+	int n;
+
+	n = snprintf (buf, len, "%s%s%s",
+			conf->so_nodelay ? ",nodelay" : "",
+			conf->so_quickack ? ",quickack" : "",
+			conf->so_fastopen ? ",fastopen" : "");
+	if (conf->so_rcvbuf && n < len)
+		n += snprintf (buf + n, len - n, ",rcvbuf=%zu", conf->so_rcvbuf);
+	if (conf->so_sndbuf && n < len)
+		n += snprintf (buf + n, len - n, ",sndbuf=%zu", conf->so_sndbuf);
+
+	// drop the leading comma
+	if (*buf)
+		memmove (buf, buf + 1, strlen (buf));
+	else
+		snprintf (buf, len, "default");
+}
@@ -0,0 +1,30 @@
+#ifndef __included__pf_sockopt_h__
+#define __included__pf_sockopt_h__
+
+#include <sys/types.h>
+
+struct pf_conf_s;
+
+/*
+ * Socket options for every connection, from -s: a comma separated list
+ * of options and named profiles, later ones overriding earlier ones.
+ *
+ *   nodelay            TCP_NODELAY
+ *   quickack           TCP_QUICKACK after connect and after every read
+ *   fastopen           TCP_FASTOPEN_CONNECT, the request rides on the SYN
+ *                      once the server has handed out a cookie
+ *   rcvbuf=<size>      SO_RCVBUF
+ *   sndbuf=<size>      SO_SNDBUF
+ *
+ *   latency            nodelay,quickack,fastopen
+ *   bulk               rcvbuf=4m,sndbuf=4m
+ *   default            nothing
+ */
+
+extern int pf_sockopt_parse (struct pf_conf_s *conf, const char *args);
+
+// what is set, as -s would take it
+extern void pf_sockopt_describe (const struct pf_conf_s *conf, char *buf,
+		size_t len);
+
+#endif // __included__pf_sockopt_h__
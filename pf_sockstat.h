@@ -0,0 +1,13 @@
+#ifndef __included__pf_sockstat_h__
+#define __included__pf_sockstat_h__
+
+/*
+ * Socket counts from /proc/net/sockstat.  They cover the whole network
+ * namespace, not just pf's sockets, which is what matters for running out
+ * of ephemeral ports.
+ */
+
+// TCP sockets in TIME_WAIT, or -errno
+extern int pf_sockstat_time_wait (void);
+
+#endif // __included__pf_sockstat_h__
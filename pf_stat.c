@@ -0,0 +1,62 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "pf_stat.h"
+
+void
+pf_tstat_copy (pf_tstat_t *dst, const pf_tstat_t *src, uint no_backends,
+		uint64_t at_ns)
+{
+	pf_bstat_t *backend = dst->backend;
+	uint b;
+
+	memset (dst, 0, sizeof (*dst));
+	dst->backend = backend;
+
+#define X(n)    dst->n = tstat_read (src, n);
+	PF_TSTAT_COUNTERS (X)
+	PF_TSTAT_GAUGES (X)
+#undef X
+#define X(n)    pf_hist_merge (&dst->n, &src->n);
+	PF_TSTAT_HISTS (X)
+#undef X
+
+	dst->start_ns = tstat_read (src, start_ns);
+	dst->end_ns = at_ns;
+
+	for (b=0; b<no_backends && src->backend; b++) {
+		memset (&backend[b], 0, sizeof (backend[b]));
+		backend[b].completed = tstat_read (&src->backend[b], completed);
+		backend[b].failed = tstat_read (&src->backend[b], failed);
+		pf_hist_merge (&backend[b].rtt, &src->backend[b].rtt);
+	}
+}
+
+void
+pf_tstat_sub (pf_tstat_t *dst, const pf_tstat_t *prev, uint no_backends)
+{
+	uint b;
+
+#define X(n)    dst->n -= prev->n;
+	PF_TSTAT_COUNTERS (X)
+#undef X
+#define X(n)    pf_hist_sub (&dst->n, &prev->n);
+	PF_TSTAT_HISTS (X)
+#undef X
+	// measured once, before the run, so no part of it is warm-up
+	pf_hist_merge (&dst->floor, &prev->floor);
+
+	// what is left started when the copy was taken
+	if (prev->end_ns > dst->start_ns)
+		dst->start_ns = prev->end_ns < dst->end_ns
+			? prev->end_ns : dst->end_ns;
+
+	for (b=0; b<no_backends && dst->backend && prev->backend; b++) {
+		dst->backend[b].completed -= prev->backend[b].completed;
+		dst->backend[b].failed -= prev->backend[b].failed;
+		pf_hist_sub (&dst->backend[b].rtt, &prev->backend[b].rtt);
+	}
+}
@@ -1,31 +1,144 @@
 #ifndef __included__pf_stat_h__
 #define __included__pf_stat_h__
 
-#include <pthread.h>
+#include <stdint.h>
+
+#include "pf_hist.h"
+#include "pf_err.h"
+
+// per-thread, per-backend outcomes
+typedef struct pf_bstat_s {
+        uint64_t                completed;
+        uint64_t                failed;
+        pf_hist_t               rtt;
+} pf_bstat_t;
+
+// per-thread counters, only ever written by the owning thread, but read
+// live by others; update them with tstat_add() and read with tstat_read()
+typedef struct pf_tstat_s {
+        // wall clock of the run, in ns
+        uint64_t                start_ns;
+        uint64_t                end_ns;
+
+        // bytes moved by closed connections
+        uint64_t                send_bytes;
+        uint64_t                recv_bytes;
+
+        // agent storage, in bytes per agent
+        uint                    no_agents;
+        uint                    agent_hot_bytes;
+        uint                    agent_cold_bytes;
+
+        // agents with a connection in the last poll set
+        uint                    active;
+
+        // event loop cost, not counting time spent waiting in poll
+        uint64_t                loop_iterations;
+        uint64_t                loop_active;    // sum of active agents
+        uint64_t                loop_ns;
+
+        // request/response exchanges and their latency, in ns
+        uint64_t                round_trips;
+        pf_hist_t               rtt;
+
+        // responses: time to first byte and transfer time after it, in
+        // ns, and per connection goodput of the body, in bytes/sec
+        uint64_t                body_bytes;
+        pf_hist_t               ttfb;
+        pf_hist_t               xfer;
+        pf_hist_t               goodput;
+
+        // whole connections, from connect() to a successful end, in ns;
+        // unlike rtt it includes the handshake, with or without fast open
+        pf_hist_t               conn;
+
+        // what waiting adds: from a descriptor becoming ready to the
+        // thread noticing, measured before the run, in ns
+        pf_hist_t               floor;
+
+        // failed connections, by enum pf_err_e
+        uint64_t                errors[PF_ERR_MAX];
+
+        // fast open connections whose SYN data the server took, or not
+        uint64_t                tfo_hits;
+        uint64_t                tfo_misses;
+
+        // udp: datagrams sent, and replies that matched no request in
+        // flight, mostly ones that came after the timeout
+        uint64_t                dgram_sent;
+        uint64_t                dgram_late;
+
+        // http bodies checked against the expected length and hash:
+        // matching, of another length, or of the length but not the hash
+        uint64_t                verify_ok;
+        uint64_t                verify_bad_len;
+        uint64_t                verify_bad_hash;
+
+        // http responses that came with a content encoding, their body
+        // bytes as received and, with decode, as decoded, and the time
+        // decoding took, in ns
+        uint64_t                enc_responses;
+        uint64_t                enc_wire_bytes;
+        uint64_t                enc_decoded_bytes;
+        uint64_t                enc_decode_ns;
+
+        // one per conf->backend
+        pf_bstat_t             *backend;
+} pf_tstat_t;
 
 typedef struct pf_stat_s {
-        // use atomic macros for these
+        // use atomic macros for these; they may be shared between
+        // processes, so no locks
         uint                    __no_completed; 
         uint                    __no_failed;
 
-        // lock that protects above variables
-        pthread_mutex_t         __lock;
+        // one per thread
+        pf_tstat_t             *thread;
+        uint                    no_threads;
+
+        // the threads as they were when the warm-up ended, taken out of
+        // the report; NULL without a warm-up
+        pf_tstat_t             *warm;
 } pf_stat_t;
 
-#define stat_atomic_read(s,n) ({             \
-        uint __val;                          \
-        pthread_mutex_lock (&(s)->__lock);   \
-        __val = (s)->__##n;                  \
-        pthread_mutex_unlock (&(s)->__lock); \
-        __val;                               \
-        })
+// pf_tstat_t fields by kind: counters only grow, gauges are current
+// values, histograms merge
+#define PF_TSTAT_COUNTERS(X)                                            \
+        X(send_bytes) X(recv_bytes) X(round_trips) X(body_bytes)        \
+        X(loop_iterations) X(loop_active) X(loop_ns)                    \
+        X(tfo_hits) X(tfo_misses) X(dgram_sent) X(dgram_late)          \
+        X(verify_ok) X(verify_bad_len) X(verify_bad_hash)               \
+        X(enc_responses) X(enc_wire_bytes) X(enc_decoded_bytes)         \
+        X(enc_decode_ns)                                                \
+        PF_TSTAT_ERRORS (X)
+
+#define PF_TSTAT_GAUGES(X)                                              \
+        X(no_agents) X(agent_hot_bytes) X(agent_cold_bytes) X(active)
+
+#define PF_TSTAT_HISTS(X)                                               \
+        X(rtt) X(ttfb) X(xfer) X(goodput) X(conn) X(floor)
+
+#define tstat_add(ts,n,v) \
+        __atomic_store_n (&(ts)->n, (ts)->n + (v), __ATOMIC_RELAXED)
+#define tstat_set(ts,n,v) \
+        __atomic_store_n (&(ts)->n, (v), __ATOMIC_RELAXED)
+#define tstat_read(ts,n) \
+        __atomic_load_n (&(ts)->n, __ATOMIC_RELAXED)
+
+#define stat_atomic_read(s,n) \
+        __atomic_load_n (&(s)->__##n, __ATOMIC_RELAXED)
+
+#define stat_atomic_inc(s,n) \
+        __atomic_fetch_add (&(s)->__##n, 1, __ATOMIC_RELAXED)
 
-#define stat_atomic_inc(s,n) ({              \
-        pthread_mutex_lock (&(s)->__lock);   \
-        (s)->__##n ++;                        \
-        pthread_mutex_unlock (&(s)->__lock); \
-        })
+// read a running thread's stats into dst, whose backend array must hold
+// no_backends; dst->end_ns is set to at_ns, when the copy was taken
+extern void pf_tstat_copy (pf_tstat_t *dst, const pf_tstat_t *src,
+                uint no_backends, uint64_t at_ns);
 
+// take an earlier copy out of dst, leaving what happened after it
+extern void pf_tstat_sub (pf_tstat_t *dst, const pf_tstat_t *prev,
+                uint no_backends);
 
 
 
@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+
+#include "pf_clock.h"
+#include "pf_think.h"
+
+int
+pf_think_parse (pf_think_t *think, const char *spec)
+{
+	const char *p = index (spec, ':');
+	char *end;
+	size_t n = p ? (size_t)(p - spec) : strlen (spec);
+
+	memset (think, 0, sizeof (*think));
+	if (!p)
+		return -EINVAL;
+	p++;
+
+	if (pf_clock_parse_time (p, &end, &think->a) < 0)
+		return -EINVAL;
+
+	if (!strncmp (spec, "fixed", n) && n == 5) {
+		think->dist = PF_THINK_FIXED;
+
+	} else if (!strncmp (spec, "exp", n) && n == 3) {
+		think->dist = PF_THINK_EXP;
+
+	} else if (!strncmp (spec, "uniform", n) && n == 7) {
+		think->dist = PF_THINK_UNIFORM;
+		if (*end != ':' || pf_clock_parse_time (end+1, &end,
+					&think->b) < 0 || think->b < think->a)
+			return -EINVAL;
+
+	} else if (!strncmp (spec, "pareto", n) && n == 6) {
+		think->dist = PF_THINK_PARETO;
+		if (*end != ':')
+			return -EINVAL;
+		think->alpha = strtod (end+1, &end);
+		if (think->alpha <= 0 || !think->a)
+			return -EINVAL;
+
+	} else {
+		return -EINVAL;
+	}
+
+	return *end ? -EINVAL : 0;
+}
+
+void
+pf_think_describe (const pf_think_t *think, char *buf, size_t len)
+{
+	switch (think->dist) {
+	case PF_THINK_NONE:
+		snprintf (buf, len, "none");
+		break;
+	case PF_THINK_FIXED:
+		snprintf (buf, len, "fixed %.3f ms", think->a / 1e6);
+		break;
+	case PF_THINK_UNIFORM:
+		snprintf (buf, len, "uniform %.3f..%.3f ms",
+				think->a / 1e6, think->b / 1e6);
+		break;
+	case PF_THINK_EXP:
+		snprintf (buf, len, "exponential, mean %.3f ms",
+				think->a / 1e6);
+		break;
+	case PF_THINK_PARETO:
+		snprintf (buf, len, "pareto, scale %.3f ms, shape %.2f%s",
+				think->a / 1e6, think->alpha,
+				think->alpha > 1 ? "" : " (no mean)");
+		break;
+	}
+}
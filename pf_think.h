@@ -0,0 +1,65 @@
+#ifndef __included__pf_think_h__
+#define __included__pf_think_h__
+
+#include <stdint.h>
+#include <math.h>
+
+#include "pf_rand.h"
+
+/*
+ * Think time: how long an agent waits after one connection is done
+ * before it opens the next, drawn per connection from a distribution.
+ * Agents also start after a think time of their own, so that large
+ * populations do not all fire at once.
+ */
+
+enum pf_think_dist_e {
+	PF_THINK_NONE,
+	PF_THINK_FIXED,         // a
+	PF_THINK_UNIFORM,       // between a and b
+	PF_THINK_EXP,           // exponential, mean a
+	PF_THINK_PARETO,        // scale a, shape alpha
+};
+
+typedef struct pf_think_s {
+	enum pf_think_dist_e    dist;
+	uint64_t                a;              // ns
+	uint64_t                b;              // ns
+	double                  alpha;
+} pf_think_t;
+
+// heavy tails are cut off here
+#define PF_THINK_MAX_NS         3600000000000ull
+
+// fixed:<t>, uniform:<t>:<t>, exp:<mean>, pareto:<scale>:<shape>; times
+// take an s, ms, us or ns suffix, ms without one
+extern int pf_think_parse (pf_think_t *think, const char *spec);
+extern void pf_think_describe (const pf_think_t *think, char *buf,
+		size_t len);
+
+static inline uint64_t
+pf_think_sample (const pf_think_t *think)
+{
+	double v;
+
+	switch (think->dist) {
+	case PF_THINK_NONE:
+		return 0;
+	case PF_THINK_FIXED:
+		return think->a;
+	case PF_THINK_UNIFORM:
+		return think->a + pf_rand_below (think->b - think->a + 1);
+	case PF_THINK_EXP:
+		v = -log1p (-pf_rand_double ()) * think->a;
+		break;
+	case PF_THINK_PARETO:
+		v = think->a / pow (1 - pf_rand_double (), 1 / think->alpha);
+		break;
+	default:
+		return 0;
+	}
+
+	return v < PF_THINK_MAX_NS ? (uint64_t)v : PF_THINK_MAX_NS;
+}
+
+#endif // __included__pf_think_h__
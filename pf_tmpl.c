@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "pf_ctx.h"
+#include "pf_rand.h"
+#include "pf_tmpl.h"
+
+// widest rendering of each variable
+#define PF_TMPL_U64_MAX         20
+#define PF_TMPL_UUID_LEN        36
+
+static const char pf_tmpl_hex[] = "0123456789abcdef";
+
+static void
+pf_tmpl_literal (pf_tmpl_t *t, const char *lit, size_t len)
+{
+	pf_tmpl_seg_t *s = &t->seg[t->no_segs++];
+
+	s->type = PF_TMPL_LITERAL;
+	s->lit = lit;
+	s->len = len;
+	t->len += len;
+}
+
+// {random:<a>-<b>}; returns the length parsed, 0 if it is not one
+static size_t
+pf_tmpl_parse_random (pf_tmpl_seg_t *s, const char *p)
+{
+	static const char prefix[] = "{random:";
+	const char *q = p + sizeof (prefix) - 1;
+	char *end;
+	uint64_t lo, hi;
+
+	if (strncmp (p, prefix, sizeof (prefix) - 1))
+		return 0;
+
+	lo = strtoull (q, &end, 10);
+	if (end == q || *end != '-')
+		return 0;
+	q = end + 1;
+	hi = strtoull (q, &end, 10);
+	if (end == q || *end != '}' || hi < lo)
+		return 0;
+
+	s->type = PF_TMPL_RANDOM;
+	s->lo = lo;
+	s->span = hi - lo + 1;          // 0 for the whole 64 bit range
+	return end + 1 - p;
+}
+
+int
+pf_tmpl_compile (pf_tmpl_t *t, const char *src)
+{
+	const char *p = src, *lit = src;
+	pf_tmpl_seg_t var;
+	size_t n;
+
+	memset (t, 0, sizeof (*t));
+
+	while ((p = strchr (p, '{'))) {
+		memset (&var, 0, sizeof (var));
+
+		if (!strncmp (p, "{counter}", n = 9)) {
+			var.type = PF_TMPL_COUNTER;
+			var.len = PF_TMPL_U64_MAX;
+		} else if (!strncmp (p, "{uuid}", n = 6)) {
+			var.type = PF_TMPL_UUID;
+			var.len = PF_TMPL_UUID_LEN;
+		} else if ((n = pf_tmpl_parse_random (&var, p))) {
+			var.len = PF_TMPL_U64_MAX;
+		} else if (!strncmp (p, "{random:", 8)) {
+			return -EINVAL;
+		} else {
+			p++;
+			continue;
+		}
+
+		if (t->no_vars == PF_TMPL_VARS_MAX)
+			return -E2BIG;
+
+		if (p > lit)
+			pf_tmpl_literal (t, lit, p - lit);
+		t->seg[t->no_segs++] = var;
+		t->no_vars++;
+		t->scratch += var.len;
+
+		p += n;
+		lit = p;
+	}
+
+	if (*lit)
+		pf_tmpl_literal (t, lit, strlen (lit));
+
+	return 0;
+}
+
+// decimal, without the formatting machinery of printf
+static size_t
+pf_tmpl_u64 (char *buf, uint64_t v)
+{
+	char tmp[PF_TMPL_U64_MAX];
+	size_t n = 0;
+
+	do {
+		tmp[sizeof (tmp) - ++n] = '0' + v % 10;
+		v /= 10;
+	} while (v);
+
+	memcpy (buf, tmp + sizeof (tmp) - n, n);
+	return n;
+}
+
+static size_t
+pf_tmpl_uuid (char *buf)
+{
+	uint64_t hi = pf_rand_u64 (), lo = pf_rand_u64 ();
+	uint i, n = 0;
+
+	// version 4, variant 10
+	hi = (hi & ~0xf000ull) | 0x4000ull;
+	lo = (lo & ~(3ull << 62)) | (2ull << 62);
+
+	for (i=0; i<32; i++) {
+		uint64_t w = i < 16 ? hi : lo;
+
+		if (i == 8 || i == 12 || i == 16 || i == 20)
+			buf[n++] = '-';
+		buf[n++] = pf_tmpl_hex[(w >> (60 - 4 * (i % 16))) & 0xf];
+	}
+
+	return n;
+}
+
+int
+pf_tmpl_out (const pf_tmpl_t *t, pf_ctx_t *ctx, char *scratch,
+		uint64_t counter)
+{
+	const pf_tmpl_seg_t *s;
+	size_t len;
+	int rc = 0;
+
+	for (s=t->seg; s<t->seg+t->no_segs && !rc; s++) {
+		switch (s->type) {
+		case PF_TMPL_LITERAL:
+			rc = pf_ctx_out_add (ctx, s->lit, s->len);
+			continue;
+		case PF_TMPL_COUNTER:
+			len = pf_tmpl_u64 (scratch, counter);
+			break;
+		case PF_TMPL_UUID:
+			len = pf_tmpl_uuid (scratch);
+			break;
+		case PF_TMPL_RANDOM:
+			len = pf_tmpl_u64 (scratch, s->lo + (s->span
+					? pf_rand_below (s->span)
+					: pf_rand_u64 ()));
+			break;
+		default:
+			continue;
+		}
+
+		rc = pf_ctx_out_add (ctx, scratch, len);
+		scratch += len;
+	}
+
+	return rc;
+}
@@ -0,0 +1,62 @@
+#ifndef __included__pf_tmpl_h__
+#define __included__pf_tmpl_h__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+struct pf_ctx_s;
+
+/*
+ * Request templates.  A string is compiled once, at setup, into literal
+ * segments and variable slots:
+ *
+ *   {counter}           1, 2, 3, ... unique across the threads of a run,
+ *                       and across the workers of a distributed one
+ *   {uuid}              a random version 4 uuid
+ *   {random:<a>-<b>}    a random number from a to b, inclusive
+ *
+ * Any other brace is literal.  Every request renders the variables into
+ * scratch space the caller keeps per agent, and queues the literals, in
+ * place, and the rendered values on the agent's output, so a vectored
+ * send puts the request together.  A request that changes every time
+ * costs little more than a constant one.
+ */
+
+// each variable splits a literal, and the output has PF_CTX_OUT_IOV
+// slots, one of which a body may take
+#define PF_TMPL_VARS_MAX        3
+#define PF_TMPL_SEGS_MAX        (2 * PF_TMPL_VARS_MAX + 1)
+
+enum pf_tmpl_seg_e {
+	PF_TMPL_LITERAL,
+	PF_TMPL_COUNTER,
+	PF_TMPL_UUID,
+	PF_TMPL_RANDOM,
+};
+
+typedef struct pf_tmpl_seg_s {
+	enum pf_tmpl_seg_e      type;
+	const char             *lit;            // literal: points into src
+	size_t                  len;
+	uint64_t                lo;             // random: lo + [0, span)
+	uint64_t                span;
+} pf_tmpl_seg_t;
+
+typedef struct pf_tmpl_s {
+	pf_tmpl_seg_t           seg[PF_TMPL_SEGS_MAX];
+	uint                    no_segs;
+	uint                    no_vars;
+	size_t                  scratch;        // bytes rendering needs
+	size_t                  len;            // literal bytes
+} pf_tmpl_t;
+
+// src must outlive the template; -EINVAL for a bad variable, -E2BIG for
+// too many
+extern int pf_tmpl_compile (pf_tmpl_t *t, const char *src);
+
+// queue a rendering on ctx's output, values written to scratch, which
+// holds t->scratch bytes; counter is what {counter} shows
+extern int pf_tmpl_out (const pf_tmpl_t *t, struct pf_ctx_s *ctx,
+		char *scratch, uint64_t counter);
+
+#endif // __included__pf_tmpl_h__
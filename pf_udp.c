@@ -0,0 +1,320 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <sys/socket.h>
+
+#include "pf_dbg.h"
+#include "pf_conf.h"
+#include "pf_ctx.h"
+#include "pf_module.h"
+#include "pf_udp.h"
+
+static pf_udp_conf_t udp_conf = {
+	.resp_max       = 2048,
+	.batch          = 64,
+};
+
+// the built-in module's request: the id, then the same payload for all
+static size_t udp_req_size = 64;
+static char *udp_tx;
+
+#define PF_UDP_ID_SIZE          sizeof (uint64_t)
+
+// per agent, the id of its request in flight
+typedef struct udp_agent_s {
+	uint64_t                id;
+	uint32_t                seq;
+} udp_agent_t;
+
+// no more than the kernel takes in one sendmmsg()
+#define PF_UDP_BATCH_MAX        1024
+
+static int
+udp_setup (pf_conf_t *conf, const char *args)
+{
+	uint timeout_ms = 1000;
+	size_t n;
+	int rc;
+	pf_module_opt_t opts[] = {
+		{ "req",        PF_OPT_SIZE,    &udp_req_size },
+		{ "resp",       PF_OPT_SIZE,    &udp_conf.resp_max },
+		{ "batch",      PF_OPT_UINT,    &udp_conf.batch },
+		{ "timeout",    PF_OPT_UINT,    &timeout_ms },
+		{ NULL }
+	};
+
+	rc = pf_module_parse_opts ("udp", args, opts);
+	if (rc<0)
+		return rc;
+
+	if (udp_req_size < PF_UDP_ID_SIZE || udp_req_size > 65507)
+		BAIL ("udp: req must be %zu to 65507 bytes", PF_UDP_ID_SIZE);
+	if (udp_conf.resp_max < PF_UDP_ID_SIZE)
+		BAIL ("udp: resp must hold at least the %zu byte id",
+				PF_UDP_ID_SIZE);
+	if (!udp_conf.batch || udp_conf.batch > PF_UDP_BATCH_MAX)
+		BAIL ("udp: batch must be 1 to %u", PF_UDP_BATCH_MAX);
+	if (!timeout_ms)
+		BAIL ("udp: timeout must be at least 1 ms");
+	if (conf->start_delay_sec || conf->close_delay_sec
+			|| conf->close_mode != PF_CLOSE_NORMAL)
+		BAIL ("udp: there are no connections to delay or close");
+
+	// recognizable, non-zero, pattern
+	udp_tx = malloc (udp_req_size);
+	if (!udp_tx)
+		BAIL ("failed to allocate the udp payload");
+	for (n=0; n<udp_req_size; n++)
+		udp_tx[n] = 'a' + n % 26;
+
+	udp_conf.timeout_ns = timeout_ms * 1000000ull;
+	conf->udp = &udp_conf;
+
+	printf ("%9zu bytes per request\n"
+		"%9zu bytes per reply, at most\n"
+		"%9u datagrams per system call, at most\n"
+		"%9u ms until a request is lost\n",
+		udp_req_size, udp_conf.resp_max, udp_conf.batch,
+		timeout_ms);
+
+	return 0;
+}
+
+static int
+udp_init (pf_ctx_t *ctx)
+{
+	if (!ctx->private_data
+			&& !(ctx->private_data = calloc (1, sizeof (udp_agent_t))))
+		return -ENOMEM;
+	return 0;
+}
+
+static void
+udp_fini (pf_ctx_t *ctx)
+{
+	free (ctx->private_data);
+}
+
+// the id says whose request a reply answers, and which one
+static int
+udp_request (pf_ctx_t *ctx, struct iovec *iov)
+{
+	udp_agent_t *a = ctx->private_data;
+
+	a->seq++;
+	a->id = (uint64_t)ctx->number << 32 | a->seq;
+
+	iov[0].iov_base = &a->id;
+	iov[0].iov_len = PF_UDP_ID_SIZE;
+	iov[1].iov_base = udp_tx + PF_UDP_ID_SIZE;
+	iov[1].iov_len = udp_req_size - PF_UDP_ID_SIZE;
+	return 2;
+}
+
+static int
+udp_agent (const pf_conf_t *conf, const void *buf, size_t len)
+{
+	uint64_t id;
+
+	if (len < PF_UDP_ID_SIZE)
+		return -1;
+	memcpy (&id, buf, PF_UDP_ID_SIZE);
+	return (int)(id >> 32);
+}
+
+static int
+udp_reply (pf_ctx_t *ctx, const void *buf, size_t len)
+{
+	const udp_agent_t *a = ctx->private_data;
+	uint64_t id;
+
+	memcpy (&id, buf, PF_UDP_ID_SIZE);
+	if (id != a->id)
+		return 1;
+
+	ctx->recv_cnt++;
+	return 0;
+}
+
+static int
+pf_udp_socket (const pf_conf_t *conf, const pf_backend_t *b)
+{
+	int fd, val;
+
+	fd = socket (b->addr.ss_family, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+	if (fd<0)
+		return -errno;
+
+	// a socket carries a whole batch, and more, at a time
+	if ((val = conf->so_rcvbuf) && setsockopt (fd, SOL_SOCKET, SO_RCVBUF,
+				&val, sizeof (val)) < 0)
+		BAIL ("setsockopt SO_RCVBUF %d", val);
+	if ((val = conf->so_sndbuf) && setsockopt (fd, SOL_SOCKET, SO_SNDBUF,
+				&val, sizeof (val)) < 0)
+		BAIL ("setsockopt SO_SNDBUF %d", val);
+	if ((val = conf->so_busy_poll))
+		setsockopt (fd, SOL_SOCKET, SO_BUSY_POLL, &val, sizeof (val));
+
+	// only the backend's datagrams come in, and its ICMP errors too
+	if (connect (fd, (const struct sockaddr *)&b->addr, b->addrlen) < 0) {
+		val = -errno;
+		close (fd);
+		return val;
+	}
+
+	return fd;
+}
+
+int
+pf_udp_init (pf_udp_t *u, const pf_conf_t *conf)
+{
+	const pf_udp_conf_t *uc = conf->udp;
+	uint b, n;
+	int fd;
+
+	memset (u, 0, sizeof (*u));
+	u->conf = uc;
+
+	u->out = calloc (conf->no_backends, sizeof (pf_udp_out_t));
+	u->in = calloc (uc->batch, sizeof (struct mmsghdr));
+	u->in_iov = calloc (uc->batch, sizeof (struct iovec));
+	u->rx = malloc (uc->batch * uc->resp_max);
+	if (!u->out || !u->in || !u->in_iov || !u->rx)
+		return -ENOMEM;
+
+	for (n=0; n<uc->batch; n++) {
+		u->in_iov[n].iov_base = u->rx + n * uc->resp_max;
+		u->in_iov[n].iov_len = uc->resp_max;
+		u->in[n].msg_hdr.msg_iov = &u->in_iov[n];
+		u->in[n].msg_hdr.msg_iovlen = 1;
+	}
+
+	for (b=0; b<conf->no_backends; b++) {
+		pf_udp_out_t *o = &u->out[b];
+
+		o->fd = -1;
+		o->msg = calloc (uc->batch, sizeof (struct mmsghdr));
+		o->slot = calloc (uc->batch, sizeof (pf_udp_slot_t));
+		if (!o->msg || !o->slot)
+			return -ENOMEM;
+		u->no_out++;
+
+		for (n=0; n<uc->batch; n++)
+			o->msg[n].msg_hdr.msg_iov = o->slot[n].iov;
+
+		fd = pf_udp_socket (conf, &conf->backend[b]);
+		if (fd<0) {
+			DBG (0, "udp socket to %s: %s\n", conf->backend[b].name,
+					strerror (-fd));
+			return fd;
+		}
+		o->fd = fd;
+	}
+
+	return 0;
+}
+
+void
+pf_udp_fini (pf_udp_t *u)
+{
+	uint b;
+
+	for (b=0; b<u->no_out; b++) {
+		if (u->out[b].fd >= 0)
+			close (u->out[b].fd);
+		free (u->out[b].msg);
+		free (u->out[b].slot);
+	}
+	free (u->out);
+	free (u->in);
+	free (u->in_iov);
+	free (u->rx);
+	memset (u, 0, sizeof (*u));
+}
+
+int
+pf_udp_queue (pf_udp_t *u, uint b)
+{
+	pf_udp_out_t *o = &u->out[b];
+
+	o->msg[o->cnt].msg_hdr.msg_iovlen = o->slot[o->cnt].iov_cnt;
+	o->cnt++;
+	return o->cnt == u->conf->batch;
+}
+
+uint
+pf_udp_flush (pf_udp_t *u, uint b, size_t *bytes, int *err)
+{
+	pf_udp_out_t *o = &u->out[b];
+	uint sent = 0, n;
+	int rc;
+
+	*err = 0;
+	while (sent < o->cnt) {
+		rc = sendmmsg (o->fd, o->msg + sent, o->cnt - sent,
+				MSG_DONTWAIT);
+		if (rc<0 && errno == EINTR)
+			continue;
+		if (rc<0) {
+			*err = -errno;
+			break;
+		}
+		for (n=sent; n<sent+rc; n++)
+			*bytes += o->msg[n].msg_len;
+		sent += rc;
+	}
+
+	o->blocked = *err == -EAGAIN;
+	return sent;
+}
+
+void
+pf_udp_drop (pf_udp_t *u, uint b, uint n)
+{
+	pf_udp_out_t *o = &u->out[b];
+	uint k;
+
+	o->cnt -= n;
+	if (!n || !o->cnt)
+		return;
+
+	// each message keeps pointing at its own slot
+	memmove (o->slot, o->slot + n, o->cnt * sizeof (*o->slot));
+	for (k=0; k<o->cnt; k++)
+		o->msg[k].msg_hdr.msg_iovlen = o->slot[k].iov_cnt;
+}
+
+int
+pf_udp_recv (pf_udp_t *u, uint b)
+{
+	int rc;
+
+	do {
+		rc = recvmmsg (u->out[b].fd, u->in, u->conf->batch,
+				MSG_DONTWAIT, NULL);
+	} while (rc<0 && errno == EINTR);
+
+	return rc<0 ? -errno : rc;
+}
+
+const void *
+pf_udp_reply (const pf_udp_t *u, uint n, size_t *len)
+{
+	*len = u->in[n].msg_len;
+	return u->in_iov[n].iov_base;
+}
+
+const pf_module_t pf_udp_module = {
+	PF_MODULE_INIT ("udp"),
+	.do_setup       = udp_setup,
+	.do_init        = udp_init,
+	.do_fini        = udp_fini,
+	.do_dgram_request = udp_request,
+	.do_dgram_agent = udp_agent,
+	.do_dgram_reply = udp_reply,
+};
@@ -0,0 +1,97 @@
+#ifndef __included__pf_udp_h__
+#define __included__pf_udp_h__
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+struct pf_conf_s;
+struct pf_module_s;
+
+/*
+ * Datagram transport.  A module that sets conf->udp in its do_setup
+ * sends requests rather than opening connections, through the
+ * do_dgram_* hooks: it builds each request, and tells which agent a
+ * reply is for.  pf_run schedules the agents, each one a request in
+ * flight, queues the requests to a backend and sends them in batches
+ * with sendmmsg(), and reaps replies in batches with recvmmsg(), on one
+ * connected socket per backend and thread.  A request with no reply
+ * within the timeout is lost.  A full send buffer keeps the batch
+ * queued until the socket is writable again.
+ *
+ * The built-in udp module is such a module: every request starts with
+ * an 8 byte id, the agent and its sequence number, and a reply has to
+ * start with the same 8 bytes, as an echo server's does.
+ */
+
+typedef struct pf_udp_conf_s {
+	size_t                  resp_max;       // longer replies are cut
+	uint                    batch;          // datagrams per system call
+	uint64_t                timeout_ns;     // then the request is lost
+} pf_udp_conf_t;
+
+// pieces of a request, at most
+#define PF_UDP_IOV              4
+
+// a queued request
+typedef struct pf_udp_slot_s {
+	uint32_t                agent;
+	uint                    iov_cnt;
+	struct iovec            iov[PF_UDP_IOV];
+} pf_udp_slot_t;
+
+// requests queued for one backend
+typedef struct pf_udp_out_s {
+	int                     fd;
+	uint                    cnt;
+	uint                    blocked;        // send buffer full
+	struct mmsghdr         *msg;
+	pf_udp_slot_t          *slot;           // per message
+} pf_udp_out_t;
+
+// one thread's sockets and batches
+typedef struct pf_udp_s {
+	const pf_udp_conf_t    *conf;
+	pf_udp_out_t           *out;
+	uint                    no_out;
+
+	struct mmsghdr         *in;
+	struct iovec           *in_iov;
+	char                   *rx;
+} pf_udp_t;
+
+// open a socket per backend; returns -errno
+extern int pf_udp_init (pf_udp_t *u, const struct pf_conf_s *conf);
+extern void pf_udp_fini (pf_udp_t *u);
+
+// the next slot for backend b, or NULL while the batch is full
+static inline pf_udp_slot_t *
+pf_udp_slot (pf_udp_t *u, uint b)
+{
+	pf_udp_out_t *o = &u->out[b];
+
+	return o->cnt < u->conf->batch ? &o->slot[o->cnt] : NULL;
+}
+
+// queue the request filled into the slot; returns non-zero once the
+// batch is full
+extern int pf_udp_queue (pf_udp_t *u, uint b);
+
+// send what is queued for b and return how many went out, adding their
+// bytes to *bytes; if not all, *err says why, -EAGAIN for a full send
+// buffer; the caller takes what it is done with off with pf_udp_drop()
+extern uint pf_udp_flush (pf_udp_t *u, uint b, size_t *bytes, int *err);
+
+// take the first n requests off b's queue; the rest move to the front
+extern void pf_udp_drop (pf_udp_t *u, uint b, uint n);
+
+// read a batch of replies from b; returns how many, or -errno, -EAGAIN
+// when there are none
+extern int pf_udp_recv (pf_udp_t *u, uint b);
+
+// reply n of the last batch, and its length
+extern const void *pf_udp_reply (const pf_udp_t *u, uint n, size_t *len);
+
+extern const struct pf_module_s pf_udp_module;
+
+#endif // __included__pf_udp_h__